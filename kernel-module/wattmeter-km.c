@@ -16,6 +16,7 @@
 #include <linux/interrupt.h>  // Required for the IRQ code
 #include <linux/kobject.h>    // Using kobjects for the sysfs bindings
 #include <linux/time.h>       // Using the clock to measure time between meter presses
+#include <linux/seqlock.h>    // Consistent count and timestamp for userspace
 //#define  DEBOUNCE_TIME 200    ///< The default bounce time -- 200ms
 #define  DEBOUNCE_TIME 0        /// No debounce 
  
@@ -42,6 +43,8 @@ static int    numWattHours = 0;            ///< For information, store the numbe
 static bool   ledOn = 0;                    ///< Is the LED on or off? Used to invert its state (off by default)
 static bool   isDebounce = 1;               ///< Use to store the debounce state (on by default)
 static struct timespec ts_last, ts_current, ts_diff;  ///< timespecs from linux/time.h (has nano precision)
+static seqcount_t pulseSeq = SEQCNT_ZERO(pulseSeq);   ///< Protects numWattHours and ts_last as a pair
+static struct kernfs_node *pulse_kn;                   ///< sysfs node of lastPulse, notified on each pulse
  
 /// Function prototype for the custom IRQ handler function -- see below for the implementation
 static irq_handler_t  tomasgpio_irq_handler(unsigned int irq, void *dev_id, struct pt_regs *regs);
@@ -65,7 +68,12 @@ static ssize_t numWattHours_show(struct kobject *kobj, struct kobj_attribute *at
  */
 static ssize_t numWattHours_store(struct kobject *kobj, struct kobj_attribute *attr,
                                    const char *buf, size_t count){
+   unsigned long flags;
+   local_irq_save(flags);                    // the IRQ handler is the other writer of pulseSeq
+   write_seqcount_begin(&pulseSeq);
    sscanf(buf, "%du", &numWattHours);
+   write_seqcount_end(&pulseSeq);
+   local_irq_restore(flags);
    return count;
 }
  
@@ -85,6 +93,22 @@ static ssize_t diffTime_show(struct kobject *kobj, struct kobj_attribute *attr,
    return sprintf(buf, "%lu.%.9lu\n", ts_diff.tv_sec, ts_diff.tv_nsec);
 }
  
+/** @brief Display the pulse count and the time of the last pulse in ns since the epoch
+ *  Both values are read under the same sequence count so they always belong to the same
+ *  pulse. The attribute is notified on every pulse, so userspace can poll() it for POLLPRI.
+ */
+static ssize_t lastPulse_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf){
+   unsigned int seq;
+   int count;
+   struct timespec ts;
+   do {
+      seq = read_seqcount_begin(&pulseSeq);
+      count = numWattHours;
+      ts = ts_last;
+   } while (read_seqcount_retry(&pulseSeq, seq));
+   return sprintf(buf, "%d %llu\n", count, (unsigned long long)timespec_to_ns(&ts));
+}
+ 
 /** @brief Displays if meter debouncing is on or off */
 static ssize_t isDebounce_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf){
    return sprintf(buf, "%d\n", isDebounce);
@@ -120,6 +144,7 @@ static struct kobj_attribute debounce_attr = __ATTR(isDebounce, 0664, isDebounce
 static struct kobj_attribute ledon_attr = __ATTR_RO(ledOn);     ///< the ledon kobject attr
 static struct kobj_attribute time_attr  = __ATTR_RO(lastTime);  ///< the last time pressed kobject attr
 static struct kobj_attribute diff_attr  = __ATTR_RO(diffTime);  ///< the difference in time attr
+static struct kobj_attribute pulse_attr = __ATTR_RO(lastPulse); ///< count and time of the last pulse attr
  
 /**  The tomas_attrs[] is an array of attributes that is used to create the attribute group below.
  *  The attr property of the kobj_attribute is used to extract the attribute struct
@@ -129,6 +154,7 @@ static struct attribute *tomas_attrs[] = {
       &ledon_attr.attr,                  ///< Is the LED on or off?
       &time_attr.attr,                   ///< Time of the last meter press in HH:MM:SS:NNNNNNNNN
       &diff_attr.attr,                   ///< The difference in time between the last two presses
+      &pulse_attr.attr,                  ///< Count and time of the last pulse in ns, pollable
       &debounce_attr.attr,               ///< Is the debounce state true or false
       NULL,
 };
@@ -172,6 +198,15 @@ static int __init tomasMeter_init(void){
       kobject_put(tomas_kobj);                          // clean up -- remove the kobject sysfs entry
       return result;
    }
+   // look up the lastPulse node once, sysfs_notify() itself may sleep and cannot be used in the IRQ
+   {
+      struct kernfs_node *dir = sysfs_get_dirent(tomas_kobj->sd, gpioName);
+      if(dir){
+         pulse_kn = sysfs_get_dirent(dir, "lastPulse");
+         sysfs_put(dir);
+      }
+      if(!pulse_kn) printk(KERN_ALERT "TOMAS Meter: lastPulse cannot be polled\n");
+   }
    getnstimeofday(&ts_last);                          // set the last time to be the current time
    ts_diff = timespec_sub(ts_last, ts_last);          // set the initial time difference to be 0
  
@@ -213,10 +248,11 @@ static int __init tomasMeter_init(void){
  */
 static void __exit tomasMeter_exit(void){
    printk(KERN_INFO "TOMAS Meter: The meter was pressed %d times\n", numWattHours);
+   free_irq(irqNumber, NULL);               // Free the IRQ number first, the handler uses pulse_kn
+   if(pulse_kn) sysfs_put(pulse_kn);        // Release the lastPulse node
    kobject_put(tomas_kobj);                   // clean up -- remove the kobject sysfs entry
    gpio_set_value(gpioLED, 0);              // Turn the LED off, makes it clear the device was unloaded
    gpio_unexport(gpioLED);                  // Unexport the LED GPIO
-   free_irq(irqNumber, NULL);               // Free the IRQ number, no *dev_id required in this case
    gpio_unexport(gpioMeter);               // Unexport the Meter GPIO
    gpio_free(gpioLED);                      // Free the LED GPIO
    gpio_free(gpioMeter);                   // Free the Meter GPIO
@@ -237,10 +273,13 @@ static irq_handler_t tomasgpio_irq_handler(unsigned int irq, void *dev_id, struc
   //ledOn = !ledOn;                      // Invert the LED state on each meter press
   //gpio_set_value(gpioLED, ledOn);      // Set the physical LED accordingly
    getnstimeofday(&ts_current);         // Get the current time as ts_current
+   write_seqcount_begin(&pulseSeq);     // lastPulse readers retry while we update
    ts_diff = timespec_sub(ts_current, ts_last);   // Determine the time difference between last 2 presses
    ts_last = ts_current;                // Store the current time as the last time ts_last
    //printk(KERN_INFO "TOMAS Meter: The meter state is currently: %d\n", gpio_get_value(gpioMeter));
    numWattHours++;                     // Global counter, will be outputted when the module is unloaded
+   write_seqcount_end(&pulseSeq);
+   if(pulse_kn) sysfs_notify_dirent(pulse_kn);   // Wake up poll() on lastPulse, safe in IRQ context
    return (irq_handler_t) IRQ_HANDLED;  // Announce that the IRQ has been handled correctly
 }
  
@@ -2,6 +2,9 @@
 #define CS_DEFS_H
 
 #define PORT (9123)
+#define QUERY_PORT (9124)
+#define METRICS_PORT (9125)
+#define COLLECTOR_PORT (9126)
 #define SRV_ADDRESS "192.168.1.184"
 
 typedef struct
@@ -9,6 +9,22 @@
  *
  *        | 4 bytes fileSize | fileSize number of bytes of contents |
  *
+ *        With -t count it instead subscribes to the live values with
+ *        traces on QUERY_PORT, shows every value as it arrives, and after
+ *        count pulses reports how long each hop took from the GPIO edge to
+ *        the value being shown:
+ *
+ *        | module   | edge to lastPulse read by the capture thread |
+ *        | capture  | waiting in the capture queue                 |
+ *        | compute  | compute stage and publish queue              |
+ *        | publish  | publish thread until the line is sent        |
+ *        | network  | server socket to arrival here                |
+ *        | client   | arrival here to shown                        |
+ *        | total    | edge to shown                                |
+ *
+ *        The server's clock is related to ours with SYNC, so the network
+ *        hop, and total, are only as good as half the sync round trip
+ *        which is reported along with them.
  *
  * \author Tomas Rosenkvist
  *
@@ -26,7 +42,40 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
 #include "CS-defs.h"
+#include "probes.h"
+
+#define NS_PER_S (1000000000LL)
+#define NS_PER_MS (1000000.0)
+#define TRACE_LINE (256)
+#define SYNC_SAMPLES (8)
+#define SYNC_S (16)
+
+typedef enum
+{
+    HOP_MODULE,
+    HOP_CAPTURE,
+    HOP_COMPUTE,
+    HOP_PUBLISH,
+    HOP_NETWORK,
+    HOP_CLIENT,
+    HOP_TOTAL,
+    NUM_HOPS
+} HopType;
+
+static const char *hopNames[NUM_HOPS] =
+    { "module", "capture", "compute", "publish", "network", "client", "total" };
+
+typedef struct
+{
+    int64_t offset[SYNC_SAMPLES];  /* Server CLOCK_MONOTONIC minus our CLOCK_REALTIME */
+    int64_t delay[SYNC_SAMPLES];   /* Round trip of the exchange */
+    int numSamples;
+    int next;
+} SyncStruct;
 
 
 /******************************************************************************/
@@ -57,6 +106,12 @@ static void usage(void)
 {
   printf("Fetches watt and kwh from server");
   printf("\n");
+  printf("  -a address  server to connect to, default %s", SRV_ADDRESS);
+  printf("\n");
+  printf("  -t count    show live values and report the latency of each hop");
+  printf("\n");
+  printf("              after count pulses");
+  printf("\n");
 }
 
 /******************************************************************************/
@@ -96,6 +151,249 @@ int readXBytes(int fd, uint8_t *buf, int numToRead)
 }
 
 
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Connect to a port on the server
+ *
+ * \param address, the server
+ * \param port, the port
+ * \return the socket, exits on failure
+ *
+ ******************************************************************************/
+static int connectServer(const char *address, int port)
+{
+    struct sockaddr_in serv_addr;
+    int sockfd;
+
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) error("ERROR opening socket");
+
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+
+    if(inet_pton(AF_INET, address, &serv_addr.sin_addr)<=0) error("inet_pton error occured");
+    if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0)
+        {
+            int err = errno;
+            printf("connect() failed with errno %d", err);
+            error("connect() failed.");
+        }
+    PROBE1(request__connect, port);
+    return sockfd;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Add the answer to a SYNC request, and get the offset of the sample with
+ * the shortest round trip, the one least disturbed by queueing
+ *
+ * \param sync, the samples
+ * \param t1, our time of the request
+ * \param t2, the server's time of arrival
+ * \param t3, the server's time of the answer
+ * \param t4, our time of arrival
+ *
+ ******************************************************************************/
+static void syncSample(SyncStruct *sync, int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+    sync->offset[sync->next] = ((t2 - t1) + (t3 - t4)) / 2;
+    sync->delay[sync->next] = (t4 - t1) - (t3 - t2);
+    sync->next = (sync->next + 1) % SYNC_SAMPLES;
+    if (sync->numSamples < SYNC_SAMPLES) sync->numSamples++;
+}
+
+static int syncBest(const SyncStruct *sync)
+{
+    int i, best = 0;
+
+    for (i = 1; i < sync->numSamples; i++)
+        {
+            if (sync->delay[i] < sync->delay[best]) best = i;
+        }
+    return best;
+}
+
+static int compareNs(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Print the distribution of each hop
+ *
+ * \param hops, NUM_HOPS rows of n latencies in ns, sorted here
+ * \param n, the number of pulses
+ * \param uncertainty, of the network hop and total in ns
+ *
+ ******************************************************************************/
+static void printReport(int64_t *hops[], int n, int64_t uncertainty)
+{
+    int hop;
+
+    printf("%-8s %9s %9s %9s %9s %9s  (ms, %d pulses)\n", "hop", "min", "p50", "p90", "p99", "max", n);
+    for (hop = 0; hop < NUM_HOPS; hop++)
+        {
+            int64_t *v = hops[hop];
+
+            qsort(v, n, sizeof(int64_t), compareNs);
+            printf("%-8s %9.3f %9.3f %9.3f %9.3f %9.3f", hopNames[hop],
+                   v[0] / NS_PER_MS, v[n / 2] / NS_PER_MS, v[(n * 9) / 10] / NS_PER_MS,
+                   v[(n * 99) / 100] / NS_PER_MS, v[n - 1] / NS_PER_MS);
+            if (hop == HOP_NETWORK || hop == HOP_TOTAL) printf("  +-%.3f", uncertainty / NS_PER_MS);
+            printf("\n");
+        }
+}
+
+/******************************************************************************/
+/**
+ *
+ * Read what the server sent, with the kernel's time of arrival
+ *
+ * \return the number of bytes read, exits on failure
+ *
+ ******************************************************************************/
+static int receive(int sockfd, char *buf, int size, int64_t *arrived)
+{
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    ssize_t r;
+
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    r = recvmsg(sockfd, &msg, 0);
+    if (r <= 0) error("Server went away");
+
+    *arrived = nowNs();
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                {
+                    struct timespec ts;
+
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    *arrived = (int64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+                }
+        }
+    return r;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Show live values and collect the hops of count pulses, then report
+ *
+ * \param address, the server
+ * \param count, the number of pulses to collect
+ * \return 0 if successful, exits on failure
+ *
+ ******************************************************************************/
+static int traceReport(const char *address, int count)
+{
+    static const char cmd[] = "SUBSCRIBE TRACE\n";
+    unsigned long long ts, t1, t2, t3, at[NUM_HOPS];
+    char buf[TRACE_LINE], req[48];
+    char *start, *nl;
+    int64_t *hops[NUM_HOPS];
+    int64_t arrived, liveArrived = 0, shown = 0, offset, nextSync = 0;
+    struct pollfd pfd;
+    unsigned long long liveTs = 0;
+    double power, energy;
+    SyncStruct sync;
+    int sockfd, hop, len, n = 0, on = 1, numTraces = 0;
+
+    for (hop = 0; hop < NUM_HOPS; hop++)
+        {
+            hops[hop] = malloc(count * sizeof(int64_t));
+            if (hops[hop] == NULL) error("malloc() failed");
+        }
+    memset(&sync, 0, sizeof(sync));
+
+    sockfd = connectServer(address, QUERY_PORT);
+    setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    if (write(sockfd, cmd, sizeof(cmd) - 1) != sizeof(cmd) - 1) error("write() failed");
+
+    while (numTraces < count)
+        {
+            if (nowNs() >= nextSync)
+                {
+                    len = snprintf(req, sizeof(req), "SYNC %lld\n", (long long)nowNs());
+                    if (write(sockfd, req, len) != len) error("write() failed");
+                    nextSync = nowNs() + ((sync.numSamples < SYNC_SAMPLES) ? 1 : SYNC_S) * NS_PER_S;
+                }
+            pfd.fd = sockfd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, (nextSync - nowNs()) / 1000000 + 1) <= 0) continue;
+
+            n += receive(sockfd, buf + n, sizeof(buf) - 1 - n, &arrived);
+            start = buf;
+            while ((nl = memchr(start, '\n', buf + n - start)) != NULL)
+                {
+                    *nl = '\0';
+                    if (strncmp(start, "ERR", 3) == 0) error(start);
+                    if (sscanf(start, "SYNC %llu %llu %llu", &t1, &t2, &t3) == 3)
+                        {
+                            syncSample(&sync, t1, t2, t3, arrived);
+                        }
+                    else if (sscanf(start, "LIVE %llu %lf %lf", &ts, &power, &energy) == 3)
+                        {
+                            printf("Power: %.1f W  Consumption: %.4f Wh\n", power, energy);
+                            fflush(stdout);
+                            shown = nowNs();
+                            liveTs = ts;
+                            liveArrived = arrived;
+                            PROBE2(live__shown, ts, shown - arrived);
+                        }
+                    else if (sscanf(start, "TRACE %llu %llu %llu %llu %llu %llu", &ts,
+                                    &at[0], &at[1], &at[2], &at[3], &at[4]) == 6 &&
+                             ts == liveTs && sync.numSamples > 0)
+                        {
+                            /* The edge and the send are moved to our clock, the hops between are all the server's */
+                            offset = sync.offset[syncBest(&sync)];
+                            for (hop = HOP_MODULE; hop <= HOP_PUBLISH; hop++)
+                                {
+                                    hops[hop][numTraces] = at[hop + 1] - at[hop];
+                                }
+                            hops[HOP_NETWORK][numTraces] = liveArrived - ((int64_t)at[4] - offset);
+                            hops[HOP_CLIENT][numTraces] = shown - liveArrived;
+                            hops[HOP_TOTAL][numTraces] = shown - ((int64_t)at[0] - offset);
+                            numTraces++;
+                        }
+                    start = nl + 1;
+                }
+            n -= start - buf;
+            memmove(buf, start, n);
+            if (n == sizeof(buf) - 1) n = 0;
+        }
+    close(sockfd);
+
+    printReport(hops, count, sync.delay[syncBest(&sync)] / 2);
+    for (hop = 0; hop < NUM_HOPS; hop++) free(hops[hop]);
+    return 0;
+}
+
+
 /******************************************************************************/
 /**
  *
@@ -109,6 +407,8 @@ int readXBytes(int fd, uint8_t *buf, int numToRead)
  * 3. File and socket is closed
  *
  *
+ * \param -a address of the server
+ * \param -t count, report the latency of each hop over count pulses
  * \param -h print help
  * \return 0 if successful, otherwise 1
  *
@@ -119,17 +419,29 @@ int main(int argc, char *argv[])
     int sockfd;
     FILE *fd1;
     FILE *fd2;
-    struct sockaddr_in serv_addr;
     PowerReportStruct report;
 
     char *powerFile="/tmp/power";
     char *consumptionFile="/tmp/consumption";
+    const char *address = SRV_ADDRESS;
+    int traceCount = 0;
 
     /* Parse command line for required information */
-    while ((opt = getopt(argc, argv, "h")) != -1)
+    while ((opt = getopt(argc, argv, "a:t:h")) != -1)
       {
 	switch (opt)
 	  {
+	  case 'a':
+	    {
+	      address = optarg;
+	      break;
+	    }
+	  case 't':
+	    {
+	      traceCount = atoi(optarg);
+	      if (traceCount <= 0) error("Bad trace count");
+	      break;
+	    }
 	  case 'h':
 	    {
 	      usage();
@@ -144,6 +456,7 @@ int main(int argc, char *argv[])
 	  }
       }
 
+    if (traceCount > 0) return traceReport(address, traceCount);
 
     fd1 = fopen(powerFile, "w+");
     if (fd1 == 0) error("fopen() Failed");
@@ -151,25 +464,12 @@ int main(int argc, char *argv[])
     fd2 = fopen(consumptionFile, "w+");
     if (fd2 == 0) error("fopen() Failed");
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) error("ERROR opening socket");
-
-    bzero((char *) &serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(PORT);
-
-    if(inet_pton(AF_INET, SRV_ADDRESS, &serv_addr.sin_addr)<=0) error("inet_pton error occured");
-    retval = connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr));
-    if (retval < 0)
-        {
-            int err = errno;
-            printf("connect() failed with errno %d", err);
-            error("connect() failed.");
-       }
+    sockfd = connectServer(address, PORT);
 
     retval = readXBytes(sockfd, (uint8_t *)&report, sizeof(PowerReportStruct));
 
     if (retval != sizeof(PowerReportStruct)) error("Failed FileSize");
+    PROBE2(response__read, report.W, report.Wh);
 
     printf("Power:       %d W", report.W);
     printf("Consumption: %d Wh", report.Wh);
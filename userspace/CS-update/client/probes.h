@@ -0,0 +1,30 @@
+/******************************************************************************/
+/**
+ * \file probes.h
+ *
+ * \brief USDT probes of the client, for bpftrace and perf in production.
+ *
+ *        Built with make SDT=1 where sys/sdt.h is installed, otherwise the
+ *        probes are not compiled at all.
+ *
+ *        | request__connect | port          | connected to the server    |
+ *        | response__read   | W, Wh         | report read from PORT      |
+ *        | live__shown      | ts, ns        | live value shown with -t,  |
+ *        |                  |               | ns since it arrived        |
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef PROBES_H
+#define PROBES_H
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(power_client, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(power_client, name, a, b)
+#else
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#endif
+
+#endif
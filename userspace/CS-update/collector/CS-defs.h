@@ -0,0 +1,17 @@
+#ifndef CS_DEFS_H
+#define CS_DEFS_H
+
+#define PORT (9123)
+#define QUERY_PORT (9124)
+#define METRICS_PORT (9125)
+#define COLLECTOR_PORT (9126)
+#define SRV_ADDRESS "192.168.1.184"
+
+typedef struct
+{
+  uint32_t W;
+  uint32_t Wh;
+} PowerReportStruct;
+
+
+#endif
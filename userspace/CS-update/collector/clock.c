@@ -0,0 +1,101 @@
+/******************************************************************************/
+/**
+ * \file clock.c
+ *
+ * \brief Meter clock estimation, see clock.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include "clock.h"
+
+#define NS_PER_S (1000000000LL)
+
+void clockInit(ClockStruct *c)
+{
+  c->numSamples = 0;
+  c->next = 0;
+  c->valid = 0;
+  c->ref = 0;
+  c->offset = 0;
+  c->delay = 0;
+  c->drift = 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Slope of the offsets of the samples with a delay up to maxDelay, 0 if
+ * they are too few or too close in time
+ *
+ ******************************************************************************/
+static double fitDrift(const ClockStruct *c, int64_t maxDelay)
+{
+  const ClockSampleStruct *s;
+  double x, y, sx = 0, sy = 0, sxx = 0, sxy = 0, drift;
+  int64_t first = INT64_MAX, last = INT64_MIN;
+  int i, n = 0;
+
+  for (i = 0; i < c->numSamples; i++)
+    {
+      s = &c->samples[i];
+      if (s->delay > maxDelay) continue;
+      if (s->local < first) first = s->local;
+      if (s->local > last) last = s->local;
+    }
+  if (last - first < CLOCK_DRIFT_SPAN_S * NS_PER_S) return 0;
+
+  /* Relative to the reference, doubles lose the ns of the absolute times */
+  for (i = 0; i < c->numSamples; i++)
+    {
+      s = &c->samples[i];
+      if (s->delay > maxDelay) continue;
+      x = (double)(s->local - c->ref);
+      y = (double)(s->offset - c->offset);
+      sx += x;
+      sy += y;
+      sxx += x * x;
+      sxy += x * y;
+      n++;
+    }
+  if (n < 3 || n * sxx - sx * sx <= 0) return 0;
+  drift = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+  if (drift > CLOCK_MAX_DRIFT) drift = CLOCK_MAX_DRIFT;
+  if (drift < -CLOCK_MAX_DRIFT) drift = -CLOCK_MAX_DRIFT;
+  return drift;
+}
+
+void clockSample(ClockStruct *c, int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+  ClockSampleStruct *s = &c->samples[c->next];
+  const ClockSampleStruct *best;
+  int i;
+
+  s->local = t1 / 2 + t4 / 2;
+  s->offset = ((t2 - t1) + (t3 - t4)) / 2;
+  s->delay = (t4 - t1) - (t3 - t2);
+  if (s->delay < 0) s->delay = 0;
+  c->next = (c->next + 1) % CLOCK_SAMPLES;
+  if (c->numSamples < CLOCK_SAMPLES) c->numSamples++;
+
+  best = &c->samples[0];
+  for (i = 1; i < c->numSamples; i++)
+    {
+      if (c->samples[i].delay < best->delay) best = &c->samples[i];
+    }
+  c->ref = best->local;
+  c->offset = best->offset;
+  c->delay = best->delay;
+  c->drift = fitDrift(c, best->delay * CLOCK_DELAY_FACTOR + NS_PER_S / 1000);
+  c->valid = 1;
+}
+
+int clockToLocal(const ClockStruct *c, int64_t remote, int64_t *local)
+{
+  int64_t t;
+
+  if (!c->valid) return -1;
+  t = remote - c->offset;
+  *local = t - (int64_t)(c->drift * (double)(t - c->ref));
+  return 0;
+}
@@ -0,0 +1,81 @@
+/******************************************************************************/
+/**
+ * \file clock.h
+ *
+ * \brief Estimates how a meter's clock relates to the collector's.
+ *
+ *        Every CLOCK_SYNC_S the collector sends SYNC with its own time t1
+ *        and the meter answers with t2 and t3 on its CLOCK_MONOTONIC, see
+ *        subscribe.h in the server. With t4 noted on arrival, each round
+ *        trip gives, as in NTP,
+ *
+ *        | offset = ((t2 - t1) + (t3 - t4)) / 2 | delay = (t4 - t1) - (t3 - t2) |
+ *
+ *        The sample with the least delay of the last CLOCK_SAMPLES is the
+ *        least disturbed by queues on the way and sets the offset. The drift
+ *        is the slope of a least squares line through the samples whose
+ *        delay is within CLOCK_DELAY_FACTOR of it, once they span
+ *        CLOCK_DRIFT_SPAN_S. Meter times are then mapped onto the
+ *        collector's clock, whatever the meter's own wall clock says.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#define CLOCK_SAMPLES (16)
+#define CLOCK_SYNC_S (16)
+#define CLOCK_DELAY_FACTOR (2)
+#define CLOCK_DRIFT_SPAN_S (120)
+#define CLOCK_MAX_DRIFT (500e-6)
+
+typedef struct
+{
+  int64_t local;      /* Collector time of the sample, ns */
+  int64_t offset;     /* Meter minus collector, ns */
+  int64_t delay;      /* Round trip without the meter's time, ns */
+} ClockSampleStruct;
+
+typedef struct
+{
+  ClockSampleStruct samples[CLOCK_SAMPLES];
+  int numSamples;
+  int next;
+  int valid;          /* Set once there is a sample */
+  int64_t ref;        /* Collector time the offset is for, ns */
+  int64_t offset;     /* ns */
+  int64_t delay;      /* Of the sample the offset is from, ns */
+  double drift;       /* Meter ns per collector ns, minus 1 */
+} ClockStruct;
+
+void clockInit(ClockStruct *c);
+
+/******************************************************************************/
+/**
+ *
+ * Add a SYNC round trip and estimate again
+ *
+ * \param c, the clock
+ * \param t1, collector time the request was sent
+ * \param t2, meter time it arrived
+ * \param t3, meter time the answer was sent
+ * \param t4, collector time the answer arrived
+ * \return None
+ *
+ ******************************************************************************/
+void clockSample(ClockStruct *c, int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+/******************************************************************************/
+/**
+ *
+ * Map a meter time onto the collector's clock
+ *
+ * \return 0 if successful, -1 if there is no estimate yet
+ *
+ ******************************************************************************/
+int clockToLocal(const ClockStruct *c, int64_t remote, int64_t *local);
+
+#endif
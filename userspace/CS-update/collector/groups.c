@@ -0,0 +1,205 @@
+/******************************************************************************/
+/**
+ * \file groups.c
+ *
+ * \brief Groups of meters and their totals, see groups.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "groups.h"
+#include "query.h"
+
+int groupsInit(GroupsStruct *g)
+{
+  if (posix_memalign((void **)&g->groups, GROUPS_CACHE_LINE, GROUPS_MAX * sizeof(GroupStruct)) != 0)
+    {
+      return -1;
+    }
+  memset(&g->groups[0], 0, sizeof(GroupStruct));
+  strcpy(g->groups[0].name, "total");
+  g->count = 1;
+  g->cleared = 0;
+  return 0;
+}
+
+GroupStruct *groupsFind(const GroupsStruct *g, const char *name)
+{
+  int i;
+
+  for (i = 0; i < g->count; i++)
+    {
+      if (strcmp(g->groups[i].name, name) == 0) return &g->groups[i];
+    }
+  return NULL;
+}
+
+GroupStruct *groupsAdd(GroupsStruct *g, const char *name, const char *parent)
+{
+  GroupStruct *group, *up = &g->groups[0];
+
+  if (g->count == GROUPS_MAX || strlen(name) >= GROUP_NAME || groupsFind(g, name) != NULL)
+    {
+      return NULL;
+    }
+  if (parent != NULL && (up = groupsFind(g, parent)) == NULL) return NULL;
+
+  group = &g->groups[g->count++];
+  memset(group, 0, sizeof(*group));
+  strcpy(group->name, name);
+  group->parent = up;
+  return group;
+}
+
+void groupAddMeter(GroupStruct *group)
+{
+  for (; group != NULL; group = group->parent) group->meters++;
+}
+
+void groupPropagate(GroupStruct *group, int64_t power, int64_t energy, int64_t connected)
+{
+  for (; group != NULL; group = group->parent)
+    {
+      if (power != 0) __atomic_fetch_add(&group->power, power, __ATOMIC_RELAXED);
+      if (energy != 0) __atomic_fetch_add(&group->energy, energy, __ATOMIC_RELAXED);
+      if (connected != 0) __atomic_fetch_add(&group->connected, connected, __ATOMIC_RELAXED);
+    }
+}
+
+int groupAddEnergy(GroupStruct *group, time_t second, int64_t energy)
+{
+  time_t now = time(NULL);
+  int i = second % GROUP_SECONDS;
+
+  if (second < now - GROUP_HISTORY_S || second > now + GROUP_AHEAD_S - 2) return -1;
+  for (; group != NULL; group = group->parent)
+    {
+      __atomic_fetch_add(&group->seconds[i], energy, __ATOMIC_RELAXED);
+    }
+  return 0;
+}
+
+void groupsTick(GroupsStruct *g, time_t now)
+{
+  time_t t = g->cleared + 1;
+  int i;
+
+  if (t < now + GROUP_AHEAD_S - GROUP_SECONDS + 1) t = now + GROUP_AHEAD_S - GROUP_SECONDS + 1;
+  for (; t <= now + GROUP_AHEAD_S; t++)
+    {
+      for (i = 0; i < g->count; i++)
+	{
+	  __atomic_store_n(&g->groups[i].seconds[t % GROUP_SECONDS], 0, __ATOMIC_RELAXED);
+	}
+    }
+  g->cleared = now + GROUP_AHEAD_S;
+}
+
+/******************************************************************************/
+/**
+ *
+ *        | <name> <meters> <connected> <W> <Wh> |
+ *
+ ******************************************************************************/
+static void printGroup(FILE *out, const GroupStruct *group)
+{
+  fprintf(out, "%s %d %lld %.1f %.4f\n", group->name, group->meters,
+	  (long long)__atomic_load_n(&group->connected, __ATOMIC_RELAXED),
+	  __atomic_load_n(&group->power, __ATOMIC_RELAXED) / 1000.0,
+	  __atomic_load_n(&group->energy, __ATOMIC_RELAXED) / 1000.0);
+}
+
+/******************************************************************************/
+/**
+ *
+ * GROUP <name>
+ *
+ ******************************************************************************/
+static int queryGroup(void *ctx, FILE *out, int argc, char *argv[])
+{
+  GroupStruct *group;
+
+  if (argc != 2) return -1;
+  group = groupsFind(ctx, argv[1]);
+  if (group == NULL) fprintf(out, "ERR unknown group %s\n", argv[1]);
+  else printGroup(out, group);
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * GROUPS, one line per group below the total
+ *
+ *        | <parent> <name> <meters> <connected> <W> <Wh> |
+ ******************************************************************************/
+static int queryGroups(void *ctx, FILE *out, int argc, char *argv[])
+{
+  GroupsStruct *g = ctx;
+  int i;
+
+  (void)argc;
+  (void)argv;
+  for (i = 1; i < g->count; i++)
+    {
+      fprintf(out, "%s ", g->groups[i].parent->name);
+      printGroup(out, &g->groups[i]);
+    }
+  return 0;
+}
+
+static int queryTotal(void *ctx, FILE *out, int argc, char *argv[])
+{
+  GroupsStruct *g = ctx;
+
+  (void)argc;
+  (void)argv;
+  printGroup(out, &g->groups[0]);
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * SECONDS <group> [count]
+ *
+ * Energy of the last seconds, the latest may still grow as late pulses
+ * arrive
+ *
+ *        | <s since the epoch> <Wh> <average W> |
+ *
+ ******************************************************************************/
+static int querySeconds(void *ctx, FILE *out, int argc, char *argv[])
+{
+  GroupStruct *group;
+  time_t t, now = time(NULL);
+  int64_t energy;
+  int n = 10;
+
+  if (argc < 2 || argc > 3) return -1;
+  if (argc == 3) n = atoi(argv[2]);
+  if (n < 1 || n > GROUP_HISTORY_S) return -1;
+  group = groupsFind(ctx, argv[1]);
+  if (group == NULL)
+    {
+      fprintf(out, "ERR unknown group %s\n", argv[1]);
+      return 0;
+    }
+  for (t = now - n; t < now; t++)
+    {
+      energy = __atomic_load_n(&group->seconds[t % GROUP_SECONDS], __ATOMIC_RELAXED);
+      fprintf(out, "%lld %.4f %.1f\n", (long long)t, energy / 1000.0, energy * 3.6);
+    }
+  return 0;
+}
+
+void groupsRegisterQueries(GroupsStruct *g)
+{
+  queryRegister("GROUP", "<name>", queryGroup, g);
+  queryRegister("GROUPS", "", queryGroups, g);
+  queryRegister("TOTAL", "", queryTotal, g);
+  queryRegister("SECONDS", "<group> [count]", querySeconds, g);
+}
@@ -0,0 +1,156 @@
+/******************************************************************************/
+/**
+ * \file groups.h
+ *
+ * \brief Groups of meters, such as buildings and regions, and their totals.
+ *
+ *        Groups form a tree with the total of all meters at the top. They
+ *        are declared in the meters file, a parent before its children:
+ *
+ *        | group <name> [parent] |
+ *
+ *        and a group a meter names without declaring it is put right under
+ *        the total.
+ *
+ *        The totals are kept up to date as values arrive: when a meter
+ *        changes, the worker of its shard adds the difference to its group
+ *        and every group above it with atomic adds, so reading a group is
+ *        O(1) whatever its size. Values are kept as integers, mW and mWh,
+ *        so the sums never drift however many deltas they have taken. The
+ *        fields of a group are added to one at a time, a reader may see a
+ *        meter's new power with its old energy.
+ *
+ *        Each group also keeps the energy of the last GROUP_SECONDS
+ *        seconds of collector time, the pulses of every meter put in the
+ *        second they happened by the meter's clock estimate, see clock.h.
+ *        So a second's sum is right across meters whose own clocks
+ *        disagree. Buckets are zeroed GROUP_AHEAD_S before their second by
+ *        groupsTick(), the workers only ever add to them.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef GROUPS_H
+#define GROUPS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define GROUP_NAME (32)
+#define GROUPS_MAX (4096)
+#define GROUPS_CACHE_LINE (64)
+#define GROUP_SECONDS (64)
+#define GROUP_AHEAD_S (8)
+
+/* Seconds that can be added to and read, the ones before now */
+#define GROUP_HISTORY_S (GROUP_SECONDS - GROUP_AHEAD_S - 2)
+
+typedef struct GroupStruct GroupStruct;
+
+struct GroupStruct
+{
+  char name[GROUP_NAME];
+  GroupStruct *parent;      /* NULL for the total */
+  int meters;               /* In the group and below */
+  int64_t power __attribute__((aligned(GROUPS_CACHE_LINE)));  /* mW of connected meters */
+  int64_t energy;           /* mWh */
+  int64_t connected;        /* Connected meters */
+  int64_t seconds[GROUP_SECONDS];  /* mWh per second, at second % GROUP_SECONDS */
+};
+
+typedef struct
+{
+  GroupStruct *groups;      /* groups[0] is the total */
+  int count;
+  time_t cleared;           /* Buckets are zeroed up to this second */
+} GroupsStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Set up with only the total
+ *
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int groupsInit(GroupsStruct *g);
+
+/******************************************************************************/
+/**
+ *
+ * Declare a group
+ *
+ * \param g, the groups
+ * \param name, the new group
+ * \param parent, an existing group, NULL for right under the total
+ * \return the group, NULL if it exists, the parent does not or the table
+ *         is full
+ *
+ ******************************************************************************/
+GroupStruct *groupsAdd(GroupsStruct *g, const char *name, const char *parent);
+
+/******************************************************************************/
+/**
+ *
+ * Find a group by name, "total" is the total
+ *
+ * \return the group, NULL if there is no such group
+ *
+ ******************************************************************************/
+GroupStruct *groupsFind(const GroupsStruct *g, const char *name);
+
+/******************************************************************************/
+/**
+ *
+ * Count a meter in a group and the groups above it, while loading
+ *
+ ******************************************************************************/
+void groupAddMeter(GroupStruct *group);
+
+/******************************************************************************/
+/**
+ *
+ * Add the changes of one meter to a group and the groups above it, from
+ * any thread
+ *
+ * \param group, the innermost group of the meter
+ * \param power, change in mW
+ * \param energy, change in mWh
+ * \param connected, change in connected meters
+ * \return None
+ *
+ ******************************************************************************/
+void groupPropagate(GroupStruct *group, int64_t power, int64_t energy, int64_t connected);
+
+/******************************************************************************/
+/**
+ *
+ * Add energy in a second of collector time to a group and the groups above
+ * it, from any thread
+ *
+ * \param group, the innermost group of the meter
+ * \param second, s since the epoch, ignored if more than GROUP_HISTORY_S
+ *        old or GROUP_AHEAD_S ahead
+ * \param energy, mWh
+ * \return 0 if added, -1 if the second was out of range
+ *
+ ******************************************************************************/
+int groupAddEnergy(GroupStruct *group, time_t second, int64_t energy);
+
+/******************************************************************************/
+/**
+ *
+ * Zero the buckets of the seconds coming up, once a second from one thread
+ *
+ ******************************************************************************/
+void groupsTick(GroupsStruct *g, time_t now);
+
+/******************************************************************************/
+/**
+ *
+ * Add the GROUP, GROUPS, TOTAL and SECONDS query commands
+ *
+ ******************************************************************************/
+void groupsRegisterQueries(GroupsStruct *g);
+
+#endif
@@ -0,0 +1,167 @@
+/******************************************************************************/
+/**
+ * \file main.c
+ *
+ * \brief Collects live values and rollups from many power-update-servers.
+ *
+ *        Every meter in the meters file is subscribed to, see SUBSCRIBE in
+ *        the server, by the worker of its shard, see shard.h. Site, group
+ *        and total values are answered on COLLECTOR_PORT with the same
+ *        line based protocol as the server's QUERY_PORT:
+ *
+ *        | SITE <name> | SITES | GROUP <name> | GROUPS | TOTAL |
+ *        | SECONDS <group> [count] | CLOCKS | SHARDS |
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include "CS-defs.h"
+#include "groups.h"
+#include "meters.h"
+#include "query.h"
+#include "shard.h"
+
+const char *logFileName = "/tmp/power-collector.log";
+const char *storePrefix = "/tmp/power-collector";
+
+static GroupsStruct groups;
+static MetersStruct meters;
+static ShardRingStruct ring;
+static ShardStruct shards[SHARD_MAX];
+
+/******************************************************************************/
+/**
+ *
+ * Print a system error message on stdout, and exit with code 1
+ *
+ * \param msg The error message to be printed
+ * \return  None
+ *
+ ******************************************************************************/
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Print usage information regarding this program
+ *
+ * \param none
+ * \return none
+ *
+ ******************************************************************************/
+static void usage(void)
+{
+  printf("Subscribe to the meters in a file and answer queries on port 9126");
+  printf("\n");
+  printf("  -m file  meters to subscribe to, see meters.h");
+  printf("\n");
+  printf("  -w num   worker threads, one per core by default");
+  printf("\n");
+}
+
+/******************************************************************************/
+/**
+ *
+ * Entrypoint for power-collector
+ *
+ * The meters are spread over the shards and a worker is started for each,
+ * then queries are answered until the end of time.
+ *
+ * \param -h print help
+ * \param -m meters file
+ * \param -w number of workers
+ * \return Daemonizes
+ *
+ ******************************************************************************/
+int main(int argc, char *argv[])
+{
+  int32_t opt;
+  const char *metersFileName = NULL;
+  int numShards = sysconf(_SC_NPROCESSORS_ONLN);
+  struct pollfd fds[1];
+  FILE *logFd;
+  int i, line;
+
+  while ((opt = getopt(argc, argv, "hm:w:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'm':
+	  {
+	    metersFileName = optarg;
+	    break;
+	  }
+	case 'w':
+	  {
+	    numShards = atoi(optarg);
+	    break;
+	  }
+	case 'h':
+	  {
+	    usage();
+	    return 0;
+	  }
+	default:
+	  {
+	    usage();
+	    error("Unrecognized input");
+	    break;
+	  }
+	}
+    }
+  if (metersFileName == NULL)
+    {
+      usage();
+      error("No meters file");
+    }
+  if (numShards < 1) numShards = 1;
+  if (numShards > SHARD_MAX) numShards = SHARD_MAX;
+  if (groupsInit(&groups) != 0) error("Failed to allocate groups");
+  if (metersLoad(&meters, &groups, metersFileName, &line) != 0)
+    {
+      printf("Bad meters file %s at line %d\n", metersFileName, line);
+      error("Failed to load meters");
+    }
+
+  if (daemon(1,1) != 0) error("Failed to daemonize");
+
+  fds[0].fd = queryListen(COLLECTOR_PORT);
+  fds[0].events = POLLIN;
+  if (fds[0].fd < 0) error("ERROR on query socket");
+  metersRegisterQueries(&meters);
+  groupsRegisterQueries(&groups);
+  shardRegisterQueries(shards, numShards);
+
+  shardRingInit(&ring, numShards);
+  for (i = 0; i < meters.count; i++)
+    {
+      meters.meters[i].shard = shardRingFind(&ring, meters.meters[i].name);
+    }
+  groupsTick(&groups, time(NULL));
+  for (i = 0; i < numShards; i++)
+    {
+      if (shardStart(&shards[i], i, &meters, storePrefix) != 0) error("Failed to start shard");
+    }
+
+  logFd = fopen(logFileName, "a+");
+  fprintf(logFd, "Collector started, %d meters in %d shards\n", meters.count, numShards);
+  fclose(logFd);
+  for (;;)
+    {
+      groupsTick(&groups, time(NULL));
+      if (poll(fds, 1, 1000) <= 0) continue;
+      if (fds[0].revents & POLLIN) queryServe(fds[0].fd);
+    }
+  return 0;
+}
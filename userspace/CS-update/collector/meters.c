@@ -0,0 +1,225 @@
+/******************************************************************************/
+/**
+ * \file meters.c
+ *
+ * \brief The meters and their latest values, see meters.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CS-defs.h"
+#include "meters.h"
+#include "query.h"
+
+#define NS_PER_S (1000000000ULL)
+#define MAX_LINE (256)
+
+/******************************************************************************/
+/**
+ *
+ * A group declaration or a meter, whose group is created if need be
+ *
+ ******************************************************************************/
+static int parseLine(MeterStruct *meter, GroupsStruct *g, char *text)
+{
+  char *name, *host, *group, *port, *save;
+
+  name = strtok_r(text, " \t\r\n", &save);
+  host = strtok_r(NULL, " \t\r\n", &save);
+  group = strtok_r(NULL, " \t\r\n", &save);
+  if (host == NULL || strtok_r(NULL, " \t\r\n", &save) != NULL) return -1;
+  if (strcmp(name, "group") == 0) return (groupsAdd(g, host, group) != NULL) ? 1 : -1;
+  if (strlen(name) >= METER_NAME || strlen(host) >= METER_HOST) return -1;
+
+  memset(meter, 0, sizeof(*meter));
+  strcpy(meter->name, name);
+  strcpy(meter->host, host);
+  meter->group = &g->groups[0];
+  if (group != NULL)
+    {
+      meter->group = groupsFind(g, group);
+      if (meter->group == NULL) meter->group = groupsAdd(g, group, NULL);
+      if (meter->group == NULL) return -1;
+    }
+  meter->port = QUERY_PORT;
+  port = strchr(meter->host, ':');
+  if (port != NULL)
+    {
+      *port++ = '\0';
+      meter->port = atoi(port);
+      if (meter->port <= 0 || meter->port > 65535) return -1;
+    }
+  return 0;
+}
+
+int metersLoad(MetersStruct *m, GroupsStruct *g, const char *fileName, int *line)
+{
+  char text[MAX_LINE];
+  MeterStruct *meter;
+  FILE *fd;
+  char *p;
+  int r;
+
+  *line = 0;
+  fd = fopen(fileName, "r");
+  if (fd == NULL) return -1;
+  m->count = 0;
+  if (posix_memalign((void **)&m->meters, METERS_CACHE_LINE, METERS_MAX * sizeof(MeterStruct)) != 0)
+    {
+      fclose(fd);
+      return -1;
+    }
+
+  while (fgets(text, sizeof(text), fd) != NULL)
+    {
+      (*line)++;
+      p = strchr(text, '#');
+      if (p != NULL) *p = '\0';
+      p = text + strspn(text, " \t\r\n");
+      if (*p == '\0') continue;
+      meter = &m->meters[m->count];
+      r = (m->count == METERS_MAX) ? -1 : parseLine(meter, g, p);
+      if (r == 1) continue;
+      if (r != 0 || metersFind(m, meter->name) != NULL)
+	{
+	  fclose(fd);
+	  return -1;
+	}
+      groupAddMeter(meter->group);
+      m->count++;
+    }
+  fclose(fd);
+  return 0;
+}
+
+MeterStruct *metersFind(const MetersStruct *m, const char *name)
+{
+  int i;
+
+  for (i = 0; i < m->count; i++)
+    {
+      if (strcmp(m->meters[i].name, name) == 0) return &m->meters[i];
+    }
+  return NULL;
+}
+
+static int64_t milli(double x)
+{
+  return (int64_t)(x * 1000 + ((x < 0) ? -0.5 : 0.5));
+}
+
+void meterWrite(MeterStruct *meter, const MeterValuesStruct *v)
+{
+  uint32_t seq = meter->seq;
+  int64_t power = v->connected ? milli(v->power) : 0;
+  int64_t energy = milli(v->energy);
+
+  groupPropagate(meter->group, power - meter->addedPower, energy - meter->addedEnergy,
+		 v->connected - meter->values.connected);
+  meter->addedPower = power;
+  meter->addedEnergy = energy;
+
+  __atomic_store_n(&meter->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  meter->values = *v;
+  __atomic_store_n(&meter->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void meterRead(const MeterStruct *meter, MeterValuesStruct *v)
+{
+  uint32_t seq;
+
+  do
+    {
+      seq = __atomic_load_n(&meter->seq, __ATOMIC_ACQUIRE);
+      *v = meter->values;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+  while ((seq & 1) || __atomic_load_n(&meter->seq, __ATOMIC_RELAXED) != seq);
+}
+
+static void printMeter(FILE *out, const MeterStruct *meter)
+{
+  MeterValuesStruct v;
+
+  meterRead(meter, &v);
+  fprintf(out, "%s %s %d %llu %.1f %.4f\n", meter->name,
+	  (meter->group->parent != NULL) ? meter->group->name : "-",
+	  v.connected, (unsigned long long)(v.ts / NS_PER_S), v.power, v.energy);
+}
+
+/******************************************************************************/
+/**
+ *
+ * SITE <name>
+ *
+ *        | <name> <group> <connected> <s since the epoch> <W> <Wh> |
+ *
+ ******************************************************************************/
+static int querySite(void *ctx, FILE *out, int argc, char *argv[])
+{
+  MeterStruct *meter;
+
+  if (argc != 2) return -1;
+  meter = metersFind(ctx, argv[1]);
+  if (meter == NULL)
+    {
+      fprintf(out, "ERR unknown site %s\n", argv[1]);
+      return 0;
+    }
+  printMeter(out, meter);
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * SITES, one SITE line per meter
+ *
+ ******************************************************************************/
+static int querySites(void *ctx, FILE *out, int argc, char *argv[])
+{
+  MetersStruct *m = ctx;
+  int i;
+
+  (void)argc;
+  (void)argv;
+  for (i = 0; i < m->count; i++) printMeter(out, &m->meters[i]);
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * CLOCKS, how far off the clock of each meter is
+ *
+ *        | <name> <synced> <wall clock skew ms> <drift ppm> <delay ms> |
+ *
+ ******************************************************************************/
+static int queryClocks(void *ctx, FILE *out, int argc, char *argv[])
+{
+  MetersStruct *m = ctx;
+  MeterValuesStruct v;
+  int i;
+
+  (void)argc;
+  (void)argv;
+  for (i = 0; i < m->count; i++)
+    {
+      meterRead(&m->meters[i], &v);
+      fprintf(out, "%s %d %.3f %.3f %.3f\n", m->meters[i].name, v.synced, v.skew / 1e6,
+	      v.drift * 1e6, v.delay / 1e6);
+    }
+  return 0;
+}
+
+void metersRegisterQueries(MetersStruct *m)
+{
+  queryRegister("SITE", "<name>", querySite, m);
+  queryRegister("SITES", "", querySites, m);
+  queryRegister("CLOCKS", "", queryClocks, m);
+}
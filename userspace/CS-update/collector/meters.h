@@ -0,0 +1,114 @@
+/******************************************************************************/
+/**
+ * \file meters.h
+ *
+ * \brief The meters the collector subscribes to, and their latest values.
+ *
+ *        The meters file has one meter per line, # starts a comment:
+ *
+ *        | <name> <host>[:port] [group] |
+ *
+ *        The port defaults to QUERY_PORT. Groups are declared in the same
+ *        file, see groups.h. Each meter belongs to one shard,
+ *        whose worker is the only writer of its values. Queries read them
+ *        from another thread through a sequence count per meter, so there
+ *        is no lock between the workers and the queries, and none between
+ *        the workers.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef METERS_H
+#define METERS_H
+
+#include <stdint.h>
+#include "groups.h"
+
+#define METER_NAME (32)
+#define METER_HOST (64)
+#define METERS_MAX (16384)
+#define METERS_CACHE_LINE (64)
+
+typedef struct
+{
+  int connected;        /* Subscribed and receiving */
+  uint64_t ts;          /* Of the latest LIVE, ns since the epoch, collector clock */
+  double power;         /* W */
+  double energy;        /* Wh, the meter's total */
+  uint64_t updates;     /* LIVE lines received */
+  int synced;           /* There is a clock estimate, see clock.h */
+  int64_t skew;         /* Meter wall clock minus collector clock, ns */
+  double drift;         /* Meter clock rate minus 1 */
+  int64_t delay;        /* Round trip of the estimate, ns */
+} MeterValuesStruct;
+
+typedef struct
+{
+  char name[METER_NAME];
+  char host[METER_HOST];
+  GroupStruct *group;       /* Innermost group, the total if none */
+  int port;
+  int shard;
+  uint32_t seq __attribute__((aligned(METERS_CACHE_LINE)));  /* Odd while written */
+  MeterValuesStruct values;
+  int64_t addedPower;       /* What the values add to the groups, mW */
+  int64_t addedEnergy;      /* mWh */
+} MeterStruct;
+
+typedef struct
+{
+  MeterStruct *meters;
+  int count;
+} MetersStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Read the meters file
+ *
+ * \param m, filled in
+ * \param g, the groups, declared groups are added
+ * \param fileName, the meters file
+ * \param line, set to the offending line on failure, 0 if the file could
+ *        not be read
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int metersLoad(MetersStruct *m, GroupsStruct *g, const char *fileName, int *line);
+
+/******************************************************************************/
+/**
+ *
+ * Find a meter by name
+ *
+ * \return the meter, NULL if there is no such meter
+ *
+ ******************************************************************************/
+MeterStruct *metersFind(const MetersStruct *m, const char *name);
+
+/******************************************************************************/
+/**
+ *
+ * Update the values of a meter, only from the worker of its shard, and
+ * the totals of its groups
+ *
+ ******************************************************************************/
+void meterWrite(MeterStruct *meter, const MeterValuesStruct *v);
+
+/******************************************************************************/
+/**
+ *
+ * Take a consistent copy of the values of a meter, from any thread
+ *
+ ******************************************************************************/
+void meterRead(const MeterStruct *meter, MeterValuesStruct *v);
+
+/******************************************************************************/
+/**
+ *
+ * Add the SITE, SITES and CLOCKS query commands
+ *
+ ******************************************************************************/
+void metersRegisterQueries(MetersStruct *m);
+
+#endif
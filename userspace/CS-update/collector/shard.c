@@ -0,0 +1,456 @@
+/******************************************************************************/
+/**
+ * \file shard.c
+ *
+ * \brief Worker threads per shard of meters, see shard.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "query.h"
+#include "shard.h"
+
+#define NS_PER_S (1000000000ULL)
+#define NS_PER_MS (1000000ULL)
+#define EVENTS (64)
+
+typedef enum
+{
+  CONN_IDLE,
+  CONN_CONNECTING,
+  CONN_SUBSCRIBING,
+  CONN_SUBSCRIBED
+} ShardConnState;
+
+static uint64_t hash(const char *key)
+{
+  uint64_t h = 14695981039346656037ULL;
+
+  while (*key) h = (h ^ (unsigned char)*key++) * 1099511628211ULL;
+
+  /* FNV-1a alone leaves similar names close together on the ring */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static int comparePoints(const void *a, const void *b)
+{
+  const ShardPointStruct *pa = a, *pb = b;
+
+  return (pa->hash > pb->hash) - (pa->hash < pb->hash);
+}
+
+void shardRingInit(ShardRingStruct *r, int numShards)
+{
+  char key[32];
+  int i, v;
+
+  r->numPoints = 0;
+  for (i = 0; i < numShards && i < SHARD_MAX; i++)
+    {
+      for (v = 0; v < SHARD_VNODES; v++)
+	{
+	  snprintf(key, sizeof(key), "shard-%d-%d", i, v);
+	  r->points[r->numPoints].hash = hash(key);
+	  r->points[r->numPoints].shard = i;
+	  r->numPoints++;
+	}
+    }
+  qsort(r->points, r->numPoints, sizeof(r->points[0]), comparePoints);
+}
+
+int shardRingFind(const ShardRingStruct *r, const char *key)
+{
+  uint64_t h = hash(key);
+  int lo = 0, hi = r->numPoints;
+
+  while (lo < hi)
+    {
+      int mid = lo + (hi - lo) / 2;
+
+      if (r->points[mid].hash < h) lo = mid + 1;
+      else hi = mid;
+    }
+  return r->points[(lo == r->numPoints) ? 0 : lo].shard;
+}
+
+static void count(uint64_t *counter)
+{
+  __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t nsOf(const struct timespec *t)
+{
+  return (uint64_t)t->tv_sec * NS_PER_S + t->tv_nsec;
+}
+
+static void disconnect(ShardConnStruct *c, time_t now)
+{
+  if (c->fd >= 0) close(c->fd);
+  c->fd = -1;
+  c->state = CONN_IDLE;
+  c->haveEnergy = 0;
+  c->retryAt = now + c->backoff;
+  c->backoff = (c->backoff * 2 > SHARD_BACKOFF_MAX_S) ? SHARD_BACKOFF_MAX_S : c->backoff * 2;
+  if (c->values.connected)
+    {
+      c->values.connected = 0;
+      meterWrite(c->meter, &c->values);
+    }
+}
+
+static void connectMeter(ShardStruct *s, int i, time_t now)
+{
+  ShardConnStruct *c = &s->conns[i];
+  struct addrinfo hints, *res;
+  struct epoll_event ev;
+  char port[8];
+  int fd, r;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port, sizeof(port), "%d", c->meter->port);
+  if (getaddrinfo(c->meter->host, port, &hints, &res) != 0)
+    {
+      disconnect(c, now);
+      return;
+    }
+  fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  r = (fd < 0) ? -1 : connect(fd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (fd < 0 || (r != 0 && errno != EINPROGRESS))
+    {
+      if (fd >= 0) close(fd);
+      disconnect(c, now);
+      return;
+    }
+
+  c->fd = fd;
+  c->state = CONN_CONNECTING;
+  c->lastLine = now;
+  c->n = 0;
+  ev.events = EPOLLOUT;
+  ev.data.u32 = i;
+  epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev);
+  count(&s->connects);
+}
+
+static void subscribe(ShardStruct *s, int i, time_t now)
+{
+  static const char cmd[] = "SUBSCRIBE\n";
+  ShardConnStruct *c = &s->conns[i];
+  struct epoll_event ev;
+  socklen_t len = sizeof(int);
+  int err = 0, on = 1;
+
+  if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0
+      || send(c->fd, cmd, sizeof(cmd) - 1, MSG_NOSIGNAL) != sizeof(cmd) - 1)
+    {
+      disconnect(c, now);
+      return;
+    }
+  setsockopt(c->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+  c->state = CONN_SUBSCRIBING;
+  ev.events = EPOLLIN;
+  ev.data.u32 = i;
+  epoll_ctl(s->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Ask the meter for its clock, the reply is a sample for clock.h
+ *
+ ******************************************************************************/
+static void syncMeter(ShardConnStruct *c, time_t now)
+{
+  char line[48];
+  struct timespec t1;
+  int len;
+
+  clock_gettime(CLOCK_REALTIME, &t1);
+  len = snprintf(line, sizeof(line), "SYNC %llu\n", (unsigned long long)nsOf(&t1));
+  if (send(c->fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len)
+    {
+      disconnect(c, now);
+      return;
+    }
+  c->nextSync = now + ((c->clock.numSamples < CLOCK_FAST_SAMPLES) ? 1 : CLOCK_SYNC_S);
+}
+
+/******************************************************************************/
+/**
+ *
+ * A live value, its pulse put in the second it happened by the collector's
+ * clock
+ *
+ ******************************************************************************/
+static void live(ShardConnStruct *c, uint64_t ts, double power, double energy, int64_t mono, int haveMono)
+{
+  int64_t local;
+
+  if (haveMono && clockToLocal(&c->clock, mono, &local) == 0)
+    {
+      c->values.skew = (int64_t)ts - local;
+      ts = local;
+    }
+  if (c->haveEnergy && energy > c->values.energy)
+    {
+      groupAddEnergy(c->meter->group, ts / NS_PER_S,
+		     (int64_t)((energy - c->values.energy) * 1000 + 0.5));
+    }
+  c->haveEnergy = 1;
+  c->values.ts = ts;
+  c->values.power = power;
+  c->values.energy = energy;
+  c->values.updates++;
+  meterWrite(c->meter, &c->values);
+}
+
+static void handleLine(ShardStruct *s, ShardConnStruct *c, char *line, uint64_t arrived, time_t now)
+{
+  unsigned long long ts, t1, t2, t3, mono;
+  double power, energy;
+  int n, text;
+
+  c->lastLine = now;
+  count(&s->lines);
+  if ((n = sscanf(line, "LIVE %llu %lf %lf %llu", &ts, &power, &energy, &mono)) >= 3)
+    {
+      live(c, ts, power, energy, mono, n == 4);
+    }
+  else if (sscanf(line, "SYNC %llu %llu %llu", &t1, &t2, &t3) == 3)
+    {
+      clockSample(&c->clock, t1, t2, t3, arrived);
+      c->values.synced = 1;
+      c->values.drift = c->clock.drift;
+      c->values.delay = c->clock.delay;
+      meterWrite(c->meter, &c->values);
+    }
+  else if (sscanf(line, "ROW %llu %lf %lf", &ts, &power, &energy) == 3)
+    {
+      if (s->rows != NULL)
+	{
+	  fprintf(s->rows, "%s,%llu,%.1f,%.4f\n", c->meter->name, ts / NS_PER_S, power, energy);
+	}
+      count(&s->numRows);
+    }
+  else if (sscanf(line, "ALERT %llu %n", &ts, &text) == 1)
+    {
+      if (s->events != NULL)
+	{
+	  fprintf(s->events, "%s %llu %s\n", c->meter->name, ts / NS_PER_S, line + text);
+	}
+    }
+  else if (strcmp(line, "OK SUBSCRIBED") == 0)
+    {
+      /* The meter may have restarted, and its CLOCK_MONOTONIC with it */
+      clockInit(&c->clock);
+      c->state = CONN_SUBSCRIBED;
+      c->backoff = 1;
+      c->nextSync = now;
+      c->values.connected = 1;
+      c->values.synced = 0;
+      c->values.skew = 0;
+      meterWrite(c->meter, &c->values);
+    }
+  else if (strncmp(line, "ERR", 3) == 0)
+    {
+      disconnect(c, now);
+    }
+}
+
+/******************************************************************************/
+/**
+ *
+ * Read what the meter sent, with the kernel's time of arrival
+ *
+ ******************************************************************************/
+static void readMeter(ShardStruct *s, ShardConnStruct *c, time_t now)
+{
+  char control[CMSG_SPACE(sizeof(struct timespec))];
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  struct timespec ts;
+  uint64_t arrived;
+  char *start, *nl;
+  ssize_t r;
+
+  for (;;)
+    {
+      iov.iov_base = c->buf + c->n;
+      iov.iov_len = sizeof(c->buf) - c->n;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      r = recvmsg(c->fd, &msg, 0);
+      if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+      if (r <= 0)
+	{
+	  disconnect(c, now);
+	  return;
+	}
+      c->n += r;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+	  if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+	    {
+	      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+	    }
+	}
+      arrived = nsOf(&ts);
+
+      start = c->buf;
+      while ((nl = memchr(start, '\n', c->buf + c->n - start)) != NULL)
+	{
+	  *nl = '\0';
+	  if (nl > start && nl[-1] == '\r') nl[-1] = '\0';
+	  handleLine(s, c, start, arrived, now);
+	  if (c->fd < 0) return;
+	  start = nl + 1;
+	}
+      c->n -= start - c->buf;
+      memmove(c->buf, start, c->n);
+
+      /* No meter sends lines this long */
+      if (c->n == sizeof(c->buf))
+	{
+	  disconnect(c, now);
+	  return;
+	}
+    }
+}
+
+static void *shardThread(void *arg)
+{
+  ShardStruct *s = arg;
+  struct epoll_event events[EVENTS];
+  time_t now, lastScan = 0, lastSync = time(NULL);
+  ShardConnStruct *c;
+  int i, n, dirty = 0;
+
+  for (;;)
+    {
+      n = epoll_wait(s->epfd, events, EVENTS, 1000);
+      now = time(NULL);
+      for (i = 0; i < n; i++)
+	{
+	  c = &s->conns[events[i].data.u32];
+	  if (c->fd < 0) continue;
+	  if (c->state == CONN_CONNECTING) subscribe(s, events[i].data.u32, now);
+	  else readMeter(s, c, now);
+	  dirty = 1;
+	}
+
+      /* Reconnects and timeouts once a second */
+      if (now != lastScan)
+	{
+	  for (i = 0; i < s->numConns; i++)
+	    {
+	      c = &s->conns[i];
+	      if (c->fd < 0 && now >= c->retryAt) connectMeter(s, i, now);
+	      else if (c->fd >= 0 && now - c->lastLine > SHARD_TIMEOUT_S) disconnect(c, now);
+	      else if (c->state == CONN_SUBSCRIBED && now >= c->nextSync) syncMeter(c, now);
+	    }
+	  lastScan = now;
+	}
+
+      if (s->rows != NULL) fflush(s->rows);
+      if (s->events != NULL) fflush(s->events);
+      if (dirty && now - lastSync >= SHARD_SYNC_S)
+	{
+	  if (s->rows != NULL) fsync(fileno(s->rows));
+	  if (s->events != NULL) fsync(fileno(s->events));
+	  lastSync = now;
+	  dirty = 0;
+	}
+    }
+  return NULL;
+}
+
+int shardStart(ShardStruct *s, int id, MetersStruct *m, const char *prefix)
+{
+  char name[256];
+  int i, n = 0;
+
+  memset(s, 0, sizeof(*s));
+  s->id = id;
+  for (i = 0; i < m->count; i++) n += (m->meters[i].shard == id);
+  s->conns = calloc(n > 0 ? n : 1, sizeof(ShardConnStruct));
+  if (s->conns == NULL) return -1;
+  for (i = 0; i < m->count; i++)
+    {
+      if (m->meters[i].shard != id) continue;
+      s->conns[s->numConns].meter = &m->meters[i];
+      s->conns[s->numConns].fd = -1;
+      s->conns[s->numConns].backoff = 1;
+      s->numConns++;
+    }
+
+  snprintf(name, sizeof(name), "%s-%d.csv", prefix, id);
+  s->rows = fopen(name, "a");
+  snprintf(name, sizeof(name), "%s-%d-events.log", prefix, id);
+  s->events = fopen(name, "a");
+  s->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (s->epfd < 0) return -1;
+  return (pthread_create(&s->thread, NULL, shardThread, s) == 0) ? 0 : -1;
+}
+
+static ShardStruct *queryShards;
+static int queryNumShards;
+
+/******************************************************************************/
+/**
+ *
+ * SHARDS
+ *
+ *        | <shard> <meters> <connected> <lines> <rows> <connects> |
+ *
+ ******************************************************************************/
+static int queryShardStats(void *ctx, FILE *out, int argc, char *argv[])
+{
+  MeterValuesStruct v;
+  ShardStruct *s;
+  int i, k, connected;
+
+  (void)ctx;
+  (void)argc;
+  (void)argv;
+  for (i = 0; i < queryNumShards; i++)
+    {
+      s = &queryShards[i];
+      connected = 0;
+      for (k = 0; k < s->numConns; k++)
+	{
+	  meterRead(s->conns[k].meter, &v);
+	  connected += v.connected;
+	}
+      fprintf(out, "%d %d %d %llu %llu %llu\n", s->id, s->numConns, connected,
+	      (unsigned long long)__atomic_load_n(&s->lines, __ATOMIC_RELAXED),
+	      (unsigned long long)__atomic_load_n(&s->numRows, __ATOMIC_RELAXED),
+	      (unsigned long long)__atomic_load_n(&s->connects, __ATOMIC_RELAXED));
+    }
+  return 0;
+}
+
+void shardRegisterQueries(ShardStruct *shards, int numShards)
+{
+  queryShards = shards;
+  queryNumShards = numShards;
+  queryRegister("SHARDS", "", queryShardStats, NULL);
+}
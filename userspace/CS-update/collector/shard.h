@@ -0,0 +1,133 @@
+/******************************************************************************/
+/**
+ * \file shard.h
+ *
+ * \brief Worker threads, each subscribing to the meters of its shard.
+ *
+ *        Meters are spread over the shards by consistent hashing of their
+ *        names: every shard has SHARD_VNODES points on a 64 bit ring, and a
+ *        meter belongs to the first point after the hash of its name. The
+ *        shards get about even shares, and a changed shard count only moves
+ *        the meters of the shards that changed.
+ *
+ *        A worker owns everything of its meters: the connections, which it
+ *        waits on with epoll, their values, and its own storage files
+ *
+ *        | <prefix>-<shard>.csv        | name, start, average W, Wh |
+ *        | <prefix>-<shard>-events.log | name, s since the epoch, text |
+ *
+ *        that the 15 minute rows and alerts of its meters are appended to,
+ *        flushed per round and synced every SHARD_SYNC_S. Workers share
+ *        nothing, so ingest scales with the cores.
+ *
+ *        The worker also keeps an estimate of each meter's clock, see
+ *        clock.h, syncing every CLOCK_SYNC_S, and every second after a
+ *        subscription until there are CLOCK_FAST_SAMPLES. The pulses of a
+ *        meter are put in the seconds of its groups by that estimate.
+ *
+ *        A meter that cannot be reached, or is silent for SHARD_TIMEOUT_S,
+ *        is subscribed again after a backoff of 1 s doubling up to
+ *        SHARD_BACKOFF_MAX_S.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "clock.h"
+#include "meters.h"
+
+#define SHARD_MAX (64)
+#define SHARD_VNODES (256)
+#define SHARD_TIMEOUT_S (15)
+#define SHARD_BACKOFF_MAX_S (60)
+#define SHARD_SYNC_S (10)
+#define SHARD_LINE (256)
+#define CLOCK_FAST_SAMPLES (4)
+
+typedef struct
+{
+  uint64_t hash;
+  int shard;
+} ShardPointStruct;
+
+typedef struct
+{
+  ShardPointStruct points[SHARD_MAX * SHARD_VNODES];
+  int numPoints;
+} ShardRingStruct;
+
+typedef struct
+{
+  MeterStruct *meter;
+  MeterValuesStruct values;   /* The worker's copy, written to the meter */
+  ClockStruct clock;
+  time_t nextSync;
+  int haveEnergy;             /* values.energy is from this subscription */
+  int fd;
+  int state;                  /* ShardConnState */
+  time_t retryAt;
+  int backoff;                /* s */
+  time_t lastLine;
+  size_t n;                   /* Bytes in buf */
+  char buf[SHARD_LINE];
+} ShardConnStruct;
+
+typedef struct
+{
+  int id;
+  ShardConnStruct *conns;     /* One per meter of the shard */
+  int numConns;
+  int epfd;
+  FILE *rows;
+  FILE *events;
+  uint64_t lines;             /* Read from any thread */
+  uint64_t numRows;
+  uint64_t connects;
+  pthread_t thread;
+} ShardStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Set up the ring for a number of shards
+ *
+ ******************************************************************************/
+void shardRingInit(ShardRingStruct *r, int numShards);
+
+/******************************************************************************/
+/**
+ *
+ * The shard a key belongs to
+ *
+ ******************************************************************************/
+int shardRingFind(const ShardRingStruct *r, const char *key);
+
+/******************************************************************************/
+/**
+ *
+ * Start the worker of a shard, for the meters with meter->shard == id
+ *
+ * \param s, the shard
+ * \param id, the shard number
+ * \param m, all meters
+ * \param prefix, path prefix of the storage files
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int shardStart(ShardStruct *s, int id, MetersStruct *m, const char *prefix);
+
+/******************************************************************************/
+/**
+ *
+ * Add the SHARDS query command
+ *
+ ******************************************************************************/
+void shardRegisterQueries(ShardStruct *shards, int numShards);
+
+#endif
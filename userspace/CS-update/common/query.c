@@ -0,0 +1,215 @@
+/******************************************************************************/
+/**
+ * \file query.c
+ *
+ * \brief Line based query protocol, see query.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "query.h"
+
+#define MAX_COMMANDS (32)
+#define MAX_LINE (256)
+
+/* A slow client must not hold up the other clients for long */
+#define RECV_TIMEOUT_MS (500)
+
+/* A client that stops reading has its reply cut off */
+#define SEND_TIMEOUT_MS (5000)
+
+typedef struct
+{
+  const char *name;
+  const char *help;
+  QueryFn fn;
+  void *ctx;
+  int direct;
+} QueryCommandStruct;
+
+static QueryCommandStruct commands[MAX_COMMANDS];
+static int numCommands = 0;
+static QueryFn forwardFn = NULL;
+static void *forwardCtx = NULL;
+
+static int add(const char *name, const char *help, QueryFn fn, void *ctx, int direct)
+{
+  if (numCommands == MAX_COMMANDS) return -1;
+  commands[numCommands].name = name;
+  commands[numCommands].help = help;
+  commands[numCommands].fn = fn;
+  commands[numCommands].ctx = ctx;
+  commands[numCommands].direct = direct;
+  numCommands++;
+  return 0;
+}
+
+int queryRegister(const char *name, const char *help, QueryFn fn, void *ctx)
+{
+  return add(name, help, fn, ctx, 0);
+}
+
+int queryRegisterDirect(const char *name, const char *help, QueryFn fn, void *ctx)
+{
+  return add(name, help, fn, ctx, 1);
+}
+
+void querySetForward(QueryFn fn, void *ctx)
+{
+  forwardFn = fn;
+  forwardCtx = ctx;
+}
+
+int queryListen(int port)
+{
+  struct sockaddr_in addr;
+  int sockfd, on = 1;
+
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sockfd < 0) return -1;
+  setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons(port);
+  if (bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sockfd, 5) != 0)
+    {
+      close(sockfd);
+      return -1;
+    }
+  return sockfd;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Read one line from the client, without the line ending
+ *
+ * \return length of the line, or -1 if no complete line arrived
+ *
+ ******************************************************************************/
+static int readLine(int fd, char *line, int size)
+{
+  int n = 0;
+
+  while (n < size - 1)
+    {
+      ssize_t r = read(fd, line + n, 1);
+
+      if (r <= 0) return -1;
+      if (line[n] == '\n')
+	{
+	  if (n > 0 && line[n - 1] == '\r') n--;
+	  line[n] = '\0';
+	  return n;
+	}
+      n++;
+    }
+  return -1;
+}
+
+static void help(FILE *out)
+{
+  int i;
+
+  fprintf(out, "HELP\n");
+  for (i = 0; i < numCommands; i++)
+    {
+      fprintf(out, "%s %s\n", commands[i].name, commands[i].help);
+    }
+}
+
+int queryServe(int sockfd)
+{
+  char line[MAX_LINE];
+  char *argv[QUERY_MAX_ARGS];
+  char *save;
+  struct timeval tv = { 0, RECV_TIMEOUT_MS * 1000 };
+  struct timeval sendTv = { SEND_TIMEOUT_MS / 1000, (SEND_TIMEOUT_MS % 1000) * 1000 };
+  FILE *out;
+  int fd, argc, ret;
+
+  fd = accept(sockfd, NULL, NULL);
+  if (fd < 0) return -1;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTv, sizeof(sendTv));
+  out = fdopen(fd, "w");
+  if (out == NULL)
+    {
+      close(fd);
+      return -1;
+    }
+
+  if (readLine(fd, line, sizeof(line)) < 0)
+    {
+      fprintf(out, "ERR no command\n");
+      fclose(out);
+      return -1;
+    }
+
+  argc = 0;
+  for (argv[argc] = strtok_r(line, " \t", &save);
+       argv[argc] != NULL && argc < QUERY_MAX_ARGS - 1;
+       argv[argc] = strtok_r(NULL, " \t", &save))
+    {
+      argc++;
+    }
+
+  ret = queryDispatch(out, argc, argv);
+  fclose(out);
+  return ret;
+}
+
+static int dispatch(FILE *out, int argc, char *argv[], int forward)
+{
+  int i;
+
+  if (argc == 0 || strcasecmp(argv[0], "HELP") == 0)
+    {
+      help(out);
+      return 0;
+    }
+  for (i = 0; i < numCommands; i++)
+    {
+      if (strcasecmp(argv[0], commands[i].name) != 0) continue;
+      /* The forwarded command is answered, errors included, by queryAnswer() */
+      if (forward && forwardFn != NULL && !commands[i].direct)
+	{
+	  return forwardFn(forwardCtx, out, argc, argv);
+	}
+      if (commands[i].fn(commands[i].ctx, out, argc, argv) != 0)
+	{
+	  fprintf(out, "ERR usage: %s %s\n", commands[i].name, commands[i].help);
+	}
+      return 0;
+    }
+  fprintf(out, "ERR unknown command %s\n", argv[0]);
+  return -1;
+}
+
+int queryDispatch(FILE *out, int argc, char *argv[])
+{
+  return dispatch(out, argc, argv, 1);
+}
+
+int queryAnswer(FILE *out, int argc, char *argv[])
+{
+  return dispatch(out, argc, argv, 0);
+}
+
+unsigned long long queryParseTime(const char *arg)
+{
+  char *end;
+  unsigned long long s = strtoull(arg, &end, 10);
+
+  if (*end != '\0') return 0;
+  return s * 1000000000ULL;
+}
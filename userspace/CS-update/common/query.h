@@ -0,0 +1,143 @@
+/******************************************************************************/
+/**
+ * \file query.h
+ *
+ * \brief Line based query protocol on QUERY_PORT.
+ *
+ *        A client sends one line with a command name and space separated
+ *        arguments and gets text lines back until the server closes the
+ *        connection. Errors are reported as a single "ERR <reason>" line.
+ *
+ *        | COMMAND arg1 arg2 ...\n |
+ *
+ *        Modules register their own commands, HELP lists them all.
+ *
+ *        A server whose commands read state owned by another thread sets a
+ *        forward function with querySetForward(). Commands are then passed
+ *        to it and answered with queryAnswer() in the owning thread, while
+ *        the connection stays with the thread that accepted it. Commands
+ *        added with queryRegisterDirect() are still answered where the
+ *        connection is.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdio.h>
+
+/* Max arguments to a command, including the command name */
+#define QUERY_MAX_ARGS (16)
+
+/******************************************************************************/
+/**
+ *
+ * Handler for a command
+ *
+ * \param ctx, the pointer given to queryRegister()
+ * \param out, where to write the reply
+ * \param argc, number of arguments including the command name
+ * \param argv, the arguments
+ * \return 0 if successful, -1 for bad arguments before anything was written
+ *
+ ******************************************************************************/
+typedef int (*QueryFn)(void *ctx, FILE *out, int argc, char *argv[]);
+
+/******************************************************************************/
+/**
+ *
+ * Add a command to the protocol
+ *
+ * \param name, the command, matched case insensitively
+ * \param help, one line describing the arguments
+ * \param fn, the handler
+ * \param ctx, passed to the handler
+ * \return 0 if successful, -1 if the table is full
+ *
+ ******************************************************************************/
+int queryRegister(const char *name, const char *help, QueryFn fn, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Add a command that is never forwarded, for commands that need the
+ * connection itself or only wrap other commands
+ *
+ * \return 0 if successful, -1 if the table is full
+ *
+ ******************************************************************************/
+int queryRegisterDirect(const char *name, const char *help, QueryFn fn, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Pass every command not added with queryRegisterDirect() to fn in place
+ * of its handler, NULL to answer them all where they arrive
+ *
+ * \param fn, called with the arguments and where to write the reply,
+ *        which should end up with queryAnswer()
+ * \param ctx, passed to fn
+ * \return None
+ *
+ ******************************************************************************/
+void querySetForward(QueryFn fn, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Open the listening socket for queries
+ *
+ * \param port, the TCP port
+ * \return the socket, or -1 on failure
+ *
+ ******************************************************************************/
+int queryListen(int port);
+
+/******************************************************************************/
+/**
+ *
+ * Accept one client on the query socket and answer its command
+ *
+ * \param sockfd, the listening socket from queryListen()
+ * \return 0 if a command was answered, -1 otherwise
+ *
+ ******************************************************************************/
+int queryServe(int sockfd);
+
+/******************************************************************************/
+/**
+ *
+ * Answer a command that is already split into arguments, for commands
+ * that wrap other commands
+ *
+ * \param out, where to write the reply, errors included
+ * \param argc, number of arguments including the command name
+ * \param argv, the arguments
+ * \return 0 if a command was answered, -1 for an unknown command
+ *
+ ******************************************************************************/
+int queryDispatch(FILE *out, int argc, char *argv[]);
+
+/******************************************************************************/
+/**
+ *
+ * Answer a command in this thread, not forwarding it, for the receiving
+ * end of querySetForward()
+ *
+ * \return 0 if a command was answered, -1 for an unknown command
+ *
+ ******************************************************************************/
+int queryAnswer(FILE *out, int argc, char *argv[]);
+
+/******************************************************************************/
+/**
+ *
+ * Parse a time argument, seconds since the epoch
+ *
+ * \return the time in ns, or 0 if the argument is not a number
+ *
+ ******************************************************************************/
+unsigned long long queryParseTime(const char *arg);
+
+#endif
@@ -0,0 +1,161 @@
+/******************************************************************************/
+/**
+ * \file alerts.c
+ *
+ * \brief Rule based alerts, see alerts.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "alerts.h"
+#include "query.h"
+
+#define NS_PER_S (1000000000ULL)
+#define MAX_LINE (128)
+
+static const char *inputNames[] = { "power", "demand", "nopulse" };
+
+/******************************************************************************/
+/**
+ *
+ * Compile one rule line
+ *
+ * \return 0 if successful, 1 for an empty line, -1 on errors
+ *
+ ******************************************************************************/
+static int parseRule(AlertRuleStruct *rule, char *buf)
+{
+  char name[ALERTS_NAME_LEN], input[16], op[4], forWord[8];
+  double limit, hold = 0;
+  int n;
+
+  n = sscanf(buf, "%23s %15s", name, input);
+  if (n <= 0) return 1;
+  if (n != 2) return -1;
+
+  memset(rule, 0, sizeof(*rule));
+  strcpy(rule->name, name);
+  if (strcmp(input, "nopulse") == 0)
+    {
+      if (sscanf(buf, "%*s %*s %lf", &limit) != 1 || limit <= 0) return -1;
+      rule->input = ALERT_NOPULSE;
+      rule->above = 1;
+      rule->limit = limit;
+      return 0;
+    }
+
+  if (strcmp(input, "power") == 0) rule->input = ALERT_POWER;
+  else if (strcmp(input, "demand") == 0) rule->input = ALERT_DEMAND;
+  else return -1;
+
+  n = sscanf(buf, "%*s %*s %3s %lf %7s %lf", op, &limit, forWord, &hold);
+  if (n < 2 || (n > 2 && (n != 4 || strcmp(forWord, "for") != 0 || hold < 0))) return -1;
+  if (strcmp(op, ">") == 0) rule->above = 1;
+  else if (strcmp(op, "<") == 0) rule->above = 0;
+  else return -1;
+  rule->limit = limit;
+  rule->hold = (uint64_t)(hold * NS_PER_S);
+  return 0;
+}
+
+int alertsLoad(AlertsStruct *a, const char *fileName, int *line,
+               AlertEventFn onEvent, void *ctx)
+{
+  char buf[MAX_LINE];
+  int r = 1, err;
+  FILE *fd;
+
+  a->numRules = 0;
+  a->onEvent = onEvent;
+  a->ctx = ctx;
+  *line = 0;
+  fd = fopen(fileName, "r");
+  if (fd == NULL) return -1;
+
+  while (r >= 0 && fgets(buf, sizeof(buf), fd) != NULL)
+    {
+      AlertRuleStruct rule;
+      char *hash = strchr(buf, '#');
+
+      (*line)++;
+      if (hash) *hash = '\0';
+      r = parseRule(&rule, buf);
+      if (r == 0 && a->numRules == ALERTS_MAX_RULES) r = -1;
+      if (r == 0) a->rules[a->numRules++] = rule;
+    }
+
+  err = ferror(fd);
+  fclose(fd);
+  if (r < 0) errno = EINVAL;
+  return (r < 0 || err) ? -1 : 0;
+}
+
+void alertsEvaluate(AlertsStruct *a, uint64_t now, const AlertInputStruct *in)
+{
+  double values[3];
+  uint64_t since = in->lastPulse ? in->lastPulse : in->started;
+  int i;
+
+  values[ALERT_POWER] = in->power;
+  values[ALERT_DEMAND] = in->demand;
+  values[ALERT_NOPULSE] = (since && now > since) ? (double)(now - since) / NS_PER_S : 0;
+
+  for (i = 0; i < a->numRules; i++)
+    {
+      AlertRuleStruct *rule = &a->rules[i];
+      double value = values[rule->input];
+      int hold = rule->above ? (value > rule->limit) : (value < rule->limit);
+
+      if (!hold)
+	{
+	  rule->since = 0;
+	  if (rule->raised)
+	    {
+	      rule->raised = 0;
+	      if (a->onEvent) a->onEvent(a->ctx, now, rule, value);
+	    }
+	  continue;
+	}
+      if (rule->since == 0) rule->since = now;
+      if (!rule->raised && now - rule->since >= rule->hold)
+	{
+	  rule->raised = 1;
+	  if (a->onEvent) a->onEvent(a->ctx, now, rule, value);
+	}
+    }
+}
+
+/******************************************************************************/
+/**
+ *
+ * ALERTS
+ *
+ * Prints every rule and whether it is raised
+ *
+ *        | <name> <input> <>|<> <limit> <hold s> <raised|ok> |
+ *
+ ******************************************************************************/
+static int queryAlerts(void *ctx, FILE *out, int argc, char *argv[])
+{
+  AlertsStruct *a = ctx;
+  int i;
+
+  (void)argc;
+  (void)argv;
+  for (i = 0; i < a->numRules; i++)
+    {
+      const AlertRuleStruct *rule = &a->rules[i];
+      fprintf(out, "%s %s %s %g %g %s\n", rule->name, inputNames[rule->input],
+              rule->above ? ">" : "<", rule->limit, (double)rule->hold / NS_PER_S,
+              rule->raised ? "raised" : "ok");
+    }
+  return 0;
+}
+
+void alertsRegisterQueries(AlertsStruct *a)
+{
+  queryRegister("ALERTS", "", queryAlerts, a);
+}
@@ -0,0 +1,102 @@
+/******************************************************************************/
+/**
+ * \file alerts.h
+ *
+ * \brief Rule based alerts, evaluated on every pulse and timer tick.
+ *
+ *        The rules file has one rule per line, a name and a condition:
+ *
+ *        # name     condition
+ *        overload   power > 8000 for 120
+ *        standby    power < 50 for 3600
+ *        peak       demand > 6000
+ *        sensor     nopulse 1800
+ *
+ *        power is the present power in W, demand the projected 15 minute
+ *        demand in W and nopulse the seconds since the last pulse, or
+ *        since the pulses were first waited for if none came yet. A rule
+ *        with "for <s>" must hold that long before it is raised. Rules are
+ *        compiled into a flat table, one compare and a little bookkeeping
+ *        per rule and evaluation.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef ALERTS_H
+#define ALERTS_H
+
+#include <stdint.h>
+
+#define ALERTS_MAX_RULES (256)
+#define ALERTS_NAME_LEN (24)
+
+enum { ALERT_POWER, ALERT_DEMAND, ALERT_NOPULSE };
+
+typedef struct
+{
+  uint8_t input;         /* ALERT_POWER, ALERT_DEMAND or ALERT_NOPULSE */
+  uint8_t above;         /* 1 for >, 0 for < */
+  uint8_t raised;
+  double limit;          /* W, or s for nopulse */
+  uint64_t hold;         /* ns the condition must hold */
+  uint64_t since;        /* When the condition became true, 0 if false */
+  char name[ALERTS_NAME_LEN];
+} AlertRuleStruct;
+
+typedef struct
+{
+  double power;          /* Present power, W */
+  double demand;         /* Projected 15 minute demand, W */
+  uint64_t lastPulse;    /* ns since the epoch, 0 if none yet */
+  uint64_t started;      /* ns since the epoch pulses are waited for since */
+} AlertInputStruct;
+
+/* Called when a rule is raised or cleared */
+typedef void (*AlertEventFn)(void *ctx, uint64_t now, const AlertRuleStruct *rule, double value);
+
+typedef struct
+{
+  AlertRuleStruct rules[ALERTS_MAX_RULES];
+  int numRules;
+  AlertEventFn onEvent;
+  void *ctx;
+} AlertsStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Read and compile a rules file
+ *
+ * \param a, the rule table
+ * \param fileName, the rules file
+ * \param line, filled in with the line number of an error
+ * \param onEvent, called when a rule is raised or cleared
+ * \param ctx, passed to onEvent
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int alertsLoad(AlertsStruct *a, const char *fileName, int *line,
+               AlertEventFn onEvent, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Evaluate all rules, raising and clearing them as needed
+ *
+ * \param a, the rule table
+ * \param now, the time in ns since the epoch
+ * \param in, the present values
+ * \return None
+ *
+ ******************************************************************************/
+void alertsEvaluate(AlertsStruct *a, uint64_t now, const AlertInputStruct *in);
+
+/******************************************************************************/
+/**
+ *
+ * Add the ALERTS query command
+ *
+ ******************************************************************************/
+void alertsRegisterQueries(AlertsStruct *a);
+
+#endif
@@ -0,0 +1,394 @@
+/******************************************************************************/
+/**
+ * \file arrow.c
+ *
+ * \brief Arrow IPC writer, see arrow.h
+ *
+ *        The flatbuffers are laid out front to back: a table is written
+ *        with its offset fields left open, and each field is patched when
+ *        the child it points to has been written after it. Vtables go
+ *        right before their table. Values are stored in host byte order,
+ *        which Arrow requires to be little endian.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "arrow.h"
+
+#define META_MAX (4096)
+#define FB_MAX_SLOTS (8)
+
+/* Slot size for an offset to something written later */
+#define FB_OFFSET (-4)
+
+/* Schema.fbs and Message.fbs */
+#define METADATA_V5 (4)
+#define HEADER_SCHEMA (1)
+#define HEADER_RECORD_BATCH (3)
+#define TYPE_INT (2)
+#define TYPE_FLOATING_POINT (3)
+#define TYPE_TIMESTAMP (10)
+#define PRECISION_SINGLE (1)
+#define PRECISION_DOUBLE (2)
+#define UNIT_NANOSECOND (3)
+
+static const uint8_t zeros[8];
+
+typedef struct
+{
+  uint8_t buf[META_MAX];
+  size_t len;
+  int overflow;
+} FbStruct;
+
+typedef struct
+{
+  int size;          /* 1, 2, 4, 8 or FB_OFFSET, 0 if absent */
+  uint64_t value;
+} FbSlotStruct;
+
+static size_t fbPut(FbStruct *b, const void *p, size_t n)
+{
+  size_t at = b->len;
+
+  if (b->len + n > META_MAX)
+    {
+      b->overflow = 1;
+      return at;
+    }
+  if (n > 0) memcpy(b->buf + b->len, p, n);
+  b->len += n;
+  return at;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Pad until the length is phase modulo align
+ *
+ ******************************************************************************/
+static void fbAlign(FbStruct *b, size_t align, size_t phase)
+{
+  while (b->len % align != phase && !b->overflow) fbPut(b, zeros, 1);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Point the offset at position at to target
+ *
+ ******************************************************************************/
+static void fbPatch(FbStruct *b, size_t at, size_t target)
+{
+  uint32_t v = target - at;
+
+  if (!b->overflow) memcpy(b->buf + at, &v, sizeof(v));
+}
+
+/******************************************************************************/
+/**
+ *
+ * Write a table with its vtable, largest fields first so all are aligned
+ *
+ * \param b, the buffer
+ * \param slots, the fields in the order of the schema
+ * \param n, number of fields
+ * \param at, filled in with the position of each offset field
+ * \return the position of the table
+ *
+ ******************************************************************************/
+static size_t fbTable(FbStruct *b, const FbSlotStruct *slots, int n, size_t *at)
+{
+  static const int sizes[] = { 8, 4, 2, 1 };
+  uint16_t vt[2 + FB_MAX_SLOTS];
+  size_t table, vtable;
+  uint16_t off = 4;
+  int32_t soffset;
+  int i, k;
+
+  for (i = 0; i < n; i++) vt[2 + i] = 0;
+  for (k = 0; k < 4; k++)
+    {
+      for (i = 0; i < n; i++)
+	{
+	  if (abs(slots[i].size) != sizes[k]) continue;
+	  vt[2 + i] = off;
+	  off += sizes[k];
+	}
+    }
+  vt[0] = 4 + 2 * n;
+  vt[1] = off;
+
+  fbAlign(b, 2, 0);
+  vtable = fbPut(b, vt, vt[0]);
+  /* After the soffset the table is 8 byte aligned */
+  fbAlign(b, 8, 4);
+  table = b->len;
+  soffset = table - vtable;
+  fbPut(b, &soffset, sizeof(soffset));
+  for (k = 0; k < 4; k++)
+    {
+      for (i = 0; i < n; i++)
+	{
+	  if (abs(slots[i].size) != sizes[k]) continue;
+	  at[i] = fbPut(b, &slots[i].value, sizes[k]);
+	}
+    }
+  return table;
+}
+
+static size_t fbStructVector(FbStruct *b, const void *elems, uint32_t count, size_t size)
+{
+  size_t v;
+
+  fbAlign(b, 8, 4);
+  v = fbPut(b, &count, sizeof(count));
+  fbPut(b, elems, count * size);
+  return v;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Write a vector of offsets to be patched, the first at *first
+ *
+ ******************************************************************************/
+static size_t fbOffsetVector(FbStruct *b, uint32_t count, size_t *first)
+{
+  uint32_t i, none = 0;
+  size_t v;
+
+  fbAlign(b, 4, 0);
+  v = fbPut(b, &count, sizeof(count));
+  *first = b->len;
+  for (i = 0; i < count; i++) fbPut(b, &none, sizeof(none));
+  return v;
+}
+
+static size_t fbString(FbStruct *b, const char *s)
+{
+  uint32_t len = strlen(s);
+  size_t v;
+
+  fbAlign(b, 4, 0);
+  v = fbPut(b, &len, sizeof(len));
+  fbPut(b, s, len + 1);
+  return v;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Write a Field table and point ref at it
+ *
+ ******************************************************************************/
+static void fbField(FbStruct *b, const ArrowFieldStruct *f, size_t ref)
+{
+  FbSlotStruct slots[6] = { { FB_OFFSET, 0 }, { 0, 0 }, { 1, 0 }, { FB_OFFSET, 0 }, { 0, 0 }, { FB_OFFSET, 0 } };
+  FbSlotStruct type[2] = { { 0, 0 }, { 0, 0 } };
+  size_t at[6], typeAt[2], field, first;
+  int numType = 1;
+
+  switch (f->type)
+    {
+    case ARROW_TIMESTAMP_NS:
+      {
+	slots[2].value = TYPE_TIMESTAMP;
+	type[0].size = 2;
+	type[0].value = UNIT_NANOSECOND;
+	type[1].size = FB_OFFSET;
+	numType = 2;
+	break;
+      }
+    case ARROW_FLOAT64:
+    case ARROW_FLOAT32:
+      {
+	slots[2].value = TYPE_FLOATING_POINT;
+	type[0].size = 2;
+	type[0].value = (f->type == ARROW_FLOAT64) ? PRECISION_DOUBLE : PRECISION_SINGLE;
+	break;
+      }
+    default:
+      {
+	slots[2].value = TYPE_INT;
+	type[0].size = 4;
+	type[0].value = 32;
+	type[1].size = 1;
+	type[1].value = 0;
+	numType = 2;
+	break;
+      }
+    }
+
+  field = fbTable(b, slots, 6, at);
+  fbPatch(b, ref, field);
+  fbPatch(b, at[0], fbString(b, f->name));
+  fbPatch(b, at[3], fbTable(b, type, numType, typeAt));
+  if (f->type == ARROW_TIMESTAMP_NS) fbPatch(b, typeAt[1], fbString(b, "UTC"));
+  fbPatch(b, at[5], fbOffsetVector(b, 0, &first));
+}
+
+static size_t fbSchema(FbStruct *b, const ArrowFieldStruct *fields, int n)
+{
+  FbSlotStruct slots[2] = { { 0, 0 }, { FB_OFFSET, 0 } };
+  size_t at[2], schema, first;
+  int i;
+
+  schema = fbTable(b, slots, 2, at);
+  fbPatch(b, at[1], fbOffsetVector(b, n, &first));
+  for (i = 0; i < n; i++) fbField(b, &fields[i], first + 4 * i);
+  return schema;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Start a Message flatbuffer, the header is to be written at *headerAt
+ *
+ ******************************************************************************/
+static void fbMessage(FbStruct *b, int headerType, uint64_t bodyLength, size_t *headerAt)
+{
+  FbSlotStruct slots[4] = { { 2, METADATA_V5 }, { 1, 0 }, { FB_OFFSET, 0 }, { 8, 0 } };
+  uint32_t root = 0;
+  size_t at[4];
+
+  b->len = 0;
+  b->overflow = 0;
+  slots[1].value = headerType;
+  slots[3].value = bodyLength;
+  fbPut(b, &root, sizeof(root));
+  fbPatch(b, 0, fbTable(b, slots, 4, at));
+  *headerAt = at[2];
+}
+
+static int put(ArrowWriterStruct *w, const void *p, size_t n)
+{
+  if (n > 0 && fwrite(p, 1, n, w->out) != n) return -1;
+  w->pos += n;
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Write an encapsulated message: continuation, length, the padded metadata
+ *
+ * \return length of the prefix and metadata, or 0 on errors
+ *
+ ******************************************************************************/
+static uint32_t putMessage(ArrowWriterStruct *w, FbStruct *b)
+{
+  uint32_t prefix[2];
+
+  fbAlign(b, 8, 0);
+  if (b->overflow) return 0;
+  prefix[0] = 0xffffffff;
+  prefix[1] = b->len;
+  if (put(w, prefix, sizeof(prefix)) != 0 || put(w, b->buf, b->len) != 0) return 0;
+  return sizeof(prefix) + b->len;
+}
+
+static size_t width(int type)
+{
+  return (type == ARROW_TIMESTAMP_NS || type == ARROW_FLOAT64) ? 8 : 4;
+}
+
+int arrowBegin(ArrowWriterStruct *w, FILE *out, const ArrowFieldStruct *fields, int numFields, int file)
+{
+  FbStruct b;
+  size_t headerAt;
+
+  if (numFields > ARROW_MAX_FIELDS) return -1;
+  w->out = out;
+  w->file = file;
+  w->pos = 0;
+  w->fields = fields;
+  w->numFields = numFields;
+  w->numBlocks = 0;
+  if (file && put(w, "ARROW1\0\0", 8) != 0) return -1;
+
+  fbMessage(&b, HEADER_SCHEMA, 0, &headerAt);
+  fbPatch(&b, headerAt, fbSchema(&b, fields, numFields));
+  return (putMessage(w, &b) > 0) ? 0 : -1;
+}
+
+int arrowBatch(ArrowWriterStruct *w, size_t length, const void *const columns[])
+{
+  FbSlotStruct slots[3] = { { 8, 0 }, { FB_OFFSET, 0 }, { FB_OFFSET, 0 } };
+  int64_t nodes[ARROW_MAX_FIELDS][2];
+  int64_t buffers[2 * ARROW_MAX_FIELDS][2];
+  ArrowBlockStruct *block;
+  uint64_t body = 0;
+  size_t headerAt, at[3], size;
+  FbStruct b;
+  int i;
+
+  if (w->file && w->numBlocks == ARROW_MAX_BATCHES) return -1;
+  for (i = 0; i < w->numFields; i++)
+    {
+      size = length * width(w->fields[i].type);
+      nodes[i][0] = length;
+      nodes[i][1] = 0;
+      /* No validity bitmap, nothing is null */
+      buffers[2 * i][0] = body;
+      buffers[2 * i][1] = 0;
+      buffers[2 * i + 1][0] = body;
+      buffers[2 * i + 1][1] = size;
+      body += (size + 7) & ~7;
+    }
+
+  fbMessage(&b, HEADER_RECORD_BATCH, body, &headerAt);
+  slots[0].value = length;
+  fbPatch(&b, headerAt, fbTable(&b, slots, 3, at));
+  fbPatch(&b, at[1], fbStructVector(&b, nodes, w->numFields, sizeof(nodes[0])));
+  fbPatch(&b, at[2], fbStructVector(&b, buffers, 2 * w->numFields, sizeof(buffers[0])));
+
+  block = &w->blocks[w->file ? w->numBlocks : 0];
+  block->offset = w->pos;
+  block->bodyLength = body;
+  if ((block->metaLength = putMessage(w, &b)) == 0) return -1;
+  for (i = 0; i < w->numFields; i++)
+    {
+      size = length * width(w->fields[i].type);
+      if (put(w, columns[i], size) != 0 || put(w, zeros, ((size + 7) & ~7) - size) != 0) return -1;
+    }
+  if (w->file) w->numBlocks++;
+  return 0;
+}
+
+int arrowEnd(ArrowWriterStruct *w)
+{
+  static const uint32_t eos[2] = { 0xffffffff, 0 };
+  FbSlotStruct slots[4] = { { 2, METADATA_V5 }, { FB_OFFSET, 0 }, { FB_OFFSET, 0 }, { FB_OFFSET, 0 } };
+  uint8_t blocks[ARROW_MAX_BATCHES][24];
+  uint32_t root = 0, len;
+  size_t at[4];
+  FbStruct b;
+  int i;
+
+  if (put(w, eos, sizeof(eos)) != 0) return -1;
+  if (!w->file) return fflush(w->out) == 0 ? 0 : -1;
+
+  /* Block is { long offset; int metaDataLength; pad; long bodyLength } */
+  memset(blocks, 0, sizeof(blocks));
+  for (i = 0; i < w->numBlocks; i++)
+    {
+      memcpy(blocks[i], &w->blocks[i].offset, 8);
+      memcpy(blocks[i] + 8, &w->blocks[i].metaLength, 4);
+      memcpy(blocks[i] + 16, &w->blocks[i].bodyLength, 8);
+    }
+  b.len = 0;
+  b.overflow = 0;
+  fbPut(&b, &root, sizeof(root));
+  fbPatch(&b, 0, fbTable(&b, slots, 4, at));
+  fbPatch(&b, at[1], fbSchema(&b, w->fields, w->numFields));
+  fbPatch(&b, at[2], fbStructVector(&b, NULL, 0, sizeof(blocks[0])));
+  fbPatch(&b, at[3], fbStructVector(&b, blocks, w->numBlocks, sizeof(blocks[0])));
+  if (b.overflow) return -1;
+
+  len = b.len;
+  if (put(w, b.buf, b.len) != 0 || put(w, &len, sizeof(len)) != 0 || put(w, "ARROW1", 6) != 0) return -1;
+  return fflush(w->out) == 0 ? 0 : -1;
+}
@@ -0,0 +1,99 @@
+/******************************************************************************/
+/**
+ * \file arrow.h
+ *
+ * \brief Writes Apache Arrow IPC streams and files.
+ *
+ *        Only what the exports need: non-nullable columns of fixed width
+ *        types, a schema and any number of record batches. The metadata
+ *        flatbuffers are built by hand, the column values are written as
+ *        they are in memory, so a batch costs a few hundred bytes of
+ *        metadata and one write per column.
+ *
+ *        The stream format can be read with pyarrow.ipc.open_stream(),
+ *        the file format with pyarrow.ipc.open_file() or DuckDB.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef ARROW_H
+#define ARROW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ARROW_MAX_FIELDS (8)
+#define ARROW_MAX_BATCHES (128)
+
+typedef enum
+{
+  ARROW_TIMESTAMP_NS,   /* int64, ns since the epoch, UTC */
+  ARROW_FLOAT64,
+  ARROW_FLOAT32,
+  ARROW_UINT32
+} ArrowType;
+
+typedef struct
+{
+  const char *name;
+  int type;             /* ArrowType */
+} ArrowFieldStruct;
+
+typedef struct
+{
+  uint64_t offset;      /* Of the message in the file */
+  uint32_t metaLength;
+  uint64_t bodyLength;
+} ArrowBlockStruct;
+
+typedef struct
+{
+  FILE *out;
+  int file;             /* File format, otherwise stream */
+  uint64_t pos;         /* Bytes written */
+  const ArrowFieldStruct *fields;
+  int numFields;
+  ArrowBlockStruct blocks[ARROW_MAX_BATCHES];
+  int numBlocks;
+} ArrowWriterStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Start a stream or file and write the schema
+ *
+ * \param w, the writer
+ * \param out, where to write
+ * \param fields, the columns
+ * \param numFields, number of columns, at most ARROW_MAX_FIELDS
+ * \param file, 1 for the file format, 0 for the stream format
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int arrowBegin(ArrowWriterStruct *w, FILE *out, const ArrowFieldStruct *fields, int numFields, int file);
+
+/******************************************************************************/
+/**
+ *
+ * Write a record batch
+ *
+ * \param w, the writer
+ * \param length, number of rows
+ * \param columns, the values of each column, length values each
+ * \return 0 if successful, -1 on write errors or too many batches
+ *
+ ******************************************************************************/
+int arrowBatch(ArrowWriterStruct *w, size_t length, const void *const columns[]);
+
+/******************************************************************************/
+/**
+ *
+ * End the stream, and for the file format write the footer
+ *
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int arrowEnd(ArrowWriterStruct *w);
+
+#endif
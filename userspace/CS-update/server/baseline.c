@@ -0,0 +1,204 @@
+/******************************************************************************/
+/**
+ * \file baseline.c
+ *
+ * \brief Hour of week statistics and standby load, see baseline.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "baseline.h"
+#include "query.h"
+
+#define NS_PER_S (1000000000ULL)
+#define ROWS_PER_HOUR (4)
+#define SECONDS_PER_ROW (ROLLUP_PERIOD / NS_PER_S)
+
+/* Deviations smaller than this are never reported, kWh and share of mean */
+#define MIN_SD (0.02)
+#define MIN_SD_SHARE (0.1)
+
+/* Standby must grow by both of these to count as creep */
+#define CREEP_SHARE (1.2)
+#define CREEP_WATT (20.0)
+
+#define WEEK_DAYS (7)
+
+void baselineInit(BaselineStruct *b, BaselineEventFn onEvent, void *ctx)
+{
+  memset(b, 0, sizeof(*b));
+  b->onEvent = onEvent;
+  b->ctx = ctx;
+}
+
+static double slotSd(const BaselineSlotStruct *s)
+{
+  return (s->n > 1) ? sqrt(s->m2 / (s->n - 1)) : 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Check a complete hour against its slot and add it to the statistics.
+ * After BASELINE_MAX_WEEKS the update turns exponential so the baseline
+ * follows the seasons.
+ *
+ ******************************************************************************/
+static void closeHour(BaselineStruct *b)
+{
+  BaselineSlotStruct *s = &b->slots[b->hourSlot];
+  double x = b->hourEnergy / 1000;
+  double delta = x - s->mean;
+
+  if (s->n >= BASELINE_MIN_WEEKS && b->onEvent)
+    {
+      double sd = fmax(slotSd(s), fmax(MIN_SD, MIN_SD_SHARE * s->mean));
+
+      if (fabs(delta) > BASELINE_SIGMAS * sd)
+	{
+	  b->onEvent(b->ctx, b->hourStart, delta > 0 ? BASELINE_HIGH : BASELINE_LOW, x, s->mean);
+	}
+    }
+
+  if (s->n < BASELINE_MAX_WEEKS)
+    {
+      s->n++;
+      s->mean += delta / s->n;
+      s->m2 += delta * (x - s->mean);
+    }
+  else
+    {
+      double alpha = 1.0 / BASELINE_MAX_WEEKS;
+      double var = s->m2 / (s->n - 1);
+
+      s->mean += alpha * delta;
+      var = (1 - alpha) * (var + delta * alpha * delta);
+      s->m2 = var * (s->n - 1);
+    }
+}
+
+/******************************************************************************/
+/**
+ *
+ * Average of n daily minimums, starting back days before the latest
+ *
+ ******************************************************************************/
+static double dayAverage(const BaselineStruct *b, int back, int n)
+{
+  double sum = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      sum += b->dayMin[(b->dayPos + 2 * BASELINE_DAYS - 1 - back - i) % BASELINE_DAYS];
+    }
+  return sum / n;
+}
+
+double baselineStandby(const BaselineStruct *b, double *reference)
+{
+  *reference = 0;
+  if (b->numDays < WEEK_DAYS) return 0;
+  if (b->numDays >= BASELINE_DAYS) *reference = dayAverage(b, 4 * WEEK_DAYS, WEEK_DAYS);
+  return dayAverage(b, 0, WEEK_DAYS);
+}
+
+static void closeDay(BaselineStruct *b, uint64_t ts)
+{
+  double now, reference;
+
+  b->dayMin[b->dayPos] = b->curDayMin;
+  b->dayPos = (b->dayPos + 1) % BASELINE_DAYS;
+  if (b->numDays < BASELINE_DAYS) b->numDays++;
+
+  now = baselineStandby(b, &reference);
+  if (reference > 0 && now > reference * CREEP_SHARE && now - reference > CREEP_WATT && b->onEvent)
+    {
+      b->onEvent(b->ctx, ts, BASELINE_CREEP, now, reference);
+    }
+}
+
+void baselinePush(BaselineStruct *b, const RollupRowStruct *row)
+{
+  time_t s = row->start / NS_PER_S;
+  uint64_t hourStart;
+  struct tm tm;
+  double power;
+  int date;
+
+  /* Rows missing seconds would look like low consumption */
+  if (row->seconds < SECONDS_PER_ROW) return;
+  localtime_r(&s, &tm);
+  power = row->energy * 3600 / SECONDS_PER_ROW;
+
+  date = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+  if (date != b->day)
+    {
+      if (b->day != 0) closeDay(b, row->start);
+      b->day = date;
+      b->curDayMin = power;
+    }
+  else if (power < b->curDayMin)
+    {
+      b->curDayMin = power;
+    }
+
+  hourStart = row->start - (uint64_t)(tm.tm_min * 60 + tm.tm_sec) * NS_PER_S;
+  if (hourStart != b->hourStart)
+    {
+      b->hourStart = hourStart;
+      b->hourSlot = tm.tm_wday * 24 + tm.tm_hour;
+      b->hourRows = 0;
+      b->hourEnergy = 0;
+    }
+  b->hourEnergy += row->energy;
+  if (++b->hourRows == ROWS_PER_HOUR) closeHour(b);
+}
+
+/******************************************************************************/
+/**
+ *
+ * BASELINE [all]
+ *
+ * Prints the standby power and the statistics of the present hour of the
+ * week, or of all of them. Slot 0 is Sunday 00-01.
+ *
+ *        | standby <W last week> <W 4 weeks earlier> |
+ *        | slot <slot> <weeks> <mean kWh> <sd kWh> |
+ *
+ ******************************************************************************/
+static int queryBaseline(void *ctx, FILE *out, int argc, char *argv[])
+{
+  BaselineStruct *b = ctx;
+  double standby, reference;
+  time_t now = time(NULL);
+  struct tm tm;
+  int i, from, to;
+
+  localtime_r(&now, &tm);
+  from = tm.tm_wday * 24 + tm.tm_hour;
+  to = from + 1;
+  if (argc > 1)
+    {
+      if (strcmp(argv[1], "all") != 0) return -1;
+      from = 0;
+      to = BASELINE_SLOTS;
+    }
+
+  standby = baselineStandby(b, &reference);
+  fprintf(out, "standby %.1f %.1f\n", standby, reference);
+  for (i = from; i < to; i++)
+    {
+      fprintf(out, "slot %d %u %.3f %.3f\n", i, b->slots[i].n, b->slots[i].mean,
+              slotSd(&b->slots[i]));
+    }
+  return 0;
+}
+
+void baselineRegisterQueries(BaselineStruct *b)
+{
+  queryRegister("BASELINE", "[all]", queryBaseline, b);
+}
@@ -0,0 +1,91 @@
+/******************************************************************************/
+/**
+ * \file baseline.h
+ *
+ * \brief Normal consumption per hour of the week and standby load creep.
+ *
+ *        Every complete hour updates the mean and variance of its hour of
+ *        the week with Welford's method, and hours further than
+ *        BASELINE_SIGMAS standard deviations from the mean are reported.
+ *
+ *        The standby load is the lowest 15 minute power of each day. The
+ *        average of the last week is compared with the same four weeks
+ *        earlier to catch standby load that creeps up.
+ *
+ *        All state is fixed size, independent of how long the meter runs.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef BASELINE_H
+#define BASELINE_H
+
+#include <stdint.h>
+#include "rollup.h"
+
+#define BASELINE_SLOTS (7 * 24)
+#define BASELINE_SIGMAS (3.0)
+#define BASELINE_MIN_WEEKS (4)
+#define BASELINE_MAX_WEEKS (12)
+#define BASELINE_DAYS (35)
+
+enum { BASELINE_HIGH, BASELINE_LOW, BASELINE_CREEP };
+
+typedef struct
+{
+  uint32_t n;
+  double mean;   /* kWh */
+  double m2;     /* Sum of squared deviations, Welford */
+} BaselineSlotStruct;
+
+/* type is BASELINE_HIGH/LOW for an hour, value and expected in kWh, or
+ * BASELINE_CREEP with the standby power now and a month ago in W */
+typedef void (*BaselineEventFn)(void *ctx, uint64_t ts, int type, double value, double expected);
+
+typedef struct
+{
+  BaselineSlotStruct slots[BASELINE_SLOTS];
+
+  uint64_t hourStart;        /* Hour being summed, 0 if none */
+  int hourSlot;
+  int hourRows;
+  double hourEnergy;         /* Wh */
+
+  float dayMin[BASELINE_DAYS];  /* Lowest 15 minute power per day, ring */
+  int numDays;
+  int dayPos;
+  int day;                      /* yyyymmdd being followed */
+  float curDayMin;
+
+  BaselineEventFn onEvent;
+  void *ctx;
+} BaselineStruct;
+
+void baselineInit(BaselineStruct *b, BaselineEventFn onEvent, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Add a completed rollup row
+ *
+ ******************************************************************************/
+void baselinePush(BaselineStruct *b, const RollupRowStruct *row);
+
+/******************************************************************************/
+/**
+ *
+ * Average standby power of the last 7 days in W, and the same for 4 weeks
+ * earlier in *reference, both 0 until there is enough history
+ *
+ ******************************************************************************/
+double baselineStandby(const BaselineStruct *b, double *reference);
+
+/******************************************************************************/
+/**
+ *
+ * Add the BASELINE query command
+ *
+ ******************************************************************************/
+void baselineRegisterQueries(BaselineStruct *b);
+
+#endif
@@ -0,0 +1,65 @@
+/******************************************************************************/
+/**
+ * \file capture.c
+ *
+ * \brief Capture stage, see capture.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <poll.h>
+#include <unistd.h>
+#include "capture.h"
+
+static void *captureThread(void *arg)
+{
+  CaptureStruct *c = arg;
+  struct pollfd pfd;
+  PulseStruct pulse;
+
+  pfd.fd = c->source.fd;
+  pfd.events = POLLPRI;
+  for (;;)
+    {
+      if (c->source.polled)
+	{
+	  usleep(PULSE_SOURCE_POLL_MS * 1000);
+	}
+      else
+	{
+	  if (poll(&pfd, 1, -1) <= 0) continue;
+	  if (!(pfd.revents & (POLLPRI | POLLERR))) continue;
+	}
+      if (pulseSourceRead(&c->source, &pulse) <= 0) continue;
+      spscPut(&c->queue, &pulse);
+      spscFlush(&c->queue);
+    }
+  return NULL;
+}
+
+int captureStart(CaptureStruct *c, const char *fileName)
+{
+  if (pulseSourceOpen(&c->source, fileName) != 0) return -1;
+  if (spscInit(&c->queue, "capture", sizeof(PulseStruct), CAPTURE_QUEUE) != 0 ||
+      pthread_create(&c->thread, NULL, captureThread, c) != 0)
+    {
+      pulseSourceClose(&c->source);
+      return -1;
+    }
+  return 0;
+}
+
+size_t captureGet(CaptureStruct *c, PulseStruct *pulses, size_t max)
+{
+  return spscGet(&c->queue, pulses, max);
+}
+
+int captureWakeFd(const CaptureStruct *c)
+{
+  return spscWakeFd(&c->queue);
+}
+
+int captureWait(CaptureStruct *c, int timeoutMs)
+{
+  return spscWait(&c->queue, timeoutMs);
+}
@@ -0,0 +1,72 @@
+/******************************************************************************/
+/**
+ * \file capture.h
+ *
+ * \brief Capture stage, waits for pulses from the module in its own thread.
+ *
+ *        Every pulse is handed to the compute stage through an SPSC queue
+ *        as soon as it is read, whatever the compute stage is busy with.
+ *        The pulse carries the time stamp taken by the module, so waiting
+ *        in the queue does not change the measurement.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pthread.h>
+#include "pulse-source.h"
+#include "spsc.h"
+
+#define CAPTURE_QUEUE (1024)
+
+typedef struct
+{
+  PulseSourceStruct source;
+  SpscStruct queue;
+  pthread_t thread;
+} CaptureStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Open the lastPulse attribute and start the capture thread
+ *
+ * \param c, the capture stage
+ * \param fileName, path of the lastPulse attribute
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int captureStart(CaptureStruct *c, const char *fileName);
+
+/******************************************************************************/
+/**
+ *
+ * Take up to max captured pulses, oldest first
+ *
+ * \return the number of pulses
+ *
+ ******************************************************************************/
+size_t captureGet(CaptureStruct *c, PulseStruct *pulses, size_t max);
+
+/******************************************************************************/
+/**
+ *
+ * Descriptor that becomes readable when there are pulses to get, for
+ * poll() together with other descriptors. Reset it with captureWait(c, 0).
+ *
+ ******************************************************************************/
+int captureWakeFd(const CaptureStruct *c);
+
+/******************************************************************************/
+/**
+ *
+ * Wait up to timeoutMs for pulses to get, -1 for no limit
+ *
+ * \return 1 if there may be pulses, 0 on timeout
+ *
+ ******************************************************************************/
+int captureWait(CaptureStruct *c, int timeoutMs);
+
+#endif
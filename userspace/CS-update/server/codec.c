@@ -0,0 +1,210 @@
+/******************************************************************************/
+/**
+ * \file codec.c
+ *
+ * \brief Compressed replies, see codec.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "codec.h"
+#include "query.h"
+
+/* Room for a block that grows, which all the codecs bound well below this */
+#define PACKED_SIZE (CODEC_BLOCK + CODEC_BLOCK / 64 + 64)
+
+typedef struct
+{
+  const char *name;
+  /* Compressed size, 0 if it did not fit in dstSize */
+  size_t (*pack)(const void *src, size_t n, void *dst, size_t dstSize);
+} CodecStruct;
+
+typedef struct
+{
+  FILE *out;                /* The client */
+  const CodecStruct *codec; /* NULL to send the reply as it is */
+  int started;              /* ENC line sent */
+  size_t n;                 /* Bytes in raw */
+  unsigned char raw[CODEC_BLOCK];
+  unsigned char packed[PACKED_SIZE];
+} CodecStreamStruct;
+
+#ifdef HAVE_LZ4
+static size_t lz4Pack(const void *src, size_t n, void *dst, size_t dstSize)
+{
+  int r = LZ4_compress_default(src, dst, n, dstSize);
+
+  return (r > 0) ? (size_t)r : 0;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static size_t zstdPack(const void *src, size_t n, void *dst, size_t dstSize)
+{
+  size_t r = ZSTD_compress(dst, dstSize, src, n, CODEC_ZSTD_LEVEL);
+
+  return ZSTD_isError(r) ? 0 : r;
+}
+#endif
+
+static size_t deflatePack(const void *src, size_t n, void *dst, size_t dstSize)
+{
+  uLongf len = dstSize;
+
+  return (compress2(dst, &len, src, n, CODEC_DEFLATE_LEVEL) == Z_OK) ? len : 0;
+}
+
+static const CodecStruct codecs[] =
+  {
+#ifdef HAVE_LZ4
+    { "lz4", lz4Pack },
+#endif
+#ifdef HAVE_ZSTD
+    { "zstd", zstdPack },
+#endif
+    { "deflate", deflatePack }
+  };
+
+static CodecStreamStruct stream;
+
+/******************************************************************************/
+/**
+ *
+ * The first codec in a comma separated list that is built in
+ *
+ * \return the codec, NULL if there is none
+ *
+ ******************************************************************************/
+static const CodecStruct *codecPick(char *list)
+{
+  char *name, *save;
+  size_t i;
+
+  for (name = strtok_r(list, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+    {
+      for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+	{
+	  if (strcasecmp(name, codecs[i].name) == 0) return &codecs[i];
+	}
+    }
+  return NULL;
+}
+
+static void putLength(FILE *out, uint32_t len)
+{
+  unsigned char b[4] = { len >> 24, len >> 16, len >> 8, len };
+
+  fwrite(b, 1, 4, out);
+}
+
+static void writeBlock(CodecStreamStruct *s)
+{
+  size_t len = s->codec->pack(s->raw, s->n, s->packed, sizeof(s->packed));
+
+  if (len == 0 || len >= s->n)
+    {
+      putLength(s->out, s->n | CODEC_STORED);
+      fwrite(s->raw, 1, s->n, s->out);
+    }
+  else
+    {
+      putLength(s->out, len);
+      fwrite(s->packed, 1, len, s->out);
+    }
+  s->n = 0;
+}
+
+static void start(CodecStreamStruct *s)
+{
+  fprintf(s->out, "ENC %s\n", s->codec ? s->codec->name : "none");
+  s->started = 1;
+}
+
+static ssize_t streamWrite(void *cookie, const char *buf, size_t size)
+{
+  CodecStreamStruct *s = cookie;
+  size_t done = 0, n;
+
+  /* The client stopped reading and the send timed out, give up the rest */
+  if (ferror(s->out)) return 0;
+  if (s->codec == NULL)
+    {
+      if (!s->started) start(s);
+      return fwrite(buf, 1, size, s->out);
+    }
+  while (done < size)
+    {
+      n = sizeof(s->raw) - s->n;
+      if (n > size - done) n = size - done;
+      memcpy(s->raw + s->n, buf + done, n);
+      s->n += n;
+      done += n;
+      if (s->n == sizeof(s->raw))
+	{
+	  if (!s->started) start(s);
+	  writeBlock(s);
+	}
+    }
+  return size;
+}
+
+static int streamClose(void *cookie)
+{
+  CodecStreamStruct *s = cookie;
+
+  /* Too little to gain from, and it all fits in the first block */
+  if (!s->started && s->n < CODEC_MIN_REPLY) s->codec = NULL;
+  if (!s->started) start(s);
+  if (s->codec == NULL)
+    {
+      fwrite(s->raw, 1, s->n, s->out);
+      return 0;
+    }
+  if (s->n > 0) writeBlock(s);
+  putLength(s->out, 0);
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * COMPRESS <codec[,codec...]> <command> [args ...]
+ *
+ ******************************************************************************/
+static int queryCompress(void *ctx, FILE *out, int argc, char *argv[])
+{
+  static const cookie_io_functions_t funcs = { NULL, streamWrite, NULL, streamClose };
+  CodecStreamStruct *s = &stream;
+  FILE *fd;
+
+  (void)ctx;
+  if (argc < 3 || strcasecmp(argv[2], "COMPRESS") == 0) return -1;
+  s->out = out;
+  s->codec = codecPick(argv[1]);
+  s->started = 0;
+  s->n = 0;
+
+  fd = fopencookie(s, "w", funcs);
+  if (fd == NULL) return 0;
+  queryDispatch(fd, argc - 2, argv + 2);
+  fclose(fd);
+  return 0;
+}
+
+void codecRegisterQueries(void)
+{
+  queryRegisterDirect("COMPRESS", "<codec[,codec...]> <command> [args ...]", queryCompress, NULL);
+}
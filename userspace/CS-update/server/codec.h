@@ -0,0 +1,55 @@
+/******************************************************************************/
+/**
+ * \file codec.h
+ *
+ * \brief Compressed replies for history transfers over slow links.
+ *
+ *        | COMPRESS <codec[,codec...]> <command> [args ...] |
+ *
+ *        runs the command and compresses its reply with the first codec in
+ *        the client's list that the server has, so the client states its
+ *        preference per request. lz4 is cheap on the CPU, zstd gives the
+ *        better ratio, deflate is always there. The reply starts with
+ *
+ *        | ENC <codec>\n |
+ *
+ *        followed by blocks of at most CODEC_BLOCK bytes of the original
+ *        reply, each compressed on its own:
+ *
+ *        | uint32 length, big endian | length bytes |
+ *
+ *        A length with CODEC_STORED set is a block that did not shrink and
+ *        is sent as it is. A length of 0 ends the reply. Each lz4 block is
+ *        an LZ4 block, each zstd block a zstd frame and each deflate block
+ *        a zlib stream.
+ *
+ *        Replies shorter than CODEC_MIN_REPLY, and requests where no codec
+ *        matches, are answered with "ENC none\n" and the reply as it is.
+ *
+ *        lz4 and zstd are built with HAVE_LZ4 and HAVE_ZSTD, see Makefile.
+ *
+ *        | echo "COMPRESS zstd,deflate EXPORT rollups 0 2000000000" | nc meter 9124 |
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef CODEC_H
+#define CODEC_H
+
+#define CODEC_BLOCK (65536)
+#define CODEC_MIN_REPLY (1024)
+#define CODEC_STORED (0x80000000U)
+
+/* Cheap levels, the ratio gained above these costs several times the CPU */
+#define CODEC_ZSTD_LEVEL (3)
+#define CODEC_DEFLATE_LEVEL (1)
+
+/******************************************************************************/
+/**
+ *
+ * Add the COMPRESS query command
+ *
+ ******************************************************************************/
+void codecRegisterQueries(void);
+
+#endif
@@ -0,0 +1,129 @@
+/******************************************************************************/
+/**
+ * \file demand.c
+ *
+ * \brief 15 minute demand and monthly peaks, see demand.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <time.h>
+#include "demand.h"
+#include "query.h"
+
+#define S_PER_H (3600.0)
+#define NS_PER_S (1e9)
+
+static int monthOf(uint64_t ts)
+{
+  time_t t = ts / 1000000000ULL;
+  struct tm tm;
+
+  localtime_r(&t, &tm);
+  return tm.tm_year * 12 + tm.tm_mon;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Called by the resampler with every completed window
+ *
+ ******************************************************************************/
+static void windowDone(void *ctx, const ResampleRowStruct *row)
+{
+  DemandStruct *d = ctx;
+  int month = monthOf(row->start);
+  int i;
+
+  if (month != d->month)
+    {
+      d->month = month;
+      d->numPeaks = 0;
+    }
+  if (d->numPeaks == DEMAND_TOP_N && row->power <= d->peaks[DEMAND_TOP_N - 1].power) return;
+
+  /* Insertion into the short sorted list */
+  i = (d->numPeaks < DEMAND_TOP_N) ? d->numPeaks++ : DEMAND_TOP_N - 1;
+  for (; i > 0 && d->peaks[i - 1].power < row->power; i--)
+    {
+      d->peaks[i] = d->peaks[i - 1];
+    }
+  d->peaks[i].start = row->start;
+  d->peaks[i].power = row->power;
+}
+
+void demandInit(DemandStruct *d)
+{
+  resamplerInit(&d->window, DEMAND_WINDOW, windowDone, d);
+  d->numPeaks = 0;
+  d->month = -1;
+  d->lastTs = 0;
+  d->lastPower = 0;
+  d->warnedWindow = 0;
+}
+
+double demandProjection(const DemandStruct *d)
+{
+  double left;
+
+  if (d->lastTs == 0) return 0;
+  left = (double)(d->window.bucketStart + DEMAND_WINDOW - d->lastTs) / NS_PER_S;
+  return (d->window.bucketEnergy + d->lastPower * left / S_PER_H) * S_PER_H * NS_PER_S / DEMAND_WINDOW;
+}
+
+int demandPush(DemandStruct *d, uint64_t ts, double wh)
+{
+  double projection, threshold;
+
+  if (d->lastTs != 0 && ts > d->lastTs)
+    {
+      d->lastPower = wh * S_PER_H * NS_PER_S / (ts - d->lastTs);
+    }
+  resamplerPush(&d->window, ts, wh);
+  d->lastTs = ts;
+
+  if (d->window.partial || d->warnedWindow == d->window.bucketStart) return 0;
+
+  /* Until the list is full every window enters it, only warn when a
+   * window would push out one of the peaks */
+  projection = demandProjection(d);
+  threshold = (d->numPeaks == DEMAND_TOP_N && d->month == monthOf(ts)) ?
+    d->peaks[DEMAND_TOP_N - 1].power : 0;
+  if (threshold == 0 || projection <= threshold) return 0;
+  d->warnedWindow = d->window.bucketStart;
+  return 1;
+}
+
+/******************************************************************************/
+/**
+ *
+ * DEMAND
+ *
+ * Prints the current window and the peaks of the month
+ *
+ *        | window <start s> <Wh so far> <projected W> |
+ *        | peak <start s> <W> |
+ *
+ ******************************************************************************/
+static int queryDemand(void *ctx, FILE *out, int argc, char *argv[])
+{
+  DemandStruct *d = ctx;
+  int i;
+
+  (void)argc;
+  (void)argv;
+  fprintf(out, "window %llu %.1f %.1f\n",
+          (unsigned long long)(d->window.bucketStart / 1000000000ULL),
+          d->window.bucketEnergy, demandProjection(d));
+  for (i = 0; i < d->numPeaks; i++)
+    {
+      fprintf(out, "peak %llu %.1f\n",
+              (unsigned long long)(d->peaks[i].start / 1000000000ULL), d->peaks[i].power);
+    }
+  return 0;
+}
+
+void demandRegisterQueries(DemandStruct *d)
+{
+  queryRegister("DEMAND", "", queryDemand, d);
+}
@@ -0,0 +1,75 @@
+/******************************************************************************/
+/**
+ * \file demand.h
+ *
+ * \brief Tracks 15 minute demand and the monthly demand peaks.
+ *
+ *        The demand of a window is its average power. The tariff bills the
+ *        highest windows of the month, so the DEMAND_TOP_N highest are
+ *        kept, and the demand of the current window is projected from the
+ *        energy so far and the present power to warn before it enters the
+ *        list. Everything is updated in constant time per pulse.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef DEMAND_H
+#define DEMAND_H
+
+#include <stdint.h>
+#include "resampler.h"
+
+#define DEMAND_WINDOW (15 * 60 * 1000000000ULL)
+#define DEMAND_TOP_N (3)
+
+typedef struct
+{
+  uint64_t start;  /* Window start, ns since the epoch */
+  double power;    /* Average power over the window, W */
+} DemandPeakStruct;
+
+typedef struct
+{
+  ResamplerStruct window;                 /* Splits the energy at window boundaries */
+  DemandPeakStruct peaks[DEMAND_TOP_N];   /* Highest windows this month, highest first */
+  int numPeaks;
+  int month;                              /* year * 12 + month of the peaks, local time */
+  uint64_t lastTs;
+  double lastPower;                       /* Power of the last pulse interval, W */
+  uint64_t warnedWindow;                  /* Window already warned for */
+} DemandStruct;
+
+void demandInit(DemandStruct *d);
+
+/******************************************************************************/
+/**
+ *
+ * Add a pulse
+ *
+ * \param d, the demand tracker
+ * \param ts, time of the pulse in ns
+ * \param wh, energy since the previous pulse in Wh
+ * \return 1 the first time in a window the projection would enter the
+ *         monthly top list, otherwise 0
+ *
+ ******************************************************************************/
+int demandPush(DemandStruct *d, uint64_t ts, double wh);
+
+/******************************************************************************/
+/**
+ *
+ * Projected average power of the current window in W, assuming the power
+ * of the last interval holds until the window ends
+ *
+ ******************************************************************************/
+double demandProjection(const DemandStruct *d);
+
+/******************************************************************************/
+/**
+ *
+ * Add the DEMAND query command
+ *
+ ******************************************************************************/
+void demandRegisterQueries(DemandStruct *d);
+
+#endif
@@ -0,0 +1,156 @@
+/******************************************************************************/
+/**
+ * \file export.c
+ *
+ * \brief Arrow export of rollups and pulses, see export.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <strings.h>
+#include "arrow.h"
+#include "export.h"
+#include "pulse-kernel.h"
+#include "query.h"
+
+static StoreStruct *exportStore;
+
+/* Where rows or blocks read back from the store go */
+typedef struct
+{
+  ArrowWriterStruct *w;
+  size_t n;
+  uint64_t from;
+  uint64_t to;
+  uint64_t prevTs;
+  double energy0;
+  int failed;
+} ExportStruct;
+
+static const ArrowFieldStruct rollupFields[] =
+  {
+    { "start", ARROW_TIMESTAMP_NS },
+    { "energy_wh", ARROW_FLOAT64 },
+    { "power_w", ARROW_FLOAT32 }
+  };
+
+static const ArrowFieldStruct pulseFields[] =
+  {
+    { "ts", ARROW_TIMESTAMP_NS },
+    { "missed", ARROW_UINT32 },
+    { "interval_s", ARROW_FLOAT32 },
+    { "power_w", ARROW_FLOAT32 },
+    { "energy_wh", ARROW_FLOAT64 }
+  };
+
+static int64_t rowStart[EXPORT_BATCH];
+static double rowEnergy[EXPORT_BATCH];
+static float rowPower[EXPORT_BATCH];
+static const void *const rowColumns[] = { rowStart, rowEnergy, rowPower };
+
+static int exportRow(void *ctx, const StoreRecordStruct *rec)
+{
+  ExportStruct *e = ctx;
+
+  rowStart[e->n] = rec->ts;
+  rowEnergy[e->n] = rec->energy;
+  rowPower[e->n] = rec->power;
+  if (++e->n < EXPORT_BATCH) return 0;
+  e->n = 0;
+  e->failed = (arrowBatch(e->w, EXPORT_BATCH, rowColumns) != 0);
+  return e->failed;
+}
+
+static int exportRollups(ArrowWriterStruct *w, uint64_t from, uint64_t to)
+{
+  ExportStruct e = { w, 0, from, to, 0, 0, 0 };
+
+  if (storeRead(exportStore, STORE_QUARTER, from, to, exportRow, &e) != 0 || e.failed) return -1;
+  return (e.n > 0) ? arrowBatch(w, e.n, rowColumns) : 0;
+}
+
+static int exportBlock(void *ctx, const PulseLogBlockStruct *block)
+{
+  static float interval[PULSELOG_BLOCK_SIZE];
+  static float power[PULSELOG_BLOCK_SIZE];
+  static double energy[PULSELOG_BLOCK_SIZE];
+  const void *columns[] = { NULL, NULL, interval, power, energy };
+  ExportStruct *e = ctx;
+  const uint64_t *ts;
+  size_t first, n;
+
+  n = pulseLogRange(block, e->from, e->to, &first);
+  if (n == 0)
+    {
+      if (block->n > 0) e->prevTs = block->ts[block->n - 1];
+      return 0;
+    }
+  ts = (const uint64_t *)block->ts + first;
+  if (first > 0) e->prevTs = ts[-1];
+  else if (e->prevTs == 0) e->prevTs = ts[0];
+
+  /* A pulse with none stored before it has no interval, so zero power */
+  pulseKernelConvert(ts, n, e->prevTs, WH_PER_PULSE, e->energy0, interval, power, energy);
+  e->prevTs = ts[n - 1];
+  e->energy0 = energy[n - 1];
+
+  columns[0] = block->ts + first;
+  columns[1] = block->missed + first;
+  e->failed = (arrowBatch(e->w, n, columns) != 0);
+  return e->failed;
+}
+
+static int exportPulses(ArrowWriterStruct *w, uint64_t from, uint64_t to)
+{
+  ExportStruct e = { w, 0, from, to, 0, 0, 0 };
+
+  return (storeReadPulses(exportStore, from, to, exportBlock, &e) != 0 || e.failed) ? -1 : 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * EXPORT <rollups|pulses> <from> <to> [stream|file]
+ *
+ * Replies with Arrow instead of text, see export.h
+ *
+ ******************************************************************************/
+static int queryExport(void *ctx, FILE *out, int argc, char *argv[])
+{
+  ArrowWriterStruct w;
+  unsigned long long from, to;
+  int pulses, file = 0;
+
+  (void)ctx;
+  if (argc < 4) return -1;
+  if (strcasecmp(argv[1], "pulses") == 0) pulses = 1;
+  else if (strcasecmp(argv[1], "rollups") == 0) pulses = 0;
+  else return -1;
+  from = queryParseTime(argv[2]);
+  to = queryParseTime(argv[3]);
+  if (to <= from) return -1;
+  if (argc > 4)
+    {
+      if (strcasecmp(argv[4], "file") == 0) file = 1;
+      else if (strcasecmp(argv[4], "stream") != 0) return -1;
+    }
+
+  if (pulses)
+    {
+      if (arrowBegin(&w, out, pulseFields, 5, file) != 0) return 0;
+      if (exportPulses(&w, from, to) != 0) return 0;
+    }
+  else
+    {
+      if (arrowBegin(&w, out, rollupFields, 3, file) != 0) return 0;
+      if (exportRollups(&w, from, to) != 0) return 0;
+    }
+  arrowEnd(&w);
+  return 0;
+}
+
+void exportRegisterQueries(StoreStruct *store)
+{
+  exportStore = store;
+  queryRegisterDirect("EXPORT", "<rollups|pulses> <from> <to> [stream|file]", queryExport, NULL);
+}
@@ -0,0 +1,50 @@
+/******************************************************************************/
+/**
+ * \file export.h
+ *
+ * \brief Exports rollups and raw pulses as Arrow for analytics tools.
+ *
+ *        | EXPORT <rollups|pulses> <from> <to> [stream|file] |
+ *
+ *        The reply on the query port is an Arrow IPC stream, or file, in
+ *        place of text lines:
+ *
+ *        | rollups | start timestamp[ns, UTC], energy_wh double,          |
+ *        |         | power_w float                                        |
+ *        | pulses  | ts timestamp[ns, UTC], missed uint32, interval_s     |
+ *        |         | float, power_w float, energy_wh double               |
+ *
+ *        Both are read back from the store, see store.h, so the range is
+ *        all that was ever stored and not only what is kept in memory.
+ *        Pulses of the last STORE_SYNC_S may not be there yet. The reading
+ *        is done in the query thread, a long export holds up other queries
+ *        but never the pulses.
+ *
+ *        Pulses are sent as one record batch per stored block, ts and
+ *        missed straight from its column arrays, the rest converted a
+ *        block at a time with pulseKernelConvert(). energy_wh counts the
+ *        pulses from the first one exported, missed pulses not included.
+ *        The stored 15 minute rows are gathered into columns EXPORT_BATCH
+ *        rows at a time.
+ *
+ *        | echo "EXPORT rollups 0 2000000000 file" | nc meter 9124 > r.arrow |
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "store.h"
+
+#define EXPORT_BATCH (1024)
+
+/******************************************************************************/
+/**
+ *
+ * Add the EXPORT query command
+ *
+ ******************************************************************************/
+void exportRegisterQueries(StoreStruct *store);
+
+#endif
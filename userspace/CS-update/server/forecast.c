@@ -0,0 +1,151 @@
+/******************************************************************************/
+/**
+ * \file forecast.c
+ *
+ * \brief Day and month energy projection, see forecast.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <time.h>
+#include "forecast.h"
+#include "query.h"
+
+#define NS_PER_S (1000000000ULL)
+#define SLOTS_PER_DAY (24 * 4)
+
+/* Smoothing of the profile, updated once a week per slot, and of the level,
+ * updated every row */
+#define PROFILE_ALPHA (0.2)
+#define LEVEL_ALPHA (0.1)
+#define MEAN_ALPHA (0.01)
+
+#define MIN_LEVEL (0.2)
+#define MAX_LEVEL (5.0)
+
+void forecastInit(ForecastStruct *f)
+{
+  int i;
+
+  for (i = 0; i < FORECAST_SLOTS; i++) f->profile[i] = -1;
+  f->meanRow = -1;
+  f->level = 1;
+  f->day = 0;
+  f->month = 0;
+  f->dayEnergy = 0;
+  f->monthEnergy = 0;
+  f->dayForecast = 0;
+  f->monthForecast = 0;
+}
+
+static double expected(const ForecastStruct *f, int slot)
+{
+  return (f->profile[slot] >= 0 ? f->profile[slot] : f->meanRow) * f->level;
+}
+
+static int daysInMonth(int year, int month)
+{
+  static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+  if (month == 1 && (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))) return 29;
+  return days[month];
+}
+
+/******************************************************************************/
+/**
+ *
+ * Project the day and month from the slot after the given local time
+ *
+ ******************************************************************************/
+static void project(ForecastStruct *f, const struct tm *tm)
+{
+  double dayTotal[7] = { 0 };
+  double rest = 0;
+  int slot = tm->tm_wday * SLOTS_PER_DAY + tm->tm_hour * 4 + tm->tm_min / 15;
+  int i, d, wday, last;
+
+  for (i = 0; i < FORECAST_SLOTS; i++) dayTotal[i / SLOTS_PER_DAY] += expected(f, i);
+  for (i = slot + 1; i < (tm->tm_wday + 1) * SLOTS_PER_DAY; i++) rest += expected(f, i);
+  f->dayForecast = f->dayEnergy + rest;
+
+  last = daysInMonth(tm->tm_year + 1900, tm->tm_mon);
+  for (d = tm->tm_mday + 1, wday = (tm->tm_wday + 1) % 7; d <= last; d++, wday = (wday + 1) % 7)
+    {
+      rest += dayTotal[wday];
+    }
+  f->monthForecast = f->monthEnergy + rest;
+}
+
+void forecastPush(ForecastStruct *f, const RollupRowStruct *row)
+{
+  time_t s = row->start / NS_PER_S;
+  struct tm tm;
+  int slot, day, month;
+  float *p;
+
+  localtime_r(&s, &tm);
+  slot = tm.tm_wday * SLOTS_PER_DAY + tm.tm_hour * 4 + tm.tm_min / 15;
+  month = (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+  day = month * 100 + tm.tm_mday;
+
+  if (day != f->day)
+    {
+      f->day = day;
+      f->dayEnergy = 0;
+    }
+  if (month != f->month)
+    {
+      f->month = month;
+      f->monthEnergy = 0;
+    }
+  f->dayEnergy += row->energy;
+  f->monthEnergy += row->energy;
+
+  /* How this row compares with the typical one moves the level, then the
+   * row becomes part of the profile */
+  p = &f->profile[slot];
+  if (*p > 0)
+    {
+      f->level += LEVEL_ALPHA * (row->energy / *p - f->level);
+      if (f->level < MIN_LEVEL) f->level = MIN_LEVEL;
+      if (f->level > MAX_LEVEL) f->level = MAX_LEVEL;
+    }
+  *p = (*p < 0) ? row->energy : *p + PROFILE_ALPHA * (row->energy - *p);
+  f->meanRow = (f->meanRow < 0) ? row->energy : f->meanRow + MEAN_ALPHA * (row->energy - f->meanRow);
+
+  project(f, &tm);
+}
+
+/******************************************************************************/
+/**
+ *
+ * FORECAST
+ *
+ * Prints the energy so far and the projection for the day and month
+ *
+ *        | day <yyyymmdd> <kWh so far> <kWh projected> |
+ *        | month <yyyymm> <kWh so far> <kWh projected> |
+ *        | level <factor> |
+ *
+ ******************************************************************************/
+static int queryForecast(void *ctx, FILE *out, int argc, char *argv[])
+{
+  ForecastStruct *f = ctx;
+
+  (void)argc;
+  (void)argv;
+  if (f->day == 0)
+    {
+      fprintf(out, "ERR no data yet\n");
+      return 0;
+    }
+  fprintf(out, "day %d %.3f %.3f\n", f->day, f->dayEnergy / 1000, f->dayForecast / 1000);
+  fprintf(out, "month %d %.3f %.3f\n", f->month, f->monthEnergy / 1000, f->monthForecast / 1000);
+  fprintf(out, "level %.3f\n", f->level);
+  return 0;
+}
+
+void forecastRegisterQueries(ForecastStruct *f)
+{
+  queryRegister("FORECAST", "", queryForecast, f);
+}
@@ -0,0 +1,56 @@
+/******************************************************************************/
+/**
+ * \file forecast.h
+ *
+ * \brief Projects the energy of the day and month from the rollups.
+ *
+ *        Each 15 minute slot of the week has an exponentially smoothed
+ *        typical energy. A level factor, smoothed over the last hours,
+ *        scales the profile to how today compares with a typical week.
+ *        The projection is the energy so far plus the scaled profile for
+ *        the rest of the day or month, recomputed with every rollup row.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef FORECAST_H
+#define FORECAST_H
+
+#include <stdint.h>
+#include "rollup.h"
+
+#define FORECAST_SLOTS (7 * 24 * 4)
+
+typedef struct
+{
+  float profile[FORECAST_SLOTS];  /* Typical Wh per slot, negative if unknown */
+  double meanRow;                 /* Smoothed Wh of any row, for unknown slots */
+  double level;                   /* Recent consumption relative to the profile */
+
+  int day;                        /* yyyymmdd */
+  int month;                      /* yyyymm */
+  double dayEnergy;               /* Wh so far */
+  double monthEnergy;             /* Wh so far */
+  double dayForecast;             /* Wh projected for the whole day */
+  double monthForecast;           /* Wh projected for the whole month */
+} ForecastStruct;
+
+void forecastInit(ForecastStruct *f);
+
+/******************************************************************************/
+/**
+ *
+ * Add a completed rollup row and recompute the projections
+ *
+ ******************************************************************************/
+void forecastPush(ForecastStruct *f, const RollupRowStruct *row);
+
+/******************************************************************************/
+/**
+ *
+ * Add the FORECAST query command
+ *
+ ******************************************************************************/
+void forecastRegisterQueries(ForecastStruct *f);
+
+#endif
@@ -0,0 +1,327 @@
+/******************************************************************************/
+/**
+ * \file influx.c
+ *
+ * \brief InfluxDB line protocol exporter, see influx.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "influx.h"
+
+#define NS_PER_S (1000000000ULL)
+#define BATCH (32)
+#define TIMEOUT_S (5)
+
+/* Result of a POST */
+#define POST_OK (0)
+#define POST_REJECTED (1)
+#define POST_FAILED (-1)
+
+/******************************************************************************/
+/**
+ *
+ * Split "http://host[:port]/path" into its parts
+ *
+ ******************************************************************************/
+static int parseUrl(InfluxStruct *x, const char *url)
+{
+  const char *host, *slash, *colon;
+  size_t len;
+
+  if (strncmp(url, "http://", 7) != 0) return -1;
+  host = url + 7;
+  slash = strchr(host, '/');
+  if (slash == NULL) slash = host + strlen(host);
+  colon = memchr(host, ':', slash - host);
+  len = (colon ? colon : slash) - host;
+  if (len == 0 || len >= sizeof(x->host)) return -1;
+  memcpy(x->host, host, len);
+  x->host[len] = '\0';
+  if (colon)
+    {
+      len = slash - colon - 1;
+      if (len == 0 || len >= sizeof(x->port)) return -1;
+      memcpy(x->port, colon + 1, len);
+      x->port[len] = '\0';
+    }
+  else strcpy(x->port, "80");
+  snprintf(x->path, sizeof(x->path), "%s", *slash ? slash : "/");
+  return 0;
+}
+
+int influxInit(InfluxStruct *x, const char *url, const char *spillFileName)
+{
+  char hostName[33];
+  const char *token = getenv("INFLUX_TOKEN");
+  size_t i, n = 0;
+
+  memset(x, 0, sizeof(*x));
+  if (parseUrl(x, url) != 0) return -1;
+  if (token != NULL) snprintf(x->token, sizeof(x->token), "%s", token);
+
+  /* Measurement and tag are the same on every line, spaces, commas and
+   * equal signs in the tag value are escaped */
+  if (gethostname(hostName, sizeof(hostName)) != 0) strcpy(hostName, "wattmeter");
+  hostName[sizeof(hostName) - 1] = '\0';
+  n += snprintf(x->prefix, sizeof(x->prefix), "power,host=");
+  for (i = 0; hostName[i] != '\0'; i++)
+    {
+      if (strchr(" ,=", hostName[i]) != NULL) x->prefix[n++] = '\\';
+      x->prefix[n++] = hostName[i];
+    }
+  x->prefix[n++] = ' ';
+  x->prefix[n] = '\0';
+  x->prefixLen = n;
+
+  if (deflateInit2(&x->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      return -1;
+    }
+  x->spill = fopen(spillFileName, "a+");
+  return (x->spill != NULL) ? 0 : -1;
+}
+
+static char *putUint(char *p, uint64_t v)
+{
+  char digits[20];
+  int n = 0;
+
+  do
+    {
+      digits[n++] = '0' + v % 10;
+      v /= 10;
+    }
+  while (v > 0);
+  while (n > 0) *p++ = digits[--n];
+  return p;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Write a non-negative value with a fixed number of decimals
+ *
+ ******************************************************************************/
+static char *putFixed(char *p, double v, int decimals)
+{
+  uint64_t scale = 1, scaled, frac;
+  int i;
+
+  for (i = 0; i < decimals; i++) scale *= 10;
+  scaled = (v > 0) ? (uint64_t)(v * scale + 0.5) : 0;
+  p = putUint(p, scaled / scale);
+  if (decimals == 0) return p;
+  *p++ = '.';
+  frac = scaled % scale;
+  for (i = decimals - 1; i >= 0; i--)
+    {
+      p[i] = '0' + frac % 10;
+      frac /= 10;
+    }
+  return p + decimals;
+}
+
+size_t influxFormat(const InfluxStruct *x, char *out, const PublishRecordStruct *rec)
+{
+  char *p = out;
+
+  memcpy(p, x->prefix, x->prefixLen);
+  p += x->prefixLen;
+  memcpy(p, "energy=", 7);
+  p = putFixed(p + 7, rec->energy, 3);
+  memcpy(p, ",power=", 7);
+  p = putFixed(p + 7, rec->power, 1);
+  *p++ = ' ';
+  p = putUint(p, rec->ts / NS_PER_S);
+  *p++ = '\n';
+  return p - out;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Compress and POST lines to the database
+ *
+ * \return POST_OK, POST_REJECTED if the data was refused or POST_FAILED if
+ *         the database could not be reached
+ *
+ ******************************************************************************/
+static int post(InfluxStruct *x, const char *data, size_t len)
+{
+  struct addrinfo hints, *res;
+  struct timeval tv = { TIMEOUT_S, 0 };
+  char head[512], reply[64];
+  size_t gzLen, headLen;
+  ssize_t n;
+  int fd, status;
+
+  deflateReset(&x->z);
+  x->z.next_in = (unsigned char *)data;
+  x->z.avail_in = len;
+  x->z.next_out = x->gz;
+  x->z.avail_out = sizeof(x->gz);
+  if (deflate(&x->z, Z_FINISH) != Z_STREAM_END) return POST_REJECTED;
+  gzLen = sizeof(x->gz) - x->z.avail_out;
+
+  headLen = snprintf(head, sizeof(head),
+		     "POST %s HTTP/1.1\r\n"
+		     "Host: %s:%s\r\n"
+		     "Content-Type: text/plain; charset=utf-8\r\n"
+		     "Content-Encoding: gzip\r\n"
+		     "Content-Length: %zu\r\n"
+		     "%s%s%s"
+		     "Connection: close\r\n\r\n",
+		     x->path, x->host, x->port, gzLen,
+		     x->token[0] ? "Authorization: Token " : "", x->token, x->token[0] ? "\r\n" : "");
+  if (headLen >= sizeof(head)) return POST_REJECTED;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(x->host, x->port, &hints, &res) != 0) return POST_FAILED;
+  fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd < 0)
+    {
+      freeaddrinfo(res);
+      return POST_FAILED;
+    }
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  status = connect(fd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (status != 0 ||
+      send(fd, head, headLen, MSG_NOSIGNAL | MSG_MORE) != (ssize_t)headLen ||
+      send(fd, x->gz, gzLen, MSG_NOSIGNAL) != (ssize_t)gzLen ||
+      (n = recv(fd, reply, sizeof(reply) - 1, 0)) <= 0)
+    {
+      close(fd);
+      return POST_FAILED;
+    }
+  close(fd);
+  reply[n] = '\0';
+  if (sscanf(reply, "HTTP/1.%*d %d", &status) != 1) return POST_FAILED;
+  if (status >= 200 && status < 300) return POST_OK;
+  if (status >= 400 && status < 500 && status != 429) return POST_REJECTED;
+  return POST_FAILED;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Keep the batch in the spill file, dropped if the file is full
+ *
+ ******************************************************************************/
+static void spillBatch(InfluxStruct *x)
+{
+  fseek(x->spill, 0, SEEK_END);
+  if (ftell(x->spill) + (long)x->batchLen <= INFLUX_SPILL_MAX)
+    {
+      fwrite(x->batch, 1, x->batchLen, x->spill);
+      fflush(x->spill);
+    }
+  x->batchLen = 0;
+}
+
+static void failed(InfluxStruct *x, time_t now)
+{
+  x->backoff = (x->backoff == 0) ? 1 : x->backoff * 2;
+  if (x->backoff > INFLUX_MAX_BACKOFF_S) x->backoff = INFLUX_MAX_BACKOFF_S;
+  x->nextTry = now + x->backoff;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Send the spill file and then the batch, if it is due
+ *
+ * \param x, the exporter
+ * \param now, present time
+ * \param force, send the batch even if it is not full or old
+ * \return None
+ *
+ ******************************************************************************/
+static void deliver(InfluxStruct *x, time_t now, int force)
+{
+  size_t n;
+
+  if (now < x->nextTry) return;
+  if (fseek(x->spill, x->spillPos, SEEK_SET) == 0)
+    {
+      while ((n = fread(x->chunk, 1, sizeof(x->chunk), x->spill)) > 0)
+	{
+	  /* Whole lines only */
+	  while (n > 0 && x->chunk[n - 1] != '\n') n--;
+	  if (n == 0) break;
+	  if (post(x, x->chunk, n) == POST_FAILED)
+	    {
+	      failed(x, now);
+	      return;
+	    }
+	  x->spillPos += n;
+	  fseek(x->spill, x->spillPos, SEEK_SET);
+	}
+      clearerr(x->spill);
+      if (x->spillPos > 0 && ftruncate(fileno(x->spill), 0) == 0) x->spillPos = 0;
+    }
+
+  if (x->batchLen == 0 || (!force && now - x->batchStart < INFLUX_BATCH_S)) return;
+  if (post(x, x->batch, x->batchLen) == POST_FAILED)
+    {
+      spillBatch(x);
+      failed(x, now);
+      return;
+    }
+  x->batchLen = 0;
+  x->backoff = 0;
+}
+
+static void addRow(InfluxStruct *x, const PublishRecordStruct *rec, time_t now)
+{
+  if (x->batchLen + INFLUX_LINE_MAX > sizeof(x->batch))
+    {
+      deliver(x, now, 1);
+      if (x->batchLen > 0) spillBatch(x);
+    }
+  if (x->batchLen == 0) x->batchStart = now;
+  x->batchLen += influxFormat(x, x->batch + x->batchLen, rec);
+}
+
+static void *influxThread(void *arg)
+{
+  InfluxStruct *x = arg;
+  PublishRecordStruct recs[BATCH];
+  size_t i, n;
+
+  for (;;)
+    {
+      spscWait(&x->queue, 1000);
+      while ((n = spscGet(&x->queue, recs, BATCH)) > 0)
+	{
+	  for (i = 0; i < n; i++) addRow(x, &recs[i], time(NULL));
+	}
+      deliver(x, time(NULL), 0);
+    }
+  return NULL;
+}
+
+int influxStart(InfluxStruct *x)
+{
+  if (spscInit(&x->queue, "influx", sizeof(PublishRecordStruct), INFLUX_QUEUE) != 0) return -1;
+  return (pthread_create(&x->thread, NULL, influxThread, x) == 0) ? 0 : -1;
+}
+
+void influxSink(void *ctx, const PublishRecordStruct *rec)
+{
+  InfluxStruct *x = ctx;
+
+  if (rec->type != PUBLISH_ROW) return;
+  spscPut(&x->queue, rec);
+  spscFlush(&x->queue);
+}
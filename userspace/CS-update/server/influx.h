@@ -0,0 +1,119 @@
+/******************************************************************************/
+/**
+ * \file influx.h
+ *
+ * \brief Exports the 15 minute rollup rows to InfluxDB in line protocol.
+ *
+ *        | power,host=<host> energy=<Wh>,power=<W> <s since the epoch> |
+ *
+ *        A sink of the publish stage hands the rows to the exporter thread
+ *        through an SPSC queue, so a slow or unreachable database never
+ *        holds up MQTT or the alerts.
+ *
+ *        Rows are formatted straight into a fixed batch buffer, without
+ *        printf and without allocating. A batch is sent when it reaches
+ *        INFLUX_BATCH_BYTES or is INFLUX_BATCH_S old, gzip compressed in
+ *        one HTTP POST to the write URL, for example
+ *
+ *        | http://localhost:8086/write?db=power&precision=s |
+ *        | http://localhost:8086/api/v2/write?org=home&bucket=power&precision=s |
+ *
+ *        with INFLUX_TOKEN from the environment sent as the token, if set.
+ *
+ *        A batch that cannot be delivered goes to a spill file of at most
+ *        INFLUX_SPILL_MAX bytes, which is sent first, in order, once the
+ *        database answers again. A batch the database rejects with 4xx is
+ *        dropped, retrying would not help.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef INFLUX_H
+#define INFLUX_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <zlib.h>
+#include "publish.h"
+#include "spsc.h"
+
+#define INFLUX_QUEUE (256)
+#define INFLUX_BATCH_BYTES (16 * 1024)
+#define INFLUX_BATCH_S (60)
+#define INFLUX_SPILL_MAX (16 * 1024 * 1024)
+#define INFLUX_MAX_BACKOFF_S (300)
+
+/* Longest line: measurement, host tag, two fields and the time */
+#define INFLUX_LINE_MAX (192)
+
+typedef struct
+{
+  char host[64];
+  char port[8];
+  char path[192];
+  char token[128];
+  char prefix[80];                          /* "power,host=<host> " */
+  size_t prefixLen;
+
+  SpscStruct queue;
+  pthread_t thread;
+
+  char batch[INFLUX_BATCH_BYTES];
+  size_t batchLen;
+  time_t batchStart;                        /* When the first row came */
+  char chunk[INFLUX_BATCH_BYTES];           /* Read back from the spill file */
+  unsigned char gz[INFLUX_BATCH_BYTES + INFLUX_BATCH_BYTES / 8 + 64];
+  z_stream z;
+
+  FILE *spill;
+  long spillPos;                            /* Next byte to send */
+  time_t nextTry;
+  int backoff;                              /* s */
+} InfluxStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Set up the exporter
+ *
+ * \param x, the exporter
+ * \param url, the write URL, http only
+ * \param spillFileName, where batches wait while the database is away
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int influxInit(InfluxStruct *x, const char *url, const char *spillFileName);
+
+/******************************************************************************/
+/**
+ *
+ * Start the exporter thread
+ *
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int influxStart(InfluxStruct *x);
+
+/******************************************************************************/
+/**
+ *
+ * Publish sink, add with publishAddSink(p, influxSink, x)
+ *
+ ******************************************************************************/
+void influxSink(void *ctx, const PublishRecordStruct *rec);
+
+/******************************************************************************/
+/**
+ *
+ * Format one row in line protocol
+ *
+ * \param x, the exporter, for the measurement and tags
+ * \param out, at least INFLUX_LINE_MAX bytes
+ * \param rec, a PUBLISH_ROW record
+ * \return the length of the line, including the newline
+ *
+ ******************************************************************************/
+size_t influxFormat(const InfluxStruct *x, char *out, const PublishRecordStruct *rec);
+
+#endif
@@ -12,24 +12,96 @@
  *
  ******************************************************************************/
 #include <getopt.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 #include "CS-defs.h"
+#include "alerts.h"
+#include "baseline.h"
+#include "capture.h"
+#include "codec.h"
+#include "demand.h"
+#include "export.h"
+#include "forecast.h"
+#include "influx.h"
+#include "metrics.h"
+#include "mqtt.h"
+#include "probes.h"
+#include "pulse-kernel.h"
+#include "pulse-source.h"
+#include "pulselog.h"
+#include "publish.h"
+#include "query.h"
+#include "query-stage.h"
+#include "reconcile.h"
+#include "resampler.h"
+#include "rollup.h"
+#include "spsc.h"
+#include "steps.h"
+#include "store.h"
+#include "subscribe.h"
+#include "tariff.h"
 
 const char *logFileName = "/tmp/power-update-server.log";
-const char *powerFileName = "/sys/tomas/gpio60/diffTime";
-const char *consumptionFileName = "/sys/tomas/gpio60/numWattHours";
+const char *meterDir = "/sys/tomas/gpio60";
+char powerFileName[PATH_MAX];
+char consumptionFileName[PATH_MAX];
+char pulseFileName[PATH_MAX];
+const char *storePrefix = "/tmp/power";
+const char *mqttQueueFileName = "/tmp/power-mqtt.queue";
+const char *influxSpillFileName = "/tmp/power-influx.spill";
 static int numRequests = 0;
 static int numFails = 0;
+static uint64_t numGaps = 0;
 
 #define SCALE (3600)
 
+/* Wake up at least this often even without pulses or clients */
+#define TICK_MS (1000)
+
+#define NS_PER_S (1000000000ULL)
+
+/* Pulses taken from the capture queue at a time */
+#define PULSE_BATCH (32)
+
+static CaptureStruct capture;
+static StoreStruct store;
+static PublishStruct publish;
+static MetricsStruct metrics;
+static QueryStageStruct queryStage;
+static SubscribeStruct subscribe;
+static ResamplerStruct secondResampler;
+static RollupStruct rollup;
+static PulseLogStruct pulseLog;
+static DemandStruct demand;
+static StepsStruct steps;
+static BaselineStruct baseline;
+static ForecastStruct forecast;
+static ReconcileStruct reconcile;
+static TariffStruct tariff;
+static int haveTariff = 0;
+static AlertsStruct alerts;
+static int haveAlerts = 0;
+static const char *alertSocketName = NULL;
+static int alertSockfd = -1;
+static MqttStruct mqtt;
+static int haveMqtt = 0;
+static InfluxStruct influx;
+static int haveInflux = 0;
+static uint64_t lastPulseTs = 0;
+static uint64_t captureStartTs = 0;
+static uint64_t lastPulseInterval = 0;
+
 
 /******************************************************************************/
 /**
@@ -60,6 +132,390 @@ static void usage(void)
 {
   printf("Listen on port 9123 for connections");
   printf("\n");
+  printf("  -t file  time-of-use tariff, see tariff.h");
+  printf("\n");
+  printf("  -r file  alert rules, see alerts.h");
+  printf("\n");
+  printf("  -a path  unix datagram socket to send alerts to");
+  printf("\n");
+  printf("  -m host[:port]  MQTT broker to publish to, see mqtt.h");
+  printf("\n");
+  printf("  -i url   InfluxDB write URL to export rollups to, see influx.h");
+  printf("\n");
+  printf("  -s engine  storage engine, log (default) or sqlite, see store.h");
+  printf("\n");
+  printf("  -d dir   attributes of the meter, default %s, or a fake tree", meterDir);
+  printf("\n");
+}
+
+/******************************************************************************/
+/**
+ *
+ * Called by the resampler with every completed second
+ *
+ ******************************************************************************/
+static void secondDone(void *ctx, const ResampleRowStruct *row)
+{
+  (void)ctx;
+  storeRow(&store, STORE_SECOND, row->start, row->power, row->energy);
+  rollupAddSecond(&rollup, row);
+  stepsPush(&steps, row->start, row->power);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Called by the step detector when an appliance switched on or off
+ *
+ *        | s since the epoch | step <+-W> <signature> |
+ *
+ ******************************************************************************/
+static void stepDone(void *ctx, const StepEventStruct *event)
+{
+  (void)ctx;
+  storeEvent(&store, event->ts, "step %+.0f %d", event->watt, event->signature);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Called by the rollup with every completed 15 minutes
+ *
+ ******************************************************************************/
+static void quarterDone(void *ctx, const RollupRowStruct *row)
+{
+  double power = row->energy * SCALE * NS_PER_S / ROLLUP_PERIOD;
+
+  (void)ctx;
+  storeRow(&store, STORE_QUARTER, row->start, power, row->energy);
+  publishRow(&publish, row->start, power, row->energy);
+  baselinePush(&baseline, row);
+  forecastPush(&forecast, row);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Called by the rollup when lost energy was put back into a completed
+ * row. The row is stored and published again, and replaces the first one
+ * in the storage engines and in InfluxDB.
+ *
+ ******************************************************************************/
+static void quarterAdjusted(void *ctx, const RollupRowStruct *row)
+{
+  double power = row->energy * SCALE * NS_PER_S / ROLLUP_PERIOD;
+
+  (void)ctx;
+  storeRow(&store, STORE_QUARTER, row->start, power, row->energy);
+  publishRow(&publish, row->start, power, row->energy);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Called by the reconciler with every register reading, stored to be
+ * taken up again after a restart, see restoreRegister()
+ *
+ *        | s since the epoch | register <Wh> |
+ *
+ ******************************************************************************/
+static void registerDone(void *ctx, uint64_t ts, double reg)
+{
+  (void)ctx;
+  storeEvent(&store, ts, "register %.0f", reg);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Called by the baseline with unusual hours and standby creep
+ *
+ *        | s since the epoch | anomaly <high|low> <kWh> <expected kWh> |
+ *        | s since the epoch | creep <standby W> <W 4 weeks earlier> |
+ *
+ ******************************************************************************/
+static void baselineDone(void *ctx, uint64_t ts, int type, double value, double expected)
+{
+  static const char *types[] = { "anomaly high", "anomaly low", "creep" };
+
+  (void)ctx;
+  storeEvent(&store, ts, "%s %.3f %.3f", types[type], value, expected);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Called when an alert rule is raised or cleared. The event is stored and
+ * published.
+ *
+ *        | s since the epoch | alert <raise|clear> <name> <value> |
+ *
+ ******************************************************************************/
+static void alertDone(void *ctx, uint64_t now, const AlertRuleStruct *rule, double value)
+{
+  char msg[PUBLISH_TEXT];
+
+  (void)ctx;
+  snprintf(msg, sizeof(msg), "alert %s %s %.0f", rule->raised ? "raise" : "clear",
+	   rule->name, value);
+  storeEvent(&store, now, "%s", msg);
+  publishAlert(&publish, now, msg);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Publish sink sending alerts as datagrams to alertSocketName, if anyone
+ * is listening
+ *
+ *        | s since the epoch | alert <raise|clear> <name> <value> |
+ *
+ ******************************************************************************/
+static void alertSend(void *ctx, const PublishRecordStruct *rec)
+{
+  struct sockaddr_un addr;
+  char msg[PUBLISH_TEXT + 24];
+  int n;
+
+  (void)ctx;
+  if (rec->type != PUBLISH_ALERT) return;
+  n = snprintf(msg, sizeof(msg), "%llu %s\n", (unsigned long long)(rec->ts / NS_PER_S), rec->text);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, alertSocketName, sizeof(addr.sun_path) - 1);
+  sendto(alertSockfd, msg, n, MSG_DONTWAIT, (struct sockaddr *) &addr, sizeof(addr));
+}
+
+/******************************************************************************/
+/**
+ *
+ * Keep the latest register reading among the stored events
+ *
+ ******************************************************************************/
+static int findRegister(void *ctx, const StoreRecordStruct *rec)
+{
+  ReconcileAnchorStruct *anchor = ctx;
+  double reg;
+
+  if (sscanf(rec->text, "register %lf", &reg) == 1)
+    {
+      anchor->ts = rec->ts;
+      anchor->reg = reg;
+    }
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Add up the energy of stored pulses after the register reading
+ *
+ ******************************************************************************/
+static int countSince(void *ctx, const PulseLogBlockStruct *block)
+{
+  ReconcileAnchorStruct *anchor = ctx;
+  size_t i, first, n;
+
+  n = pulseLogRange(block, anchor->ts + 1, INT64_MAX, &first);
+  for (i = first; i < first + n; i++) anchor->counted += (1 + block->missed[i]) * WH_PER_PULSE;
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Take up the latest register reading stored before a restart, with the
+ * energy of the pulses stored since. Pulses not yet synced when the server
+ * stopped, and pulses while it was down, are lost energy to the next
+ * reading.
+ *
+ ******************************************************************************/
+static void restoreRegister(void)
+{
+  ReconcileAnchorStruct anchor = { 0, 0, 0 };
+
+  if (storeRead(&store, STORE_EVENT, 0, INT64_MAX, findRegister, &anchor) != 0) return;
+  if (anchor.ts == 0) return;
+  if (storeReadPulses(&store, anchor.ts + 1, INT64_MAX, countSince, &anchor) != 0) return;
+  reconcileRestore(&reconcile, anchor.ts, anchor.reg, anchor.counted);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Present power in W. Between pulses the last interval is used until it has
+ * passed, after that the power must be below one pulse over the time since.
+ *
+ ******************************************************************************/
+static double livePower(uint64_t now)
+{
+  uint64_t elapsed;
+
+  if (lastPulseTs == 0 || lastPulseInterval == 0) return 0;
+  elapsed = (now > lastPulseTs) ? now - lastPulseTs : 0;
+  if (elapsed < lastPulseInterval) elapsed = lastPulseInterval;
+  return WH_PER_PULSE * SCALE * NS_PER_S / elapsed;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Evaluate the alert rules with the present values
+ *
+ ******************************************************************************/
+static void evaluateAlerts(void)
+{
+  AlertInputStruct in;
+  struct timespec ts;
+  uint64_t now;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  now = (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+  in.power = livePower(now);
+  in.demand = demandProjection(&demand);
+  in.lastPulse = lastPulseTs;
+  in.started = captureStartTs;
+  alertsEvaluate(&alerts, now, &in);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Feed a pulse from the module to everything that follows the pulse stream
+ *
+ * \param pulse, the new pulse
+ * \return None
+ *
+ ******************************************************************************/
+static void ingestPulse(const PulseStruct *pulse)
+{
+  double wh = (1 + pulse->missed) * WH_PER_PULSE;
+  TraceStruct trace = pulse->trace;
+  double total;
+  FILE *logFd;
+
+  traceStamp(&trace, TRACE_COMPUTE);
+  PROBE3(pulse__ingest, pulse->ts, pulse->missed, trace.at[TRACE_COMPUTE] - pulse->ts);
+  pulseLogAdd(&pulseLog, pulse->ts, pulse->missed);
+  storePulse(&store, pulse->ts, pulse->missed);
+  resamplerPush(&secondResampler, pulse->ts, wh);
+  if (demandPush(&demand, pulse->ts, wh))
+    {
+      logFd = fopen(logFileName, "a+");
+      fprintf(logFd, "Demand warning: %.0f W projected for this window\n",
+	      demandProjection(&demand));
+      fclose(logFd);
+    }
+  if (haveTariff) tariffPush(&tariff, pulse->ts, wh);
+  if (reconcilePush(&reconcile, pulse->ts, wh))
+    {
+      storeEvent(&store, pulse->ts, "gap %llu",
+		 (unsigned long long)((pulse->ts - lastPulseTs) / NS_PER_S));
+      numGaps++;
+    }
+  metricsPulse(&metrics, (lastPulseTs != 0 && pulse->ts > lastPulseTs) ? pulse->ts - lastPulseTs : 0,
+	       pulse->missed);
+
+  if (lastPulseTs != 0 && pulse->ts > lastPulseTs)
+    {
+      lastPulseInterval = (pulse->ts - lastPulseTs) / (1 + pulse->missed);
+    }
+  lastPulseTs = pulse->ts;
+  reconcileTotal(&reconcile, &total);
+  publishLive(&publish, pulse->ts, livePower(pulse->ts), total, &trace);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Compute stage: take the captured pulses in batches and process them
+ *
+ ******************************************************************************/
+static void ingestCaptured(void)
+{
+  PulseStruct pulses[PULSE_BATCH];
+  size_t i, n;
+
+  captureWait(&capture, 0);
+  while ((n = captureGet(&capture, pulses, PULSE_BATCH)) > 0)
+    {
+      for (i = 0; i < n; i++) ingestPulse(&pulses[i]);
+    }
+}
+
+/******************************************************************************/
+/**
+ *
+ * Publish the present values to scrapes on METRICS_PORT
+ *
+ ******************************************************************************/
+static void updateMetrics(void)
+{
+  MetricsValuesStruct values;
+  struct timespec ts;
+  uint64_t now;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  now = (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+  values.counted = reconcile.counted;
+  reconcileTotal(&reconcile, &values.energy);
+  /* Rounded as exposed, so steady power between pulses changes nothing */
+  values.power = round(livePower(now) * 10) / 10;
+  values.requests = numRequests;
+  values.fails = numFails;
+  values.queries = queryStageCount(&queryStage);
+  values.gaps = numGaps;
+  metricsUpdate(&metrics, &values, now);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Answer one client with the current watt and Wh
+ *
+ * \param newsockfd, the accepted client socket, closed on return
+ * \return None
+ *
+ ******************************************************************************/
+static void serveClient(int newsockfd)
+{
+  PowerReportStruct report;
+  FILE *fd;
+  FILE *logFd;
+  float diffTime;
+  uint32_t wh;
+  double total;
+  int n;
+
+  numRequests++;
+
+  fd = fopen(powerFileName, "r");
+  fscanf(fd, "%f", &diffTime);
+  fclose(fd);
+
+  fd = fopen(consumptionFileName, "r");
+  fscanf(fd, "%d", &wh);
+  fclose(fd);
+
+  report.W = (SCALE/diffTime);
+  report.Wh = wh;
+
+  /* Once the meter register has been read, follow it instead of the count */
+  if (reconcileTotal(&reconcile, &total)) report.Wh = total;
+  PROBE2(snapshot__refresh, report.W, report.Wh);
+
+  /* Transmit first block of protocol, the number of bytes to expect */
+  n = write(newsockfd, &report ,sizeof(report));
+  PROBE2(response__write, newsockfd, n);
+  close(newsockfd);
+  if (n != sizeof(report))
+    {
+      logFd = fopen(logFileName, "a+");
+      fprintf(logFd, "Error on write()\n");
+      fclose(logFd);
+      numFails++;
+    }
 }
 
 /******************************************************************************/
@@ -72,9 +528,28 @@ static void usage(void)
  * 1. watt and kWh are reported
  * 2. File and socket is closed
  *
+ * In between, pulses from the module are stored and resampled to 1 s and
+ * 15 min series which are stored under storePrefix, see store.h, and text
+ * queries are answered on QUERY_PORT, see query.h, and Prometheus scrapes
+ * on METRICS_PORT, see metrics.h.
+ *
+ * The work is split in stages connected by SPSC queues, see spsc.h. The
+ * capture thread reads pulses, this loop computes and answers clients on
+ * PORT, the store thread writes to the storage engine, the publish thread
+ * pushes live values and alerts out and the query thread serves
+ * QUERY_PORT with replies rendered here and METRICS_PORT with the
+ * metrics published here.
+ *
  * Up to 5 clients can be queued up simultaneously
  *
  * \param -h print help
+ * \param -t tariff file for cost accounting
+ * \param -r alert rules file
+ * \param -a unix socket for alerts
+ * \param -m MQTT broker
+ * \param -i InfluxDB write URL
+ * \param -s storage engine
+ * \param -d directory of the meter attributes, see pulse-replay for a fake
  * \return Daemonizes
  *
  ******************************************************************************/
@@ -82,20 +557,72 @@ int main(int argc, char *argv[])
 {
   int32_t opt;
   int sockfd, newsockfd;
-  PowerReportStruct report;
   socklen_t clilen;
   struct sockaddr_in serv_addr, cli_addr;
-  int n;
-  FILE *fd;
   FILE *logFd;
-  float diffTime;
-  uint32_t wh;
+  const StoreEngineStruct *storeEng = &storeLogEngine;
+  struct pollfd fds[3];
+  struct timespec startTime;
+  int querySockfd;
+  int metricsSockfd;
+  int nfds;
+  int line;
 
   /* Parse command line for required information */
-  while ((opt = getopt(argc, argv, "h")) != -1)
+  while ((opt = getopt(argc, argv, "ht:r:a:m:i:s:d:")) != -1)
     {
       switch (opt)
 	{
+	case 't':
+	  {
+	    if (tariffLoad(&tariff, optarg, &line) != 0)
+	      {
+		printf("Bad tariff %s at line %d\n", optarg, line);
+		error("Failed to load tariff");
+	      }
+	    haveTariff = 1;
+	    break;
+	  }
+	case 'r':
+	  {
+	    if (alertsLoad(&alerts, optarg, &line, alertDone, NULL) != 0)
+	      {
+		printf("Bad alert rules %s at line %d\n", optarg, line);
+		error("Failed to load alert rules");
+	      }
+	    haveAlerts = 1;
+	    break;
+	  }
+	case 'a':
+	  {
+	    alertSocketName = optarg;
+	    alertSockfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	    if (alertSockfd < 0) error("ERROR opening alert socket");
+	    break;
+	  }
+	case 'm':
+	  {
+	    if (mqttInit(&mqtt, optarg, mqttQueueFileName) != 0) error("Bad MQTT broker");
+	    haveMqtt = 1;
+	    break;
+	  }
+	case 'i':
+	  {
+	    if (influxInit(&influx, optarg, influxSpillFileName) != 0) error("Bad InfluxDB URL");
+	    haveInflux = 1;
+	    break;
+	  }
+	case 's':
+	  {
+	    storeEng = storeEngine(optarg);
+	    if (storeEng == NULL) error("Unknown storage engine");
+	    break;
+	  }
+	case 'd':
+	  {
+	    meterDir = optarg;
+	    break;
+	  }
 	case 'h':
 	  {
 	    usage();
@@ -109,6 +636,9 @@ int main(int argc, char *argv[])
 	  }
 	}
     }
+  snprintf(powerFileName, sizeof(powerFileName), "%s/diffTime", meterDir);
+  snprintf(consumptionFileName, sizeof(consumptionFileName), "%s/numWattHours", meterDir);
+  snprintf(pulseFileName, sizeof(pulseFileName), "%s/lastPulse", meterDir);
   
     /* Daemonize */
   if (daemon(1,1) != 0) error("Failed to daemonize");
@@ -127,14 +657,84 @@ int main(int argc, char *argv[])
   /* Tell OS we are interested, and tell it to keep a queue of 5 clients */
   if (listen(sockfd,5) != 0) error("Failed to listen");
   
+  querySockfd = queryListen(QUERY_PORT);
+  if (querySockfd < 0) error("ERROR on query socket");
+  metricsSockfd = metricsListen(METRICS_PORT);
+  if (metricsSockfd < 0) error("ERROR on metrics socket");
+  metricsInit(&metrics);
+  rollupRegisterQueries(&rollup);
+  demandRegisterQueries(&demand);
+  stepsRegisterQueries(&steps);
+  baselineRegisterQueries(&baseline);
+  forecastRegisterQueries(&forecast);
+  reconcileRegisterQueries(&reconcile);
+  if (haveTariff) tariffRegisterQueries(&tariff);
+  if (haveAlerts) alertsRegisterQueries(&alerts);
+  spscRegisterQueries();
+  exportRegisterQueries(&store);
+  codecRegisterQueries();
+  subscribeRegisterQueries(&subscribe);
+
+  /* Follow the pulses, the server still answers clients without them */
+  if (storeStart(&store, storeEng, storePrefix) != 0) error("Failed to start store");
+  publishInit(&publish);
+  if (alertSockfd >= 0) publishAddSink(&publish, alertSend, NULL);
+  if (subscribeInit(&subscribe) != 0) error("Failed to set up subscriptions");
+  publishAddSink(&publish, subscribeSink, &subscribe);
+  if (haveMqtt) publishAddSink(&publish, mqttSink, &mqtt);
+  if (haveInflux)
+    {
+      if (influxStart(&influx) != 0) error("Failed to start InfluxDB export");
+      publishAddSink(&publish, influxSink, &influx);
+    }
+  if (publishStart(&publish) != 0) error("Failed to start publish");
+  resamplerInit(&secondResampler, NS_PER_S, secondDone, NULL);
+  rollupInit(&rollup, quarterDone, quarterAdjusted, NULL);
+  pulseLogInit(&pulseLog);
+  demandInit(&demand);
+  stepsInit(&steps, stepDone, NULL);
+  baselineInit(&baseline, baselineDone, NULL);
+  forecastInit(&forecast);
+  reconcileInit(&reconcile, &rollup, &pulseLog, registerDone, NULL);
+  restoreRegister();
+  fds[0].fd = sockfd;
+  fds[0].events = POLLIN;
+  fds[1].fd = -1;
+  fds[1].events = POLLIN;
+  fds[2].fd = -1;
+  fds[2].events = POLLIN;
+  if (captureStart(&capture, pulseFileName) == 0) fds[2].fd = captureWakeFd(&capture);
+  clock_gettime(CLOCK_REALTIME, &startTime);
+  captureStartTs = (uint64_t)startTime.tv_sec * NS_PER_S + startTime.tv_nsec;
+  updateMetrics();
+  if (queryStageStart(&queryStage, querySockfd, metricsSockfd, &metrics) != 0) error("Failed to start queries");
+  fds[1].fd = queryStageWakeFd(&queryStage);
+  nfds = 3;
+
   /* Enter forever loop waiting to serve client requests */
   numRequests = 0;
   printf("Start to wait for connections");
   logFd = fopen(logFileName, "a+");
   fprintf(logFd, "Server #1 started\n");
+  if (fds[2].fd < 0) fprintf(logFd, "No pulses from %s\n", pulseFileName);
   fclose(logFd);
   for (;;)
     {
+      if (poll(fds, nfds, TICK_MS) < 0) continue;
+
+      if (fds[2].revents & POLLIN) ingestCaptured();
+
+      /* Rules are evaluated after every pulse and at least once a tick */
+      if (haveAlerts) evaluateAlerts();
+
+      /* One handoff per round to each of the following stages */
+      storeFlush(&store);
+      publishFlush(&publish);
+      updateMetrics();
+
+      if (fds[1].revents & POLLIN) queryStageAnswer(&queryStage);
+
+      if (!(fds[0].revents & POLLIN)) continue;
       clilen = sizeof(cli_addr);
       newsockfd = accept(sockfd,
 			 (struct sockaddr *) &cli_addr,
@@ -147,31 +747,8 @@ int main(int argc, char *argv[])
 	  numFails++;
 	  continue;
 	}
-      numRequests++;
-      
-      fd = fopen(powerFileName, "r");
-      fscanf(fd, "%f", &diffTime);
-      fclose(fd);
-      
-      fd = fopen(consumptionFileName, "r");
-      fscanf(fd, "%d", &wh);
-      fclose(fd);
-      
-      report.W = (SCALE/diffTime);
-      report.Wh = wh;
-      
-      
-      /* Transmit first block of protocol, the number of bytes to expect */
-      n = write(newsockfd, &report ,sizeof(report));
-      close(newsockfd);
-      if (n != sizeof(report))
-	{
-	  logFd = fopen(logFileName, "a+");
-	  fprintf(logFd, "Error on write()\n");
-	  fclose(logFd);
-	  numFails++;
-	  continue;
-	}
+      PROBE1(request__accept, newsockfd);
+      serveClient(newsockfd);
     }
   close(sockfd);
   return 0;
@@ -0,0 +1,261 @@
+/******************************************************************************/
+/**
+ * \file metrics.c
+ *
+ * \brief Prometheus text exposition, see metrics.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "metrics.h"
+#include "spsc.h"
+
+#define NS_PER_S (1000000000.0)
+#define MAX_REQUEST (1024)
+
+/* A slow client must not hold up the other clients for long */
+#define RECV_TIMEOUT_MS (500)
+
+static const double bounds[METRICS_BUCKETS] = METRICS_BUCKET_BOUNDS;
+
+static const char notFound[] =
+  "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+void metricsInit(MetricsStruct *m)
+{
+  memset(m, 0, sizeof(*m));
+}
+
+void metricsPulse(MetricsStruct *m, uint64_t interval, uint32_t missed)
+{
+  double s = interval / NS_PER_S / (1 + missed);
+  int i;
+
+  m->state.pulses += 1 + missed;
+  m->state.missed += missed;
+  if (interval == 0) return;
+  for (i = 0; i < METRICS_BUCKETS && s > bounds[i]; i++)
+    {
+    }
+  m->state.buckets[i]++;
+  m->state.intervalSum += s;
+}
+
+int metricsListen(int port)
+{
+  struct sockaddr_in addr;
+  int sockfd, on = 1;
+
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sockfd < 0) return -1;
+  setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons(port);
+  if (bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sockfd, 5) != 0)
+    {
+      close(sockfd);
+      return -1;
+    }
+  return sockfd;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Append to the body, output that does not fit is cut off
+ *
+ ******************************************************************************/
+static void append(MetricsStruct *m, const char *format, ...)
+{
+  va_list ap;
+  int n;
+
+  if (m->bodyLen >= sizeof(m->body)) return;
+  va_start(ap, format);
+  n = vsnprintf(m->body + m->bodyLen, sizeof(m->body) - m->bodyLen, format, ap);
+  va_end(ap);
+  if (n > 0) m->bodyLen += n;
+  if (m->bodyLen > sizeof(m->body) - 1) m->bodyLen = sizeof(m->body) - 1;
+}
+
+static void family(MetricsStruct *m, const char *name, const char *type, const char *help)
+{
+  append(m, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Format the exposition from m->built
+ *
+ ******************************************************************************/
+static void build(MetricsStruct *m)
+{
+  const MetricsStateStruct *st = &m->built;
+  uint64_t cumulative = 0;
+  SpscStruct *q;
+  int i;
+
+  m->bodyLen = 0;
+  family(m, "wattmeter_energy_watthours_total", "counter", "Energy of the pulses counted, missed ones included.");
+  append(m, "wattmeter_energy_watthours_total %.0f\n", st->values.counted);
+  family(m, "wattmeter_energy_watthours", "gauge", "Total energy, following the meter register once read.");
+  append(m, "wattmeter_energy_watthours %.0f\n", st->values.energy);
+  family(m, "wattmeter_power_watts", "gauge", "Present power.");
+  append(m, "wattmeter_power_watts %.1f\n", st->values.power);
+  family(m, "wattmeter_pulses_total", "counter", "Pulses from the meter, including missed ones.");
+  append(m, "wattmeter_pulses_total %llu\n", (unsigned long long)st->pulses);
+  family(m, "wattmeter_pulses_missed_total", "counter", "Pulses counted by the module but not seen by the server.");
+  append(m, "wattmeter_pulses_missed_total %llu\n", (unsigned long long)st->missed);
+  family(m, "wattmeter_pulse_gaps_total", "counter", "Gaps in the pulses where pulses were lost.");
+  append(m, "wattmeter_pulse_gaps_total %llu\n", (unsigned long long)st->values.gaps);
+
+  family(m, "wattmeter_pulse_interval_seconds", "histogram", "Time between pulses.");
+  for (i = 0; i < METRICS_BUCKETS; i++)
+    {
+      cumulative += st->buckets[i];
+      append(m, "wattmeter_pulse_interval_seconds_bucket{le=\"%g\"} %llu\n", bounds[i],
+	     (unsigned long long)cumulative);
+    }
+  cumulative += st->buckets[METRICS_BUCKETS];
+  append(m, "wattmeter_pulse_interval_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+  append(m, "wattmeter_pulse_interval_seconds_sum %.3f\n", st->intervalSum);
+  append(m, "wattmeter_pulse_interval_seconds_count %llu\n", (unsigned long long)cumulative);
+
+  family(m, "wattmeter_requests_total", "counter", "Requests served per port.");
+  append(m, "wattmeter_requests_total{port=\"report\"} %llu\n", (unsigned long long)st->values.requests);
+  append(m, "wattmeter_requests_total{port=\"query\"} %llu\n", (unsigned long long)st->values.queries);
+  family(m, "wattmeter_request_failures_total", "counter", "Report requests that failed.");
+  append(m, "wattmeter_request_failures_total %llu\n", (unsigned long long)st->values.fails);
+
+  family(m, "wattmeter_queue_depth", "gauge", "Elements waiting between two stages.");
+  for (i = 0; i < METRICS_QUEUES && (q = spscQueue(i)) != NULL; i++)
+    {
+      append(m, "wattmeter_queue_depth{queue=\"%s\"} %zu\n", q->name, st->queueDepth[i]);
+    }
+  family(m, "wattmeter_queue_dropped_total", "counter", "Elements dropped because a queue was full.");
+  for (i = 0; i < METRICS_QUEUES && (q = spscQueue(i)) != NULL; i++)
+    {
+      append(m, "wattmeter_queue_dropped_total{queue=\"%s\"} %llu\n", q->name,
+	     (unsigned long long)st->queueDropped[i]);
+    }
+}
+
+/******************************************************************************/
+/**
+ *
+ * Copy header and body to the reply the query thread sends. The sequence
+ * count is odd while the copy is made, so a reader that saw it change, or
+ * odd, copies again.
+ *
+ ******************************************************************************/
+static void publish(MetricsStruct *m)
+{
+  int headerLen;
+
+  __atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  headerLen = snprintf(m->reply, METRICS_HEADER,
+		       "HTTP/1.1 200 OK\r\n"
+		       "Content-Type: text/plain; version=0.0.4\r\n"
+		       "Content-Length: %zu\r\n"
+		       "Connection: close\r\n\r\n", m->bodyLen);
+  memcpy(m->reply + headerLen, m->body, m->bodyLen);
+  __atomic_store_n(&m->replyLen, headerLen + m->bodyLen, __ATOMIC_RELAXED);
+  __atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Read the request up to the empty line ending the headers
+ *
+ * \return 1 for GET /metrics, 0 for anything else, -1 if nothing came
+ *
+ ******************************************************************************/
+static int readRequest(int fd)
+{
+  char buf[MAX_REQUEST + 1];
+  size_t n = 0;
+
+  while (n < MAX_REQUEST)
+    {
+      ssize_t r = read(fd, buf + n, MAX_REQUEST - n);
+
+      if (r <= 0) break;
+      n += r;
+      buf[n] = '\0';
+      if (strstr(buf, "\r\n\r\n") != NULL || strstr(buf, "\n\n") != NULL) break;
+    }
+  if (n == 0) return -1;
+  buf[n] = '\0';
+  return strncmp(buf, "GET /metrics", 12) == 0 && (buf[12] == ' ' || buf[12] == '?');
+}
+
+void metricsUpdate(MetricsStruct *m, const MetricsValuesStruct *values, uint64_t now)
+{
+  SpscStruct *q;
+  int i;
+
+  if (m->haveBuilt && now - m->builtAt < METRICS_PUBLISH_MS * 1000000ULL) return;
+
+  /* Format again only if something moved since the body was built */
+  m->state.values = *values;
+  for (i = 0; i < METRICS_QUEUES; i++)
+    {
+      q = spscQueue(i);
+      m->state.queueDepth[i] = (q != NULL) ? spscDepth(q) : 0;
+      m->state.queueDropped[i] = (q != NULL) ? spscDropped(q) : 0;
+    }
+  if (m->haveBuilt && memcmp(&m->state, &m->built, sizeof(m->state)) == 0) return;
+  m->built = m->state;
+  m->haveBuilt = 1;
+  m->builtAt = now;
+  build(m);
+  publish(m);
+}
+
+void metricsServe(MetricsStruct *m, int sockfd)
+{
+  struct timeval tv = { 0, RECV_TIMEOUT_MS * 1000 };
+  char reply[sizeof(m->reply)];
+  unsigned int seq;
+  size_t len;
+  int fd, ok;
+
+  fd = accept(sockfd, NULL, NULL);
+  if (fd < 0) return;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  ok = readRequest(fd);
+  if (ok == 0) send(fd, notFound, sizeof(notFound) - 1, MSG_NOSIGNAL);
+  if (ok <= 0)
+    {
+      close(fd);
+      return;
+    }
+
+  do
+    {
+      seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE);
+      len = __atomic_load_n(&m->replyLen, __ATOMIC_RELAXED);
+      if (len > sizeof(reply)) len = sizeof(reply);
+      memcpy(reply, m->reply, len);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+  while ((seq & 1) || __atomic_load_n(&m->seq, __ATOMIC_RELAXED) != seq);
+
+  if (len > 0) send(fd, reply, len, MSG_NOSIGNAL);
+  close(fd);
+}
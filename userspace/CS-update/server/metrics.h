@@ -0,0 +1,133 @@
+/******************************************************************************/
+/**
+ * \file metrics.h
+ *
+ * \brief Prometheus text exposition on METRICS_PORT.
+ *
+ *        | GET /metrics HTTP/1.1 |
+ *
+ *        The compute stage keeps the reply formatted, see metricsUpdate().
+ *        It formats again only if a value changed, at most once every
+ *        METRICS_PUBLISH_MS, and publishes header and body together under
+ *        a sequence count. The query thread copies the published reply and
+ *        sends it without waiting for the compute stage, so scrapes from
+ *        several Prometheus servers cost an accept and a copy each.
+ *
+ *        Exposed are the energy counter of the counted pulses, the total
+ *        following the meter register as a gauge, since a reading can set
+ *        it back, present power, a histogram of the pulse intervals and
+ *        the server internals: requests, failures, gaps and the depth and
+ *        drops of the queues between the stages.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Upper bounds of the pulse interval histogram in s, +Inf is added */
+#define METRICS_BUCKETS (9)
+#define METRICS_BUCKET_BOUNDS { 0.5, 1, 2, 5, 10, 30, 60, 300, 900 }
+
+#define METRICS_QUEUES (8)
+#define METRICS_SIZE (8192)
+#define METRICS_HEADER (128)
+#define METRICS_PUBLISH_MS (1000)
+
+/* Values from the rest of the server, filled in for every update */
+typedef struct
+{
+  double counted;        /* Energy of the pulses counted, Wh, only goes up */
+  double energy;         /* Total energy following the register, Wh */
+  double power;          /* Present power, W */
+  uint64_t requests;     /* Clients on the main port */
+  uint64_t fails;        /* Failed client requests */
+  uint64_t queries;      /* Commands on the query port */
+  uint64_t gaps;         /* Pulse gaps found */
+} MetricsValuesStruct;
+
+typedef struct
+{
+  /* Everything the exposition is built from */
+  MetricsValuesStruct values;
+  uint64_t pulses;
+  uint64_t missed;
+  uint64_t buckets[METRICS_BUCKETS + 1];   /* Not cumulative, last is +Inf */
+  double intervalSum;                      /* s */
+  size_t queueDepth[METRICS_QUEUES];
+  uint64_t queueDropped[METRICS_QUEUES];
+} MetricsStateStruct;
+
+typedef struct
+{
+  /* Owned by the compute stage */
+  MetricsStateStruct state;   /* Updated as things happen */
+  MetricsStateStruct built;   /* What the body holds */
+  int haveBuilt;
+  uint64_t builtAt;           /* ns since the epoch */
+  char body[METRICS_SIZE];
+  size_t bodyLen;
+
+  /* Published to the query thread */
+  unsigned int seq;           /* Odd while the reply is written */
+  char reply[METRICS_HEADER + METRICS_SIZE];
+  size_t replyLen;
+} MetricsStruct;
+
+void metricsInit(MetricsStruct *m);
+
+/******************************************************************************/
+/**
+ *
+ * Count a pulse
+ *
+ * \param m, the metrics
+ * \param interval, time since the previous pulse in ns, 0 for the first
+ * \param missed, pulses missed before this one
+ * \return None
+ *
+ ******************************************************************************/
+void metricsPulse(MetricsStruct *m, uint64_t interval, uint32_t missed);
+
+/******************************************************************************/
+/**
+ *
+ * Open the listening socket for scrapes
+ *
+ * \param port, the TCP port
+ * \return the socket, or -1 on failure
+ *
+ ******************************************************************************/
+int metricsListen(int port);
+
+/******************************************************************************/
+/**
+ *
+ * Compute: format the exposition again if a value changed and publish it
+ *
+ * \param m, the metrics
+ * \param values, the present values of the rest of the server
+ * \param now, ns since the epoch
+ * \return None
+ *
+ ******************************************************************************/
+void metricsUpdate(MetricsStruct *m, const MetricsValuesStruct *values, uint64_t now);
+
+/******************************************************************************/
+/**
+ *
+ * Accept one scrape and send it the published reply, answering anything
+ * but GET /metrics with 404. Safe to call from any thread.
+ *
+ * \param m, the metrics
+ * \param sockfd, the listening socket from metricsListen()
+ * \return None
+ *
+ ******************************************************************************/
+void metricsServe(MetricsStruct *m, int sockfd);
+
+#endif
@@ -0,0 +1,360 @@
+/******************************************************************************/
+/**
+ * \file mqtt.c
+ *
+ * \brief MQTT 3.1.1 publisher, see mqtt.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "mqtt.h"
+
+#define NS_PER_S (1000000000ULL)
+#define CONNECT_TIMEOUT_MS (2000)
+
+#define CONNECT (0x10)
+#define CONNACK (0x20)
+#define PUBLISH_QOS1 (0x32)
+#define PUBLISH_DUP (0x08)
+#define PUBLISH_RETAIN (0x01)
+#define PUBACK (0x40)
+#define PINGREQ (0xc0)
+
+static uint64_t nowMs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int mqttInit(MqttStruct *m, const char *broker, const char *queueFileName)
+{
+  const char *colon = strchr(broker, ':');
+  size_t len = colon ? (size_t)(colon - broker) : strlen(broker);
+
+  memset(m, 0, sizeof(*m));
+  if (len == 0 || len >= sizeof(m->host)) return -1;
+  memcpy(m->host, broker, len);
+  snprintf(m->port, sizeof(m->port), "%s", colon ? colon + 1 : "1883");
+  m->fd = -1;
+  m->backoff = 1000;
+  m->nextId = 1;
+  m->queue = fopen(queueFileName, "a+");
+  return (m->queue != NULL) ? 0 : -1;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Append a packet to the transmit buffer
+ *
+ * \return 0 if successful, -1 if it does not fit
+ *
+ ******************************************************************************/
+static int putPacket(MqttStruct *m, uint8_t type, const uint8_t *body, size_t len)
+{
+  uint8_t head[5];
+  size_t n = 0, rest = len;
+
+  head[n++] = type;
+  do
+    {
+      head[n] = rest % 128;
+      rest /= 128;
+      if (rest > 0) head[n] |= 0x80;
+      n++;
+    }
+  while (rest > 0);
+  if (m->txLen + n + len > sizeof(m->tx)) return -1;
+  memcpy(m->tx + m->txLen, head, n);
+  if (len > 0) memcpy(m->tx + m->txLen + n, body, len);
+  m->txLen += n + len;
+  return 0;
+}
+
+static size_t putString(uint8_t *p, const char *s)
+{
+  size_t len = strlen(s);
+
+  p[0] = len >> 8;
+  p[1] = len & 0xff;
+  memcpy(p + 2, s, len);
+  return len + 2;
+}
+
+static void putPublish(MqttStruct *m, const MqttMessageStruct *msg, int dup)
+{
+  uint8_t body[MQTT_TOPIC_LEN + MQTT_PAYLOAD_LEN + 8];
+  size_t n = putString(body, msg->topic);
+  size_t len = strlen(msg->payload);
+
+  body[n++] = msg->id >> 8;
+  body[n++] = msg->id & 0xff;
+  memcpy(body + n, msg->payload, len);
+  putPacket(m, PUBLISH_QOS1 | (dup ? PUBLISH_DUP : 0) | (msg->retain ? PUBLISH_RETAIN : 0),
+	    body, n + len);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Send as much of the transmit buffer as the socket takes
+ *
+ * \return 0 if successful, -1 if the connection failed
+ *
+ ******************************************************************************/
+static int flush(MqttStruct *m, uint64_t now)
+{
+  ssize_t n;
+
+  if (m->txLen == 0) return 0;
+  n = send(m->fd, m->tx, m->txLen, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  memmove(m->tx, m->tx + n, m->txLen - n);
+  m->txLen -= n;
+  m->lastTx = now;
+  return 0;
+}
+
+static void disconnect(MqttStruct *m, uint64_t now)
+{
+  close(m->fd);
+  m->fd = -1;
+  m->connected = 0;
+  m->txLen = 0;
+  m->rxLen = 0;
+  m->nextConnect = now + m->backoff;
+  m->backoff *= 2;
+  if (m->backoff > MQTT_MAX_BACKOFF_MS) m->backoff = MQTT_MAX_BACKOFF_MS;
+}
+
+static void connectBroker(MqttStruct *m, uint64_t now)
+{
+  struct addrinfo hints, *res;
+  struct timeval tv = { CONNECT_TIMEOUT_MS / 1000, (CONNECT_TIMEOUT_MS % 1000) * 1000 };
+  uint8_t body[32 + sizeof(MQTT_CLIENT_ID)];
+  size_t n = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  m->nextConnect = now + m->backoff;
+  if (getaddrinfo(m->host, m->port, &hints, &res) != 0) return;
+  m->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (m->fd >= 0)
+    {
+      setsockopt(m->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+      if (connect(m->fd, res->ai_addr, res->ai_addrlen) != 0)
+	{
+	  freeaddrinfo(res);
+	  disconnect(m, now);
+	  return;
+	}
+    }
+  freeaddrinfo(res);
+  if (m->fd < 0) return;
+
+  /* Clean session, everything unacknowledged is sent again on CONNACK */
+  n += putString(body + n, "MQTT");
+  body[n++] = 4;
+  body[n++] = 0x02;
+  body[n++] = MQTT_KEEPALIVE_S >> 8;
+  body[n++] = MQTT_KEEPALIVE_S & 0xff;
+  n += putString(body + n, MQTT_CLIENT_ID);
+  putPacket(m, CONNECT, body, n);
+  if (flush(m, now) != 0) disconnect(m, now);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Append a message to the queue file, unless it is full
+ *
+ ******************************************************************************/
+static void enqueue(MqttStruct *m, const char *topic, int retain, const char *payload)
+{
+  fseek(m->queue, 0, SEEK_END);
+  if (ftell(m->queue) >= MQTT_QUEUE_MAX) return;
+  fprintf(m->queue, "%s\t%d\t%s\n", topic, retain, payload);
+  fflush(m->queue);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Send a message if connected and there is room in the window, otherwise
+ * queue it, for alerts and history, the live values wait for room instead
+ *
+ ******************************************************************************/
+static void message(MqttStruct *m, const char *topic, int retain, const char *payload, uint64_t now)
+{
+  MqttMessageStruct *msg;
+  int i;
+
+  if (!m->connected || m->numInflight == MQTT_INFLIGHT)
+    {
+      enqueue(m, topic, retain, payload);
+      return;
+    }
+  for (i = 0; m->inflight[i].id != 0; i++)
+    {
+    }
+  msg = &m->inflight[i];
+  msg->id = m->nextId;
+  m->nextId = (m->nextId == 0xffff) ? 1 : m->nextId + 1;
+  msg->retain = retain;
+  snprintf(msg->topic, sizeof(msg->topic), "%s", topic);
+  snprintf(msg->payload, sizeof(msg->payload), "%s", payload);
+  msg->sent = now;
+  m->numInflight++;
+  putPublish(m, msg, 0);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Send queued messages while there is room in the window, and empty the
+ * queue file once all of it was sent
+ *
+ ******************************************************************************/
+static void replay(MqttStruct *m, uint64_t now)
+{
+  char line[MQTT_TOPIC_LEN + MQTT_PAYLOAD_LEN + 8];
+  char *retain, *payload;
+
+  if (fseek(m->queue, m->replayPos, SEEK_SET) != 0) return;
+  while (m->numInflight < MQTT_INFLIGHT && fgets(line, sizeof(line), m->queue) != NULL)
+    {
+      m->replayPos = ftell(m->queue);
+      line[strcspn(line, "\n")] = '\0';
+      if ((retain = strchr(line, '\t')) == NULL) continue;
+      *retain++ = '\0';
+      if ((payload = strchr(retain, '\t')) == NULL) continue;
+      *payload++ = '\0';
+      message(m, line, *retain == '1', payload, now);
+    }
+  if (feof(m->queue) && m->replayPos > 0)
+    {
+      if (ftruncate(fileno(m->queue), 0) == 0) m->replayPos = 0;
+    }
+  clearerr(m->queue);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Handle the packets from the broker
+ *
+ * \return 0 if successful, -1 if the connection failed
+ *
+ ******************************************************************************/
+static int receive(MqttStruct *m, uint64_t now)
+{
+  ssize_t n;
+  int i;
+
+  n = recv(m->fd, m->rx + m->rxLen, sizeof(m->rx) - m->rxLen, MSG_DONTWAIT);
+  if (n == 0) return -1;
+  if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  m->rxLen += n;
+
+  /* Everything the broker sends us has a one byte remaining length, a
+   * PINGRESP needs no handling */
+  while (m->rxLen >= 2)
+    {
+      size_t len = 2 + m->rx[1];
+
+      if ((m->rx[1] & 0x80) || len > sizeof(m->rx)) return -1;
+      if (m->rxLen < len) break;
+      if (m->rx[0] == CONNACK && len == 4)
+	{
+	  if (m->rx[3] != 0) return -1;
+	  m->connected = 1;
+	  m->backoff = 1000;
+	  for (i = 0; i < MQTT_INFLIGHT; i++)
+	    {
+	      if (m->inflight[i].id == 0) continue;
+	      m->inflight[i].sent = now;
+	      putPublish(m, &m->inflight[i], 1);
+	    }
+	}
+      else if (m->rx[0] == PUBACK && len == 4)
+	{
+	  uint16_t id = (m->rx[2] << 8) | m->rx[3];
+
+	  for (i = 0; i < MQTT_INFLIGHT; i++)
+	    {
+	      if (m->inflight[i].id != id) continue;
+	      m->inflight[i].id = 0;
+	      m->numInflight--;
+	    }
+	}
+      memmove(m->rx, m->rx + len, m->rxLen - len);
+      m->rxLen -= len;
+    }
+  return 0;
+}
+
+void mqttSink(void *ctx, const PublishRecordStruct *rec)
+{
+  MqttStruct *m = ctx;
+  uint64_t now = nowMs();
+  char payload[MQTT_PAYLOAD_LEN];
+  int i;
+
+  if (rec->type == PUBLISH_LIVE)
+    {
+      m->live = *rec;
+      m->liveDirty = 1;
+    }
+  else if (rec->type == PUBLISH_ALERT)
+    {
+      snprintf(payload, sizeof(payload), "%llu %s", (unsigned long long)(rec->ts / NS_PER_S), rec->text);
+      message(m, MQTT_TOPIC "/alert", 0, payload, now);
+    }
+
+  if (m->fd < 0 && now >= m->nextConnect) connectBroker(m, now);
+  if (m->fd >= 0 && receive(m, now) != 0) disconnect(m, now);
+
+  if (!m->connected)
+    {
+      /* Keep a sparse history while offline, the latest values go out as
+       * retained messages once connected */
+      if (m->liveDirty && m->live.ts >= m->lastHistory + MQTT_HISTORY_S * NS_PER_S)
+	{
+	  snprintf(payload, sizeof(payload), "%llu %.1f %.0f", (unsigned long long)(m->live.ts / NS_PER_S),
+		   m->live.power, m->live.energy);
+	  enqueue(m, MQTT_TOPIC "/history", 0, payload);
+	  m->lastHistory = m->live.ts;
+	}
+      return;
+    }
+
+  for (i = 0; i < MQTT_INFLIGHT; i++)
+    {
+      if (m->inflight[i].id == 0 || now < m->inflight[i].sent + MQTT_RETRY_MS) continue;
+      m->inflight[i].sent = now;
+      putPublish(m, &m->inflight[i], 1);
+    }
+  if (m->replayPos > 0 || (fseek(m->queue, 0, SEEK_END) == 0 && ftell(m->queue) > 0)) replay(m, now);
+  /* Only the latest live values matter, they are kept until both fit */
+  if (m->liveDirty && now >= m->lastLive + MQTT_MIN_INTERVAL_MS && m->numInflight <= MQTT_INFLIGHT - 2)
+    {
+      snprintf(payload, sizeof(payload), "%.1f", m->live.power);
+      message(m, MQTT_TOPIC "/power", 1, payload, now);
+      snprintf(payload, sizeof(payload), "%.0f", m->live.energy);
+      message(m, MQTT_TOPIC "/energy", 1, payload, now);
+      m->liveDirty = 0;
+      m->lastLive = now;
+    }
+  if (m->txLen == 0 && now >= m->lastTx + MQTT_KEEPALIVE_S * 1000 / 2) putPacket(m, PINGREQ, NULL, 0);
+  if (flush(m, now) != 0) disconnect(m, now);
+}
@@ -0,0 +1,108 @@
+/******************************************************************************/
+/**
+ * \file mqtt.h
+ *
+ * \brief MQTT 3.1.1 publisher, a sink of the publish stage.
+ *
+ *        Topics, all QoS 1:
+ *
+ *        | wattmeter/power   | present W, retained            |
+ *        | wattmeter/energy  | total Wh, retained             |
+ *        | wattmeter/alert   | "<s> alert ..." per alert      |
+ *        | wattmeter/history | "<s> <W> <Wh>" queued offline  |
+ *
+ *        Live values are coalesced, at most one power and energy pair is
+ *        sent per MQTT_MIN_INTERVAL_MS, and everything due in a tick goes
+ *        out in one write. Messages wait for PUBACK in a window of
+ *        MQTT_INFLIGHT and are sent again after MQTT_RETRY_MS. While the
+ *        window is full only the latest live values are kept, to be sent
+ *        when there is room, alerts are queued as below.
+ *
+ *        While the broker cannot be reached, alerts and a history line per
+ *        MQTT_HISTORY_S are appended to a queue file of at most
+ *        MQTT_QUEUE_MAX bytes, sent in order after reconnecting. The queue
+ *        file survives restarts of the server.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef MQTT_H
+#define MQTT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "publish.h"
+
+#define MQTT_PORT (1883)
+#define MQTT_TOPIC "wattmeter"
+#define MQTT_CLIENT_ID "wattmeter-server"
+#define MQTT_KEEPALIVE_S (60)
+#define MQTT_MIN_INTERVAL_MS (1000)
+#define MQTT_RETRY_MS (10000)
+#define MQTT_MAX_BACKOFF_MS (60000)
+#define MQTT_HISTORY_S (60)
+#define MQTT_INFLIGHT (16)
+#define MQTT_QUEUE_MAX (1024 * 1024)
+
+#define MQTT_TOPIC_LEN (32)
+#define MQTT_PAYLOAD_LEN (PUBLISH_TEXT + 24)
+
+typedef struct
+{
+  uint16_t id;                       /* Packet identifier, 0 if free */
+  uint8_t retain;
+  char topic[MQTT_TOPIC_LEN];
+  char payload[MQTT_PAYLOAD_LEN];
+  uint64_t sent;                     /* ms, monotonic */
+} MqttMessageStruct;
+
+typedef struct
+{
+  char host[64];
+  char port[8];
+  int fd;                            /* -1 while disconnected */
+  int connected;                     /* CONNACK received */
+  uint64_t nextConnect;              /* ms, monotonic */
+  uint64_t backoff;                  /* ms */
+  uint64_t lastTx;                   /* ms, for the keep-alive */
+  uint16_t nextId;
+
+  MqttMessageStruct inflight[MQTT_INFLIGHT];
+  int numInflight;
+  uint8_t tx[MQTT_INFLIGHT * 2 * (MQTT_TOPIC_LEN + MQTT_PAYLOAD_LEN + 8)];
+  size_t txLen;
+  uint8_t rx[64];
+  size_t rxLen;
+
+  PublishRecordStruct live;          /* Latest live values */
+  int liveDirty;                     /* Not yet sent */
+  uint64_t lastLive;                 /* ms, monotonic */
+  uint64_t lastHistory;              /* ns since the epoch */
+
+  FILE *queue;
+  long replayPos;                    /* Next queued line to send */
+} MqttStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Set up the publisher, the broker is connected from the publish thread
+ *
+ * \param m, the publisher
+ * \param broker, "host" or "host:port"
+ * \param queueFileName, file for messages while offline
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int mqttInit(MqttStruct *m, const char *broker, const char *queueFileName);
+
+/******************************************************************************/
+/**
+ *
+ * Publish sink, add with publishAddSink(p, mqttSink, m)
+ *
+ ******************************************************************************/
+void mqttSink(void *ctx, const PublishRecordStruct *rec);
+
+#endif
@@ -0,0 +1,43 @@
+/******************************************************************************/
+/**
+ * \file probes.h
+ *
+ * \brief USDT probes of the server, for bpftrace and perf in production.
+ *
+ *        Built with make SDT=1 where sys/sdt.h is installed. Each probe is
+ *        then a nop in the code and a note in the binary, the arguments are
+ *        only fetched when a tracer has attached. Without SDT the probes
+ *        are not compiled at all.
+ *
+ *        | request__accept  | fd            | client accepted on PORT    |
+ *        | snapshot__refresh| W, Wh         | values read for the client |
+ *        | response__write  | fd, bytes     | report written, or -1      |
+ *        | query__start     |               | query connection to serve  |
+ *        | query__done      |               | query answered             |
+ *        | pulse__ingest    | ts, missed, ns| pulse in the compute stage,|
+ *        |                  |               | ns since the edge          |
+ *        | store__write     | records       | batch to the engine        |
+ *        | store__sync      | ns            | engine synced to disk      |
+ *
+ *        | bpftrace -e 'usdt:./power-update-server:power_update:pulse__ingest { @ = hist(arg2); }' |
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef PROBES_H
+#define PROBES_H
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define PROBE0(name) DTRACE_PROBE(power_update, name)
+#define PROBE1(name, a) DTRACE_PROBE1(power_update, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(power_update, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(power_update, name, a, b, c)
+#else
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,108 @@
+/******************************************************************************/
+/**
+ * \file publish.c
+ *
+ * \brief Publish stage, see publish.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <string.h>
+#include <time.h>
+#include "publish.h"
+
+#define BATCH (32)
+
+void publishInit(PublishStruct *p)
+{
+  p->numSinks = 0;
+}
+
+int publishAddSink(PublishStruct *p, PublishSinkFn fn, void *ctx)
+{
+  if (p->numSinks == PUBLISH_SINKS) return -1;
+  p->sinks[p->numSinks] = fn;
+  p->ctx[p->numSinks] = ctx;
+  p->numSinks++;
+  return 0;
+}
+
+static void *publishThread(void *arg)
+{
+  PublishStruct *p = arg;
+  PublishRecordStruct recs[BATCH];
+  PublishRecordStruct tick;
+  struct timespec ts;
+  size_t i, n;
+  int k;
+
+  memset(&tick, 0, sizeof(tick));
+  tick.type = PUBLISH_TICK;
+  for (;;)
+    {
+      spscWait(&p->queue, PUBLISH_TICK_MS);
+      while ((n = spscGet(&p->queue, recs, BATCH)) > 0)
+	{
+	  for (i = 0; i < n; i++)
+	    {
+	      if (recs[i].type == PUBLISH_LIVE) traceStamp(&recs[i].trace, TRACE_PUBLISH);
+	      for (k = 0; k < p->numSinks; k++) p->sinks[k](p->ctx[k], &recs[i]);
+	    }
+	}
+      clock_gettime(CLOCK_REALTIME, &ts);
+      tick.ts = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+      for (k = 0; k < p->numSinks; k++) p->sinks[k](p->ctx[k], &tick);
+    }
+  return NULL;
+}
+
+int publishStart(PublishStruct *p)
+{
+  if (spscInit(&p->queue, "publish", sizeof(PublishRecordStruct), PUBLISH_QUEUE) != 0) return -1;
+  return (pthread_create(&p->thread, NULL, publishThread, p) == 0) ? 0 : -1;
+}
+
+void publishLive(PublishStruct *p, uint64_t ts, double power, double energy, const TraceStruct *trace)
+{
+  PublishRecordStruct rec;
+
+  rec.type = PUBLISH_LIVE;
+  rec.ts = ts;
+  rec.power = power;
+  rec.energy = energy;
+  rec.text[0] = '\0';
+  rec.trace = *trace;
+  spscPut(&p->queue, &rec);
+}
+
+void publishRow(PublishStruct *p, uint64_t start, double power, double energy)
+{
+  PublishRecordStruct rec;
+
+  rec.type = PUBLISH_ROW;
+  rec.ts = start;
+  rec.power = power;
+  rec.energy = energy;
+  rec.text[0] = '\0';
+  memset(&rec.trace, 0, sizeof(rec.trace));
+  spscPut(&p->queue, &rec);
+}
+
+void publishAlert(PublishStruct *p, uint64_t ts, const char *text)
+{
+  PublishRecordStruct rec;
+
+  rec.type = PUBLISH_ALERT;
+  rec.ts = ts;
+  rec.power = 0;
+  rec.energy = 0;
+  strncpy(rec.text, text, sizeof(rec.text) - 1);
+  rec.text[sizeof(rec.text) - 1] = '\0';
+  memset(&rec.trace, 0, sizeof(rec.trace));
+  spscPut(&p->queue, &rec);
+}
+
+void publishFlush(PublishStruct *p)
+{
+  spscFlush(&p->queue);
+}
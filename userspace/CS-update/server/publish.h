@@ -0,0 +1,122 @@
+/******************************************************************************/
+/**
+ * \file publish.h
+ *
+ * \brief Publish stage, pushes live values and alerts out in its own thread.
+ *
+ *        The compute stage queues a live record per pulse, one per alert
+ *        and one per completed 15 minute rollup row. The publish thread
+ *        hands every record to each sink added with publishAddSink(), so a
+ *        slow receiver on the network only delays the other sinks, never
+ *        the pulses or the store.
+ *
+ *        Every PUBLISH_TICK_MS, and after every batch, the sinks also get
+ *        a PUBLISH_TICK record for timers such as retries and keep-alive.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef PUBLISH_H
+#define PUBLISH_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "spsc.h"
+#include "trace.h"
+
+#define PUBLISH_QUEUE (1024)
+#define PUBLISH_SINKS (8)
+#define PUBLISH_TEXT (96)
+#define PUBLISH_TICK_MS (250)
+
+typedef enum
+{
+  PUBLISH_LIVE,
+  PUBLISH_ALERT,
+  PUBLISH_ROW,
+  PUBLISH_TICK
+} PublishType;
+
+typedef struct
+{
+  int type;                  /* PublishType */
+  uint64_t ts;               /* ns since the epoch, row start for rows */
+  double power;              /* Live: present power, row: average, W */
+  double energy;             /* Live: total energy, row: its energy, Wh */
+  char text[PUBLISH_TEXT];   /* Alert: the event line */
+  TraceStruct trace;         /* Live: the hops of its pulse, see trace.h */
+} PublishRecordStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Receiver of published records, called in the publish thread
+ *
+ ******************************************************************************/
+typedef void (*PublishSinkFn)(void *ctx, const PublishRecordStruct *rec);
+
+typedef struct
+{
+  SpscStruct queue;
+  PublishSinkFn sinks[PUBLISH_SINKS];
+  void *ctx[PUBLISH_SINKS];
+  int numSinks;
+  pthread_t thread;
+} PublishStruct;
+
+void publishInit(PublishStruct *p);
+
+/******************************************************************************/
+/**
+ *
+ * Add a receiver, before publishStart()
+ *
+ * \return 0 if successful, -1 if there are too many
+ *
+ ******************************************************************************/
+int publishAddSink(PublishStruct *p, PublishSinkFn fn, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Start the publish thread
+ *
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int publishStart(PublishStruct *p);
+
+/******************************************************************************/
+/**
+ *
+ * Queue the present power in W and total energy in Wh, with the trace of
+ * the pulse that changed them
+ *
+ ******************************************************************************/
+void publishLive(PublishStruct *p, uint64_t ts, double power, double energy, const TraceStruct *trace);
+
+/******************************************************************************/
+/**
+ *
+ * Queue a completed rollup row, average power in W and energy in Wh
+ *
+ ******************************************************************************/
+void publishRow(PublishStruct *p, uint64_t start, double power, double energy);
+
+/******************************************************************************/
+/**
+ *
+ * Queue an alert line
+ *
+ ******************************************************************************/
+void publishAlert(PublishStruct *p, uint64_t ts, const char *text);
+
+/******************************************************************************/
+/**
+ *
+ * Hand everything queued since the last call over to the publish thread
+ *
+ ******************************************************************************/
+void publishFlush(PublishStruct *p);
+
+#endif
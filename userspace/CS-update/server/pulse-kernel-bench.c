@@ -0,0 +1,144 @@
+/******************************************************************************/
+/**
+ * \file pulse-kernel-bench.c
+ *
+ * \brief Compares the vectorized pulse kernel with the scalar reference.
+ *
+ *        A synthetic series of pulse timestamps is converted repeatedly by
+ *        both implementations and the throughput is printed together with
+ *        the largest deviation between them.
+ *
+ *        | impl | ns/pulse | MB/s |
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "pulse-kernel.h"
+
+#define DEFAULT_PULSES (1 << 20)
+#define DEFAULT_ROUNDS (50)
+
+/* Bytes touched per pulse: timestamp in, interval, power and energy out */
+#define BYTES_PER_PULSE (sizeof(uint64_t) + 2 * sizeof(float) + sizeof(double))
+
+typedef void (*ConvertFn)(const uint64_t *, size_t, uint64_t, double, double,
+                          float *, float *, double *);
+
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+static void usage(void)
+{
+  printf("pulse-kernel-bench [-n pulses] [-r rounds]");
+  printf("\n");
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Time one implementation, returns seconds per round
+ *
+ ******************************************************************************/
+static double run(ConvertFn fn, const uint64_t *ts, size_t n, int rounds,
+                  float *interval, float *power, double *energy)
+{
+  double start = now();
+  int r;
+
+  for (r = 0; r < rounds; r++)
+    {
+      fn(ts, n, ts[0], 1.0, 0.0, interval, power, energy);
+    }
+  return (now() - start) / rounds;
+}
+
+static void report(const char *name, double t, size_t n)
+{
+  printf("%-8s %8.3f ns/pulse %10.1f MB/s\n", name, t * 1e9 / n,
+         BYTES_PER_PULSE * n / t / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+  int32_t opt;
+  size_t n = DEFAULT_PULSES;
+  int rounds = DEFAULT_ROUNDS;
+  uint64_t *ts;
+  float *interval[2], *power[2];
+  double *energy[2];
+  double tScalar, tVector, maxRel = 0;
+  uint64_t t = 1500000000ULL * 1000000000ULL;
+  uint64_t seed = 1;
+  size_t i;
+  int k;
+
+  while ((opt = getopt(argc, argv, "hn:r:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'n':
+	  n = strtoul(optarg, NULL, 0);
+	  break;
+	case 'r':
+	  rounds = atoi(optarg);
+	  break;
+	case 'h':
+	  usage();
+	  return 0;
+	default:
+	  usage();
+	  error("Unrecognized input");
+	  break;
+	}
+    }
+  if (n < 2 || rounds < 1) error("Bad arguments");
+
+  ts = malloc(n * sizeof(*ts));
+  for (k = 0; k < 2; k++)
+    {
+      interval[k] = malloc(n * sizeof(float));
+      power[k] = malloc(n * sizeof(float));
+      energy[k] = malloc(n * sizeof(double));
+      if (!interval[k] || !power[k] || !energy[k]) error("malloc() Failed");
+    }
+  if (!ts) error("malloc() Failed");
+
+  /* Intervals between 0.1 s and 40 s, i.e. 90 W to 36 kW, from the top
+     53 bits of a 64 bit LCG scaled onto the range */
+  for (i = 0; i < n; i++)
+    {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      t += 100000000ULL + (uint64_t)((seed >> 11) / 9007199254740992.0 * 39900000000.0);
+      ts[i] = t;
+    }
+
+  tScalar = run(pulseKernelConvertScalar, ts, n, rounds, interval[0], power[0], energy[0]);
+  tVector = run(pulseKernelConvert, ts, n, rounds, interval[1], power[1], energy[1]);
+
+  for (i = 0; i < n; i++)
+    {
+      double rel = fabs(power[1][i] - power[0][i]) / (power[0][i] ? power[0][i] : 1);
+      if (rel > maxRel) maxRel = rel;
+    }
+
+  report("scalar", tScalar, n);
+  report(pulseKernelName(), tVector, n);
+  printf("speedup %.2fx, max relative power deviation %g\n", tScalar / tVector, maxRel);
+  return 0;
+}
@@ -0,0 +1,237 @@
+/******************************************************************************/
+/**
+ * \file pulse-kernel.c
+ *
+ * \brief Batch conversion of pulse timestamps, see pulse-kernel.h
+ *
+ *        The x86 paths convert the 64 bit intervals to double with the
+ *        2^52 bias trick, since neither SSE2 nor AVX2 has a 64 bit integer
+ *        to double conversion. The ARM path narrows the intervals to 32 bit
+ *        units of 1024 ns, which is all a Cortex-A8 can vectorize.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include "pulse-kernel.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#define PULSE_KERNEL_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PULSE_KERNEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define NS_PER_S (1e9)
+#define S_PER_H (3600.0)
+
+typedef void (*ConvertFn)(const uint64_t *, size_t, uint64_t, double, double,
+                          float *, float *, double *);
+
+/******************************************************************************/
+/**
+ *
+ * Convert a single pulse, shared by all implementations for the first
+ * element and the tail that does not fill a vector
+ *
+ ******************************************************************************/
+static inline void convertOne(uint64_t diff, size_t i, double k,
+                              double whPerPulse, double energy0,
+                              float *interval, float *power, double *energy)
+{
+  double d = (double)diff;
+
+  interval[i] = (float)(d * (1.0 / NS_PER_S));
+  power[i] = diff ? (float)(k / d) : 0.0f;
+  energy[i] = energy0 + (double)(i + 1) * whPerPulse;
+}
+
+void pulseKernelConvertScalar(const uint64_t *ts, size_t n, uint64_t prevTs,
+                              double whPerPulse, double energy0,
+                              float *interval, float *power, double *energy)
+{
+  double k = whPerPulse * S_PER_H * NS_PER_S;
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    {
+      convertOne(ts[i] - (i ? ts[i - 1] : prevTs), i, k,
+                 whPerPulse, energy0, interval, power, energy);
+    }
+}
+
+#ifdef PULSE_KERNEL_X86
+
+/* Bit pattern of 2^52 as double, OR:ing an integer below 2^52 into the
+ * mantissa and subtracting 2^52 gives the integer as double */
+#define BIAS_BITS (0x4330000000000000LL)
+#define BIAS (4503599627370496.0)
+
+static void convertSse2(const uint64_t *ts, size_t n, uint64_t prevTs,
+                        double whPerPulse, double energy0,
+                        float *interval, float *power, double *energy)
+{
+  double k = whPerPulse * S_PER_H * NS_PER_S;
+  const __m128i biasBits = _mm_set1_epi64x(BIAS_BITS);
+  const __m128d bias = _mm_set1_pd(BIAS);
+  const __m128d vk = _mm_set1_pd(k);
+  const __m128d nsToS = _mm_set1_pd(1.0 / NS_PER_S);
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d wh = _mm_set1_pd(whPerPulse);
+  const __m128d e0 = _mm_set1_pd(energy0);
+  size_t i;
+
+  if (n == 0) return;
+  convertOne(ts[0] - prevTs, 0, k, whPerPulse, energy0, interval, power, energy);
+
+  for (i = 1; i + 2 <= n; i += 2)
+    {
+      __m128i cur = _mm_loadu_si128((const __m128i *)(ts + i));
+      __m128i prev = _mm_loadu_si128((const __m128i *)(ts + i - 1));
+      __m128i diff = _mm_sub_epi64(cur, prev);
+      __m128d d = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(diff, biasBits)), bias);
+      __m128d p = _mm_andnot_pd(_mm_cmpeq_pd(d, zero), _mm_div_pd(vk, d));
+      __m128d idx = _mm_set_pd((double)(i + 2), (double)(i + 1));
+
+      _mm_storel_pi((__m64 *)(interval + i), _mm_cvtpd_ps(_mm_mul_pd(d, nsToS)));
+      _mm_storel_pi((__m64 *)(power + i), _mm_cvtpd_ps(p));
+      _mm_storeu_pd(energy + i, _mm_add_pd(e0, _mm_mul_pd(idx, wh)));
+    }
+  for (; i < n; i++)
+    {
+      convertOne(ts[i] - ts[i - 1], i, k, whPerPulse, energy0, interval, power, energy);
+    }
+}
+
+__attribute__((target("avx2")))
+static void convertAvx2(const uint64_t *ts, size_t n, uint64_t prevTs,
+                        double whPerPulse, double energy0,
+                        float *interval, float *power, double *energy)
+{
+  double k = whPerPulse * S_PER_H * NS_PER_S;
+  const __m256i biasBits = _mm256_set1_epi64x(BIAS_BITS);
+  const __m256d bias = _mm256_set1_pd(BIAS);
+  const __m256d vk = _mm256_set1_pd(k);
+  const __m256d nsToS = _mm256_set1_pd(1.0 / NS_PER_S);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d wh = _mm256_set1_pd(whPerPulse);
+  const __m256d e0 = _mm256_set1_pd(energy0);
+  const __m256d step = _mm256_set1_pd(4.0);
+  __m256d idx;
+  size_t i;
+
+  if (n == 0) return;
+  convertOne(ts[0] - prevTs, 0, k, whPerPulse, energy0, interval, power, energy);
+
+  idx = _mm256_set_pd(5.0, 4.0, 3.0, 2.0);
+  for (i = 1; i + 4 <= n; i += 4)
+    {
+      __m256i cur = _mm256_loadu_si256((const __m256i *)(ts + i));
+      __m256i prev = _mm256_loadu_si256((const __m256i *)(ts + i - 1));
+      __m256i diff = _mm256_sub_epi64(cur, prev);
+      __m256d d = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(diff, biasBits)), bias);
+      __m256d p = _mm256_andnot_pd(_mm256_cmp_pd(d, zero, _CMP_EQ_OQ), _mm256_div_pd(vk, d));
+
+      _mm_storeu_ps(interval + i, _mm256_cvtpd_ps(_mm256_mul_pd(d, nsToS)));
+      _mm_storeu_ps(power + i, _mm256_cvtpd_ps(p));
+      _mm256_storeu_pd(energy + i, _mm256_add_pd(e0, _mm256_mul_pd(idx, wh)));
+      idx = _mm256_add_pd(idx, step);
+    }
+  for (; i < n; i++)
+    {
+      convertOne(ts[i] - ts[i - 1], i, k, whPerPulse, energy0, interval, power, energy);
+    }
+}
+
+#endif /* PULSE_KERNEL_X86 */
+
+#ifdef PULSE_KERNEL_NEON
+
+/* Intervals are narrowed to units of 2^10 ns before conversion to float */
+#define NEON_SHIFT (10)
+#define NEON_UNIT_S (1024.0 / NS_PER_S)
+
+static void convertNeon(const uint64_t *ts, size_t n, uint64_t prevTs,
+                        double whPerPulse, double energy0,
+                        float *interval, float *power, double *energy)
+{
+  double k = whPerPulse * S_PER_H * NS_PER_S;
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float unitS = (float)NEON_UNIT_S;
+  const float kUnit = (float)(whPerPulse * S_PER_H / NEON_UNIT_S);
+  size_t i;
+
+  if (n == 0) return;
+  convertOne(ts[0] - prevTs, 0, k, whPerPulse, energy0, interval, power, energy);
+
+  for (i = 1; i + 4 <= n; i += 4)
+    {
+      uint64x2_t d0 = vsubq_u64(vld1q_u64(ts + i), vld1q_u64(ts + i - 1));
+      uint64x2_t d1 = vsubq_u64(vld1q_u64(ts + i + 2), vld1q_u64(ts + i + 1));
+      uint32x4_t u = vcombine_u32(vqshrn_n_u64(d0, NEON_SHIFT),
+                                  vqshrn_n_u64(d1, NEON_SHIFT));
+      float32x4_t f = vcvtq_f32_u32(u);
+      float32x4_t r = vrecpeq_f32(f);
+
+      /* Two Newton-Raphson steps take the estimate to full float precision */
+      r = vmulq_f32(vrecpsq_f32(f, r), r);
+      r = vmulq_f32(vrecpsq_f32(f, r), r);
+      r = vbslq_f32(vceqq_u32(u, vdupq_n_u32(0)), zero, vmulq_n_f32(r, kUnit));
+
+      vst1q_f32(interval + i, vmulq_n_f32(f, unitS));
+      vst1q_f32(power + i, r);
+      energy[i] = energy0 + (double)(i + 1) * whPerPulse;
+      energy[i + 1] = energy0 + (double)(i + 2) * whPerPulse;
+      energy[i + 2] = energy0 + (double)(i + 3) * whPerPulse;
+      energy[i + 3] = energy0 + (double)(i + 4) * whPerPulse;
+    }
+  for (; i < n; i++)
+    {
+      convertOne(ts[i] - ts[i - 1], i, k, whPerPulse, energy0, interval, power, energy);
+    }
+}
+
+#endif /* PULSE_KERNEL_NEON */
+
+/******************************************************************************/
+/**
+ *
+ * Pick the best implementation for the CPU we are running on
+ *
+ ******************************************************************************/
+static ConvertFn selectConvert(const char **name)
+{
+#if defined(PULSE_KERNEL_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    {
+      *name = "avx2";
+      return convertAvx2;
+    }
+  *name = "sse2";
+  return convertSse2;
+#elif defined(PULSE_KERNEL_NEON)
+  *name = "neon";
+  return convertNeon;
+#else
+  *name = "scalar";
+  return pulseKernelConvertScalar;
+#endif
+}
+
+static ConvertFn convertFn;
+static const char *convertName;
+
+void pulseKernelConvert(const uint64_t *ts, size_t n, uint64_t prevTs,
+                        double whPerPulse, double energy0,
+                        float *interval, float *power, double *energy)
+{
+  if (!convertFn) convertFn = selectConvert(&convertName);
+  convertFn(ts, n, prevTs, whPerPulse, energy0, interval, power, energy);
+}
+
+const char *pulseKernelName(void)
+{
+  if (!convertFn) convertFn = selectConvert(&convertName);
+  return convertName;
+}
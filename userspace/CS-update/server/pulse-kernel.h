@@ -0,0 +1,73 @@
+/******************************************************************************/
+/**
+ * \file pulse-kernel.h
+ *
+ * \brief Batch conversion of pulse timestamps into interval, power and
+ *        accumulated energy series.
+ *
+ *        Every LED pulse from the meter represents a fixed amount of energy,
+ *        so the power between two pulses is energy/interval. This is the
+ *        SCALE/diffTime calculation done one value at a time elsewhere,
+ *        done here for whole arrays with NEON, SSE2 or AVX2 when available.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef PULSE_KERNEL_H
+#define PULSE_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Energy represented by one pulse, in Wh (1000 imp/kWh meter) */
+#define WH_PER_PULSE (1.0)
+
+/******************************************************************************/
+/**
+ *
+ * Convert an array of pulse timestamps into interval, power and energy series
+ *
+ * interval[i] is the time in seconds since the previous pulse, power[i] the
+ * average power in W over that interval and energy[i] the accumulated
+ * energy in Wh including pulse i. A zero interval gives zero power.
+ *
+ * Timestamps must be non-decreasing and intervals shorter than 2^52 ns.
+ * The NEON path works in single precision and saturates intervals at
+ * about 73 minutes, the x86 paths are bit-exact with the scalar code.
+ *
+ * \param ts, pulse timestamps in ns
+ * \param n, number of timestamps
+ * \param prevTs, timestamp of the pulse preceding ts[0]
+ * \param whPerPulse, energy of one pulse in Wh
+ * \param energy0, accumulated energy in Wh before ts[0]
+ * \param interval, output, n intervals in s
+ * \param power, output, n power values in W
+ * \param energy, output, n accumulated energies in Wh
+ * \return None
+ *
+ ******************************************************************************/
+void pulseKernelConvert(const uint64_t *ts, size_t n, uint64_t prevTs,
+                        double whPerPulse, double energy0,
+                        float *interval, float *power, double *energy);
+
+/******************************************************************************/
+/**
+ *
+ * Plain C version of pulseKernelConvert(), used as fallback and reference
+ *
+ ******************************************************************************/
+void pulseKernelConvertScalar(const uint64_t *ts, size_t n, uint64_t prevTs,
+                              double whPerPulse, double energy0,
+                              float *interval, float *power, double *energy);
+
+/******************************************************************************/
+/**
+ *
+ * Name of the implementation selected by pulseKernelConvert()
+ *
+ * \return "avx2", "sse2", "neon" or "scalar"
+ *
+ ******************************************************************************/
+const char *pulseKernelName(void);
+
+#endif
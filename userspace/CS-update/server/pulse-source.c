@@ -0,0 +1,111 @@
+/******************************************************************************/
+/**
+ * \file pulse-source.c
+ *
+ * \brief Reads pulses from the wattmeter module, see pulse-source.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include "pulse-source.h"
+
+/******************************************************************************/
+/**
+ *
+ * Read and parse the attribute from the start
+ *
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+static int readAttr(int fd, PulseStruct *pulse)
+{
+  char buf[64];
+  unsigned long long ts;
+  unsigned int count;
+  ssize_t n;
+
+  n = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) return -1;
+  buf[n] = '\0';
+  if (sscanf(buf, "%u %llu", &count, &ts) != 2)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  pulse->ts = ts;
+  pulse->count = count;
+  pulse->missed = 0;
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Read the attribute, through a new descriptor when it is polled
+ *
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+static int readSource(PulseSourceStruct *src, PulseStruct *pulse)
+{
+  int fd, ret;
+
+  if (!src->polled) return readAttr(src->fd, pulse);
+  fd = open(src->fileName, O_RDONLY);
+  if (fd < 0) return -1;
+  ret = readAttr(fd, pulse);
+  close(fd);
+  return ret;
+}
+
+int pulseSourceOpen(PulseSourceStruct *src, const char *fileName)
+{
+  struct statfs fs;
+
+  src->havePrev = 0;
+  if (strlen(fileName) >= sizeof(src->fileName))
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  strcpy(src->fileName, fileName);
+  src->fd = open(fileName, O_RDONLY);
+  if (src->fd < 0) return -1;
+  src->polled = (fstatfs(src->fd, &fs) != 0 || fs.f_type != SYSFS_MAGIC);
+  if (readSource(src, &src->prev) == 0) src->havePrev = 1;
+  return 0;
+}
+
+int pulseSourceRead(PulseSourceStruct *src, PulseStruct *pulse)
+{
+  PulseStruct cur;
+
+  if (readSource(src, &cur) != 0) return -1;
+  if (!src->havePrev || cur.count < src->prev.count)
+    {
+      src->prev = cur;
+      src->havePrev = 1;
+      return 0;
+    }
+  if (cur.count == src->prev.count) return 0;
+
+  cur.missed = cur.count - src->prev.count - 1;
+  traceBegin(&cur.trace, cur.ts);
+  traceStamp(&cur.trace, TRACE_READ);
+  src->prev = cur;
+  *pulse = cur;
+  return 1;
+}
+
+void pulseSourceClose(PulseSourceStruct *src)
+{
+  if (src->fd >= 0) close(src->fd);
+  src->fd = -1;
+}
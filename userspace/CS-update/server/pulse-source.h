@@ -0,0 +1,77 @@
+/******************************************************************************/
+/**
+ * \file pulse-source.h
+ *
+ * \brief Reads pulses from the lastPulse attribute of the wattmeter module.
+ *
+ *        The attribute holds "<numWattHours> <ns since epoch>" and is
+ *        notified on every pulse, so the file descriptor can be poll()ed
+ *        for POLLPRI together with the server sockets.
+ *
+ *        A lastPulse that is not in sysfs, such as the fake tree kept by
+ *        pulse-replay, is never notified. It is read every
+ *        PULSE_SOURCE_POLL_MS instead, reopened each time so that it can be
+ *        replaced with rename() and never be seen half written.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef PULSE_SOURCE_H
+#define PULSE_SOURCE_H
+
+#include <stdint.h>
+#include "trace.h"
+
+#define PULSE_SOURCE_PATH (256)
+#define PULSE_SOURCE_POLL_MS (1)
+
+typedef struct
+{
+  uint64_t ts;      /* Time of the pulse, ns since the epoch */
+  uint32_t count;   /* numWattHours including this pulse */
+  uint32_t missed;  /* Pulses counted by the module but not seen by us */
+  TraceStruct trace;
+} PulseStruct;
+
+typedef struct
+{
+  int fd;
+  int polled;                /* Not in sysfs, read every PULSE_SOURCE_POLL_MS */
+  char fileName[PULSE_SOURCE_PATH];
+  int havePrev;
+  PulseStruct prev;
+} PulseSourceStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Open the lastPulse attribute and read the current state as baseline
+ *
+ * \param src, the source to initialize
+ * \param fileName, path of the lastPulse attribute
+ * \return 0 if successful, otherwise -1 with errno set
+ *
+ ******************************************************************************/
+int pulseSourceOpen(PulseSourceStruct *src, const char *fileName);
+
+/******************************************************************************/
+/**
+ *
+ * Read the attribute and report a pulse if the count has moved
+ *
+ * When several pulses happened since the last read only the latest
+ * timestamp is known, the others are reported in pulse->missed. A count
+ * that went backwards (module reloaded or counter written) restarts the
+ * baseline without reporting a pulse. The trace of the pulse is begun
+ * at its time stamp and has passed TRACE_READ.
+ *
+ * \param src, the source
+ * \param pulse, filled in with the new pulse
+ * \return 1 if a new pulse was read, 0 if not, -1 on error
+ *
+ ******************************************************************************/
+int pulseSourceRead(PulseSourceStruct *src, PulseStruct *pulse);
+
+void pulseSourceClose(PulseSourceStruct *src);
+
+#endif
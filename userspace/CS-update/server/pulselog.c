@@ -0,0 +1,85 @@
+/******************************************************************************/
+/**
+ * \file pulselog.c
+ *
+ * \brief Column stored raw pulses, see pulselog.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include "pulselog.h"
+
+void pulseLogInit(PulseLogStruct *log)
+{
+  log->head = 0;
+  log->count = 1;
+  log->blocks[0].n = 0;
+}
+
+void pulseLogAdd(PulseLogStruct *log, uint64_t ts, uint32_t missed)
+{
+  PulseLogBlockStruct *block = &log->blocks[log->head];
+
+  if (block->n == PULSELOG_BLOCK_SIZE)
+    {
+      log->head = (log->head + 1) % PULSELOG_BLOCKS;
+      if (log->count < PULSELOG_BLOCKS) log->count++;
+      block = &log->blocks[log->head];
+      block->n = 0;
+    }
+  block->ts[block->n] = ts;
+  block->missed[block->n] = missed;
+  block->n++;
+}
+
+const PulseLogBlockStruct *pulseLogBlock(const PulseLogStruct *log, size_t i)
+{
+  return &log->blocks[(log->head + 1 + PULSELOG_BLOCKS - log->count + i) % PULSELOG_BLOCKS];
+}
+
+/******************************************************************************/
+/**
+ *
+ * Index of the first pulse at or after ts
+ *
+ ******************************************************************************/
+static size_t lowerBound(const PulseLogBlockStruct *block, uint64_t ts)
+{
+  size_t lo = 0, hi = block->n;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if ((uint64_t)block->ts[mid] < ts) lo = mid + 1;
+      else hi = mid;
+    }
+  return lo;
+}
+
+size_t pulseLogRange(const PulseLogBlockStruct *block, uint64_t from, uint64_t to, size_t *first)
+{
+  size_t end;
+
+  *first = lowerBound(block, from);
+  end = lowerBound(block, to);
+  return (end > *first) ? end - *first : 0;
+}
+
+int pulseLogSince(const PulseLogStruct *log, uint64_t ts, uint64_t *pulses)
+{
+  size_t i, j, first;
+
+  *pulses = 0;
+  for (i = log->count; i-- > 0;)
+    {
+      const PulseLogBlockStruct *block = pulseLogBlock(log, i);
+
+      first = lowerBound(block, ts + 1);
+      for (j = first; j < block->n; j++) *pulses += 1 + block->missed[j];
+      if (first > 0) return 0;
+    }
+
+  /* Pulses from before the oldest one kept, or before a restart, are not known */
+  return (*pulses == 0) ? 0 : -1;
+}
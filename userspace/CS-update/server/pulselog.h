@@ -0,0 +1,92 @@
+/******************************************************************************/
+/**
+ * \file pulselog.h
+ *
+ * \brief The raw pulses of the last days, stored column by column.
+ *
+ *        Pulses are appended to blocks of PULSELOG_BLOCK_SIZE, each block
+ *        holding one array of time stamps and one of missed pulse counts.
+ *        The PULSELOG_BLOCKS latest blocks are kept in a ring, which at
+ *        1 Wh per pulse and 1 kW on average is more than ten days.
+ *
+ *        A block is laid out as a column store reads it. The log storage
+ *        engine writes pulses in the same blocks, so exports hand the
+ *        arrays read back from it out as they are.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef PULSELOG_H
+#define PULSELOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PULSELOG_BLOCK_SIZE (4096)
+#define PULSELOG_BLOCKS (64)
+
+typedef struct
+{
+  int64_t ts[PULSELOG_BLOCK_SIZE];       /* ns since the epoch */
+  uint32_t missed[PULSELOG_BLOCK_SIZE];  /* Pulses missed before this one */
+  size_t n;
+} PulseLogBlockStruct;
+
+typedef struct
+{
+  PulseLogBlockStruct blocks[PULSELOG_BLOCKS];
+  size_t head;      /* Block being filled */
+  size_t count;     /* Blocks in use, including the one being filled */
+} PulseLogStruct;
+
+void pulseLogInit(PulseLogStruct *log);
+
+/******************************************************************************/
+/**
+ *
+ * Append a pulse, the oldest block is reused when the ring is full
+ *
+ * \param log, the pulse log
+ * \param ts, time of the pulse in ns
+ * \param missed, pulses missed before this one
+ * \return None
+ *
+ ******************************************************************************/
+void pulseLogAdd(PulseLogStruct *log, uint64_t ts, uint32_t missed);
+
+/******************************************************************************/
+/**
+ *
+ * Block number i, 0 being the oldest
+ *
+ ******************************************************************************/
+const PulseLogBlockStruct *pulseLogBlock(const PulseLogStruct *log, size_t i);
+
+/******************************************************************************/
+/**
+ *
+ * Pulses of a block in [from, to)
+ *
+ * \param block, the block
+ * \param from, start in ns
+ * \param to, end in ns
+ * \param first, filled in with the index of the first pulse
+ * \return the number of pulses
+ *
+ ******************************************************************************/
+size_t pulseLogRange(const PulseLogBlockStruct *block, uint64_t from, uint64_t to, size_t *first);
+
+/******************************************************************************/
+/**
+ *
+ * Count the pulses after a time, missed pulses included
+ *
+ * \param log, the pulse log
+ * \param ts, time in ns
+ * \param pulses, filled in with the number of pulses
+ * \return 0 if successful, -1 if the log does not reach back to ts
+ *
+ ******************************************************************************/
+int pulseLogSince(const PulseLogStruct *log, uint64_t ts, uint64_t *pulses);
+
+#endif
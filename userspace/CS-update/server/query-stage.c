@@ -0,0 +1,114 @@
+/******************************************************************************/
+/**
+ * \file query-stage.c
+ *
+ * \brief Query stage, see query-stage.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <poll.h>
+#include <stdlib.h>
+#include "probes.h"
+#include "query.h"
+#include "query-stage.h"
+
+/******************************************************************************/
+/**
+ *
+ * Hand a request to the compute stage and wait for its reply
+ *
+ ******************************************************************************/
+static void exchange(QueryStageStruct *q, const QueryRequestStruct *req, QueryReplyStruct *reply)
+{
+  reply->buf = NULL;
+  reply->len = 0;
+  if (spscPut(&q->requests, req) != 0) return;
+  spscFlush(&q->requests);
+  while (spscGet(&q->replies, reply, 1) == 0) spscWait(&q->replies, -1);
+}
+
+/* The forward function of the query protocol, see querySetForward() */
+static int forward(void *ctx, FILE *out, int argc, char *argv[])
+{
+  QueryStageStruct *q = ctx;
+  QueryRequestStruct req = { argc, argv };
+  QueryReplyStruct reply;
+
+  exchange(q, &req, &reply);
+  if (reply.buf == NULL) fprintf(out, "ERR busy\n");
+  else fwrite(reply.buf, 1, reply.len, out);
+  free(reply.buf);
+  return 0;
+}
+
+static void *queryThread(void *arg)
+{
+  QueryStageStruct *q = arg;
+  struct pollfd fds[2];
+
+  fds[0].fd = q->querySockfd;
+  fds[0].events = POLLIN;
+  fds[1].fd = q->metricsSockfd;
+  fds[1].events = POLLIN;
+  for (;;)
+    {
+      if (poll(fds, 2, -1) < 0) continue;
+      if (fds[0].revents & POLLIN)
+	{
+	  PROBE0(query__start);
+	  queryServe(q->querySockfd);
+	  PROBE0(query__done);
+	  __atomic_store_n(&q->queries, q->queries + 1, __ATOMIC_RELAXED);
+	}
+      if (fds[1].revents & POLLIN) metricsServe(q->metrics, q->metricsSockfd);
+    }
+  return NULL;
+}
+
+int queryStageStart(QueryStageStruct *q, int querySockfd, int metricsSockfd, MetricsStruct *metrics)
+{
+  if (spscInit(&q->requests, "query", sizeof(QueryRequestStruct), QUERY_STAGE_QUEUE) != 0 ||
+      spscInit(&q->replies, "reply", sizeof(QueryReplyStruct), QUERY_STAGE_QUEUE) != 0)
+    {
+      return -1;
+    }
+  q->querySockfd = querySockfd;
+  q->metricsSockfd = metricsSockfd;
+  q->metrics = metrics;
+  q->queries = 0;
+  querySetForward(forward, q);
+  return (pthread_create(&q->thread, NULL, queryThread, q) == 0) ? 0 : -1;
+}
+
+void queryStageAnswer(QueryStageStruct *q)
+{
+  QueryRequestStruct req;
+  QueryReplyStruct reply;
+  FILE *out;
+
+  spscWait(&q->requests, 0);
+  while (spscGet(&q->requests, &req, 1) == 1)
+    {
+      reply.buf = NULL;
+      reply.len = 0;
+      out = open_memstream(&reply.buf, &reply.len);
+      if (out != NULL)
+	{
+	  queryAnswer(out, req.argc, req.argv);
+	  fclose(out);
+	}
+      spscPut(&q->replies, &reply);
+      spscFlush(&q->replies);
+    }
+}
+
+int queryStageWakeFd(const QueryStageStruct *q)
+{
+  return spscWakeFd(&q->requests);
+}
+
+uint64_t queryStageCount(const QueryStageStruct *q)
+{
+  return __atomic_load_n(&q->queries, __ATOMIC_RELAXED);
+}
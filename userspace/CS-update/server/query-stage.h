@@ -0,0 +1,101 @@
+/******************************************************************************/
+/**
+ * \file query-stage.h
+ *
+ * \brief Query stage, serves QUERY_PORT and METRICS_PORT in its own thread.
+ *
+ *        The query thread accepts the connections, reads the requests and
+ *        sends the replies, so a slow or stalled client only holds up the
+ *        other clients, never the pulses. Scrapes get the reply the compute
+ *        stage last published, see metrics.h. The commands read state owned by
+ *        the compute stage, so they are forwarded to it through an SPSC
+ *        queue, see query.h, and answered there into memory. The reply
+ *        comes back through a second queue and is sent from the query
+ *        thread, which waits for it with one request outstanding.
+ *
+ *        Commands that need the connection or only wrap other commands,
+ *        SUBSCRIBE and COMPRESS, are answered in the query thread, so a
+ *        compressed transfer costs the compute stage only the rendering of
+ *        the plain reply. So is EXPORT, which reads the store and nothing
+ *        owned by the compute stage.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef QUERY_STAGE_H
+#define QUERY_STAGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "metrics.h"
+#include "spsc.h"
+
+#define QUERY_STAGE_QUEUE (2)
+
+typedef struct
+{
+  int argc;
+  char **argv;               /* Kept by the query thread until the reply */
+} QueryRequestStruct;
+
+typedef struct
+{
+  char *buf;                 /* malloc()ed, freed by the query thread */
+  size_t len;
+} QueryReplyStruct;
+
+typedef struct
+{
+  SpscStruct requests;       /* Query thread -> compute */
+  SpscStruct replies;        /* Compute -> query thread */
+  int querySockfd;
+  int metricsSockfd;
+  MetricsStruct *metrics;
+  uint64_t queries;
+  pthread_t thread;
+} QueryStageStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Start the query thread, after the commands are registered
+ *
+ * \param q, the query stage
+ * \param querySockfd, the listening socket from queryListen()
+ * \param metricsSockfd, the listening socket from metricsListen()
+ * \param metrics, the metrics scrapes are answered from
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int queryStageStart(QueryStageStruct *q, int querySockfd, int metricsSockfd, MetricsStruct *metrics);
+
+/******************************************************************************/
+/**
+ *
+ * Compute: answer the forwarded requests, to be called when
+ * queryStageWakeFd() is readable
+ *
+ * \param q, the query stage
+ * \return None
+ *
+ ******************************************************************************/
+void queryStageAnswer(QueryStageStruct *q);
+
+/******************************************************************************/
+/**
+ *
+ * Compute: the descriptor to poll() for forwarded requests
+ *
+ ******************************************************************************/
+int queryStageWakeFd(const QueryStageStruct *q);
+
+/******************************************************************************/
+/**
+ *
+ * Connections served on QUERY_PORT, safe to call from any thread
+ *
+ ******************************************************************************/
+uint64_t queryStageCount(const QueryStageStruct *q);
+
+#endif
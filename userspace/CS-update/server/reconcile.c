@@ -0,0 +1,200 @@
+/******************************************************************************/
+/**
+ * \file reconcile.c
+ *
+ * \brief Lost pulse reconciliation, see reconcile.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include <time.h>
+#include "pulse-kernel.h"
+#include "query.h"
+#include "reconcile.h"
+
+#define NS_PER_S (1000000000ULL)
+#define INTERVAL_ALPHA (0.1)
+
+void reconcileInit(ReconcileStruct *rc, RollupStruct *rollup, const PulseLogStruct *pulses,
+		   ReconcileRegisterFn onRegister, void *ctx)
+{
+  rc->rollup = rollup;
+  rc->pulses = pulses;
+  rc->onRegister = onRegister;
+  rc->ctx = ctx;
+  rc->numGaps = 0;
+  rc->gapPos = 0;
+  rc->lastTs = 0;
+  rc->interval = 0;
+  rc->counted = 0;
+  rc->anchor.ts = 0;
+}
+
+static ReconcileGapStruct *gap(ReconcileStruct *rc, int i)
+{
+  return &rc->gaps[(rc->gapPos + RECONCILE_GAPS - rc->numGaps + i) % RECONCILE_GAPS];
+}
+
+int reconcilePush(ReconcileStruct *rc, uint64_t ts, double wh)
+{
+  uint64_t interval;
+  ReconcileGapStruct *g;
+
+  rc->counted += wh;
+  if (rc->lastTs == 0 || ts <= rc->lastTs)
+    {
+      if (rc->lastTs == 0) rc->lastTs = ts;
+      return 0;
+    }
+  interval = ts - rc->lastTs;
+
+  if (rc->interval == 0 || interval < RECONCILE_MIN_GAP ||
+      interval < RECONCILE_GAP_FACTOR * rc->interval)
+    {
+      rc->interval = (rc->interval == 0) ? interval :
+	rc->interval + INTERVAL_ALPHA * (interval - rc->interval);
+      rc->lastTs = ts;
+      return 0;
+    }
+
+  /* Gaps are kept out of the smoothed interval */
+  g = &rc->gaps[rc->gapPos];
+  g->start = rc->lastTs;
+  g->end = ts;
+  g->added = 0;
+  rc->gapPos = (rc->gapPos + 1) % RECONCILE_GAPS;
+  if (rc->numGaps < RECONCILE_GAPS) rc->numGaps++;
+  rc->lastTs = ts;
+  return 1;
+}
+
+int reconcileRegister(ReconcileStruct *rc, uint64_t ts, double reg, double *lost, int *numGaps)
+{
+  ReconcileAnchorStruct prev = rc->anchor;
+  double length = 0;
+  uint64_t since;
+  int i;
+
+  *lost = 0;
+  *numGaps = 0;
+  if (pulseLogSince(rc->pulses, ts, &since) != 0) return -1;
+  rc->anchor.ts = ts;
+  rc->anchor.reg = reg;
+  rc->anchor.counted = rc->counted - since * WH_PER_PULSE;
+  if (rc->onRegister) rc->onRegister(rc->ctx, ts, reg);
+  if (prev.ts == 0 || ts <= prev.ts) return 0;
+
+  *lost = (reg - prev.reg) - (rc->anchor.counted - prev.counted);
+  if (*lost <= 0) return 0;
+
+  for (i = 0; i < rc->numGaps; i++)
+    {
+      ReconcileGapStruct *g = gap(rc, i);
+      if (g->start >= prev.ts && g->end <= ts)
+	{
+	  length += g->end - g->start;
+	  (*numGaps)++;
+	}
+    }
+  if (length == 0) return 0;
+
+  for (i = 0; i < rc->numGaps; i++)
+    {
+      ReconcileGapStruct *g = gap(rc, i);
+      if (g->start >= prev.ts && g->end <= ts)
+	{
+	  double share = *lost * (g->end - g->start) / length;
+	  g->added += share;
+	  rollupAdjust(rc->rollup, g->start, g->end, share);
+	}
+    }
+  return 0;
+}
+
+void reconcileRestore(ReconcileStruct *rc, uint64_t ts, double reg, double since)
+{
+  rc->anchor.ts = ts;
+  rc->anchor.reg = reg;
+  rc->anchor.counted = rc->counted - since;
+}
+
+int reconcileTotal(const ReconcileStruct *rc, double *total)
+{
+  if (rc->anchor.ts == 0)
+    {
+      *total = rc->counted;
+      return 0;
+    }
+  *total = rc->anchor.reg + rc->counted - rc->anchor.counted;
+  return 1;
+}
+
+/******************************************************************************/
+/**
+ *
+ * REGISTER <kWh> [s since the epoch]
+ *
+ * Adds a reading of the meter register, taken now unless a time is given.
+ * The time can not be in the future, nor older than the pulse log.
+ *
+ *        | lost <Wh> gaps <number of gaps> |
+ *
+ ******************************************************************************/
+static int queryRegisterReading(void *ctx, FILE *out, int argc, char *argv[])
+{
+  ReconcileStruct *rc = ctx;
+  unsigned long long now = (uint64_t)time(NULL) * NS_PER_S, ts = now;
+  double kwh, lost;
+  char *end;
+  int numGaps;
+
+  if (argc < 2) return -1;
+  kwh = strtod(argv[1], &end);
+  if (*end != '\0' || kwh < 0) return -1;
+  if (argc > 2 && ((ts = queryParseTime(argv[2])) == 0 || ts > now)) return -1;
+
+  if (reconcileRegister(rc, ts, kwh * 1000, &lost, &numGaps) != 0)
+    {
+      fprintf(out, "ERR reading older than the pulse log\n");
+      return 0;
+    }
+  fprintf(out, "lost %.0f gaps %d\n", lost, numGaps);
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * GAPS
+ *
+ * Prints the gaps found, oldest first, and the total
+ *
+ *        | gap <start s> <end s> <Wh put back> |
+ *        | total <Wh> <register|counted> |
+ *
+ ******************************************************************************/
+static int queryGaps(void *ctx, FILE *out, int argc, char *argv[])
+{
+  ReconcileStruct *rc = ctx;
+  double total;
+  int i, anchored;
+
+  (void)argc;
+  (void)argv;
+  for (i = 0; i < rc->numGaps; i++)
+    {
+      ReconcileGapStruct *g = gap(rc, i);
+      fprintf(out, "gap %llu %llu %.0f\n", (unsigned long long)(g->start / NS_PER_S),
+              (unsigned long long)(g->end / NS_PER_S), g->added);
+    }
+  anchored = reconcileTotal(rc, &total);
+  fprintf(out, "total %.0f %s\n", total, anchored ? "register" : "counted");
+  return 0;
+}
+
+void reconcileRegisterQueries(ReconcileStruct *rc)
+{
+  queryRegister("REGISTER", "<kWh> [time]", queryRegisterReading, rc);
+  queryRegister("GAPS", "", queryGaps, rc);
+}
@@ -0,0 +1,135 @@
+/******************************************************************************/
+/**
+ * \file reconcile.h
+ *
+ * \brief Finds lost pulses and puts their energy back using meter readings.
+ *
+ *        A pulse interval far longer than the recent ones, and longer than
+ *        RECONCILE_MIN_GAP, is taken as a gap where pulses were lost, for
+ *        example while the sensor was bumped or the module reloaded.
+ *
+ *        Readings of the utility meter register are anchor points. Between
+ *        two anchors, the difference between the register and the counted
+ *        energy is the lost energy. It is spread over the gaps in between
+ *        in proportion to their length and added to the rollups, and the
+ *        total follows the register from then on. A reading taken earlier
+ *        is compared with what was counted up to then, taken from the
+ *        pulse log, so it can be no older than the pulses kept there.
+ *
+ *        Each reading is handed to onRegister to be stored, and the latest
+ *        one is taken up again at start with reconcileRestore(), so the
+ *        total goes on following the register over a restart.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef RECONCILE_H
+#define RECONCILE_H
+
+#include <stdint.h>
+#include "pulselog.h"
+#include "rollup.h"
+
+#define RECONCILE_GAPS (64)
+#define RECONCILE_MIN_GAP (5 * 60 * 1000000000ULL)
+#define RECONCILE_GAP_FACTOR (10.0)
+
+typedef struct
+{
+  uint64_t start;   /* Pulse before the gap, ns since the epoch */
+  uint64_t end;     /* Pulse after the gap */
+  double added;     /* Energy put back, Wh */
+} ReconcileGapStruct;
+
+typedef struct
+{
+  uint64_t ts;       /* When the register was read, 0 if never */
+  double reg;        /* Register, Wh */
+  double counted;    /* Counted energy at that time, Wh */
+} ReconcileAnchorStruct;
+
+/* Called with every register reading taken, reg in Wh */
+typedef void (*ReconcileRegisterFn)(void *ctx, uint64_t ts, double reg);
+
+typedef struct
+{
+  RollupStruct *rollup;
+  const PulseLogStruct *pulses;
+  ReconcileGapStruct gaps[RECONCILE_GAPS];   /* Ring, oldest first */
+  int numGaps;
+  int gapPos;
+  uint64_t lastTs;
+  double interval;                           /* Smoothed pulse interval, ns */
+  double counted;                            /* Energy of all pulses, Wh */
+  ReconcileAnchorStruct anchor;              /* Latest register reading */
+  ReconcileRegisterFn onRegister;
+  void *ctx;
+} ReconcileStruct;
+
+void reconcileInit(ReconcileStruct *rc, RollupStruct *rollup, const PulseLogStruct *pulses,
+		   ReconcileRegisterFn onRegister, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Add a pulse, recording a gap if the interval is implausibly long
+ *
+ * \param rc, the reconciler
+ * \param ts, time of the pulse in ns
+ * \param wh, energy since the previous pulse in Wh
+ * \return 1 if a gap was found, otherwise 0
+ *
+ ******************************************************************************/
+int reconcilePush(ReconcileStruct *rc, uint64_t ts, double wh);
+
+/******************************************************************************/
+/**
+ *
+ * Add a register reading and put the energy lost since the previous one
+ * back into the gaps
+ *
+ * \param rc, the reconciler
+ * \param ts, when the register was read, ns since the epoch
+ * \param reg, the register in Wh
+ * \param lost, filled in with the lost energy in Wh, 0 for the first reading
+ * \param numGaps, filled in with the number of gaps the energy went to
+ * \return 0 if successful, -1 if the reading is older than the pulse log
+ *
+ ******************************************************************************/
+int reconcileRegister(ReconcileStruct *rc, uint64_t ts, double reg, double *lost, int *numGaps);
+
+/******************************************************************************/
+/**
+ *
+ * Take up a register reading stored before a restart
+ *
+ * \param rc, the reconciler
+ * \param ts, when the register was read, ns since the epoch
+ * \param reg, the register in Wh
+ * \param since, energy of the pulses stored after ts, Wh
+ * \return None
+ *
+ ******************************************************************************/
+void reconcileRestore(ReconcileStruct *rc, uint64_t ts, double reg, double since);
+
+/******************************************************************************/
+/**
+ *
+ * Total energy in Wh, following the register once one has been read
+ *
+ * \param rc, the reconciler
+ * \param total, filled in with the total
+ * \return 1 if the total follows a register reading, otherwise 0
+ *
+ ******************************************************************************/
+int reconcileTotal(const ReconcileStruct *rc, double *total);
+
+/******************************************************************************/
+/**
+ *
+ * Add the REGISTER and GAPS query commands
+ *
+ ******************************************************************************/
+void reconcileRegisterQueries(ReconcileStruct *rc);
+
+#endif
@@ -0,0 +1,80 @@
+/******************************************************************************/
+/**
+ * \file resampler.c
+ *
+ * \brief Fixed interval power from the pulse stream, see resampler.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include "resampler.h"
+
+#define S_PER_H (3600.0)
+#define NS_PER_S (1e9)
+
+void resamplerInit(ResamplerStruct *r, uint64_t period, ResampleEmitFn emit, void *ctx)
+{
+  r->period = period;
+  r->bucketStart = 0;
+  r->lastTs = 0;
+  r->bucketEnergy = 0;
+  r->partial = 0;
+  r->emit = emit;
+  r->ctx = ctx;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Emit the current bucket and start the next one
+ *
+ ******************************************************************************/
+static void closeBucket(ResamplerStruct *r)
+{
+  ResampleRowStruct row;
+
+  row.start = r->bucketStart;
+  row.period = r->period;
+  row.energy = r->bucketEnergy;
+  row.power = r->bucketEnergy * S_PER_H * NS_PER_S / r->period;
+  if (!r->partial) r->emit(r->ctx, &row);
+
+  r->bucketStart += r->period;
+  r->bucketEnergy = 0;
+  r->partial = 0;
+}
+
+void resamplerPush(ResamplerStruct *r, uint64_t ts, double wh)
+{
+  uint64_t t, span;
+  double left;
+
+  if (r->lastTs == 0)
+    {
+      r->lastTs = ts;
+      r->bucketStart = ts - ts % r->period;
+      r->partial = (ts != r->bucketStart);
+      return;
+    }
+  if (ts <= r->lastTs)
+    {
+      /* Same or earlier timestamp, nothing to spread it over */
+      r->bucketEnergy += wh;
+      return;
+    }
+
+  /* Split the interval at every bucket boundary it crosses. The last part
+   * gets what is left so no energy is lost to rounding. */
+  span = ts - r->lastTs;
+  left = wh;
+  for (t = r->lastTs; ts >= r->bucketStart + r->period; t = r->bucketStart)
+    {
+      double part = wh * (double)(r->bucketStart + r->period - t) / span;
+
+      r->bucketEnergy += part;
+      left -= part;
+      closeBucket(r);
+    }
+  r->bucketEnergy += left;
+  r->lastTs = ts;
+}
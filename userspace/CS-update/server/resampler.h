@@ -0,0 +1,76 @@
+/******************************************************************************/
+/**
+ * \file resampler.h
+ *
+ * \brief Turns the irregular pulse stream into fixed interval power values.
+ *
+ *        The energy between two pulses is spread evenly over the time
+ *        between them, so an interval crossing a bucket boundary is split
+ *        between the buckets in proportion to the time spent in each. The
+ *        energy of every bucket is therefore exact, not a sample.
+ *
+ *        A bucket can only be completed when the first pulse after its end
+ *        arrives, since until then the energy of the interval is unknown.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+typedef struct
+{
+  uint64_t start;   /* Bucket start, ns since the epoch */
+  uint64_t period;  /* Bucket length, ns */
+  double energy;    /* Energy in the bucket, Wh */
+  double power;     /* Average power over the bucket, W */
+} ResampleRowStruct;
+
+typedef void (*ResampleEmitFn)(void *ctx, const ResampleRowStruct *row);
+
+typedef struct
+{
+  uint64_t period;
+  uint64_t bucketStart;
+  uint64_t lastTs;       /* 0 until the first pulse */
+  double bucketEnergy;   /* Energy of the current bucket so far, Wh */
+  int partial;           /* Current bucket started before the first pulse */
+  ResampleEmitFn emit;
+  void *ctx;
+} ResamplerStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Initialize a resampler
+ *
+ * \param r, the resampler
+ * \param period, bucket length in ns, buckets are aligned to the epoch
+ * \param emit, called for every completed bucket, in time order
+ * \param ctx, passed to emit
+ * \return None
+ *
+ ******************************************************************************/
+void resamplerInit(ResamplerStruct *r, uint64_t period, ResampleEmitFn emit, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Add the energy of the interval ending at ts
+ *
+ * The first pulse only starts the series, the energy before it is unknown,
+ * so the bucket it falls in is not emitted.
+ * Buckets completed by this interval are emitted before returning, one per
+ * bucket even when the interval spans many of them.
+ *
+ * \param r, the resampler
+ * \param ts, time of the pulse in ns
+ * \param wh, energy since the previous pulse in Wh
+ * \return None
+ *
+ ******************************************************************************/
+void resamplerPush(ResamplerStruct *r, uint64_t ts, double wh);
+
+#endif
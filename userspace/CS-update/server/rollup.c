@@ -0,0 +1,214 @@
+/******************************************************************************/
+/**
+ * \file rollup.c
+ *
+ * \brief 15 minute rollups with percentile sketches, see rollup.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include "query.h"
+#include "rollup.h"
+
+#define DEFAULT_CURVE_POINTS (20)
+#define MAX_CURVE_POINTS (1000)
+
+void rollupInit(RollupStruct *r, RollupCloseFn onClose, RollupCloseFn onAdjust, void *ctx)
+{
+  r->head = 0;
+  r->count = 0;
+  r->haveCur = 0;
+  r->onClose = onClose;
+  r->onAdjust = onAdjust;
+  r->ctx = ctx;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Move the current row into the ring
+ *
+ ******************************************************************************/
+static void closeRow(RollupStruct *r)
+{
+  RollupRowStruct *row = &r->rows[r->head];
+
+  r->cur.digest = *tdigestBuilderDigest(&r->builder);
+  *row = r->cur;
+  r->head = (r->head + 1) % ROLLUP_ROWS;
+  if (r->count < ROLLUP_ROWS) r->count++;
+  r->haveCur = 0;
+  if (r->onClose) r->onClose(r->ctx, row);
+}
+
+void rollupAddSecond(RollupStruct *r, const ResampleRowStruct *second)
+{
+  uint64_t start = second->start - second->start % ROLLUP_PERIOD;
+
+  if (r->haveCur && start != r->cur.start) closeRow(r);
+  if (!r->haveCur)
+    {
+      r->cur.start = start;
+      r->cur.energy = 0;
+      r->cur.seconds = 0;
+      tdigestBuilderInit(&r->builder);
+      r->haveCur = 1;
+    }
+  r->cur.energy += second->energy;
+  r->cur.seconds++;
+  tdigestBuilderAdd(&r->builder, (float)second->power);
+}
+
+RollupRowStruct *rollupRow(RollupStruct *r, size_t i)
+{
+  return &r->rows[(r->head + ROLLUP_ROWS - r->count + i) % ROLLUP_ROWS];
+}
+
+size_t rollupFind(RollupStruct *r, uint64_t ts)
+{
+  size_t lo = 0, hi = r->count;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (rollupRow(r, mid)->start < ts) lo = mid + 1;
+      else hi = mid;
+    }
+  return lo;
+}
+
+size_t rollupDigest(RollupStruct *r, uint64_t from, uint64_t to, TDigestStruct *out)
+{
+  size_t i, n = 0;
+
+  tdigestInit(out);
+  for (i = rollupFind(r, from); i < r->count; i++)
+    {
+      RollupRowStruct *row = rollupRow(r, i);
+
+      if (row->start >= to) break;
+      tdigestMerge(out, &row->digest);
+      n++;
+    }
+  if (r->haveCur && r->cur.start >= from && r->cur.start < to)
+    {
+      tdigestMerge(out, tdigestBuilderDigest(&r->builder));
+      n++;
+    }
+  return n;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Add the share of [from, to) that overlaps a row
+ *
+ ******************************************************************************/
+static double adjustRow(RollupRowStruct *row, uint64_t from, uint64_t to, double wh)
+{
+  uint64_t start = (row->start > from) ? row->start : from;
+  uint64_t end = (row->start + ROLLUP_PERIOD < to) ? row->start + ROLLUP_PERIOD : to;
+  double part;
+
+  if (end <= start) return 0;
+  part = wh * (double)(end - start) / (double)(to - from);
+  row->energy += part;
+  return part;
+}
+
+double rollupAdjust(RollupStruct *r, uint64_t from, uint64_t to, double wh)
+{
+  double done = 0, part;
+  size_t i;
+
+  if (to <= from) return 0;
+  for (i = rollupFind(r, from > ROLLUP_PERIOD ? from - ROLLUP_PERIOD : 0); i < r->count; i++)
+    {
+      RollupRowStruct *row = rollupRow(r, i);
+
+      if (row->start >= to) break;
+      part = adjustRow(row, from, to, wh);
+      if (part != 0 && r->onAdjust) r->onAdjust(r->ctx, row);
+      done += part;
+    }
+  if (r->haveCur) done += adjustRow(&r->cur, from, to, wh);
+  return done;
+}
+
+/******************************************************************************/
+/**
+ *
+ * PERCENTILE <from> <to> [percent ...]
+ *
+ * Prints "P<percent> <W>" per requested percentile, P5 P50 P95 P99 by
+ * default. Times are seconds since the epoch.
+ *
+ ******************************************************************************/
+static int queryPercentile(void *ctx, FILE *out, int argc, char *argv[])
+{
+  static char *defaults[] = { "5", "50", "95", "99" };
+  TDigestStruct digest;
+  unsigned long long from, to;
+  char **pct = argv + 3;
+  int i, n = argc - 3;
+
+  if (argc < 3) return -1;
+  from = queryParseTime(argv[1]);
+  to = queryParseTime(argv[2]);
+  if (to <= from) return -1;
+  if (n == 0)
+    {
+      pct = defaults;
+      n = sizeof(defaults) / sizeof(defaults[0]);
+    }
+  for (i = 0; i < n; i++)
+    {
+      double p = atof(pct[i]);
+      if (p < 0 || p > 100) return -1;
+    }
+
+  rollupDigest(ctx, from, to, &digest);
+  for (i = 0; i < n; i++)
+    {
+      fprintf(out, "P%s %.1f\n", pct[i], tdigestQuantile(&digest, atof(pct[i]) / 100));
+    }
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * LOADCURVE <from> <to> [points]
+ *
+ * Prints the load-duration curve as "<percent of time> <W>" lines, the
+ * power that was exceeded during that share of the time.
+ *
+ ******************************************************************************/
+static int queryLoadCurve(void *ctx, FILE *out, int argc, char *argv[])
+{
+  TDigestStruct digest;
+  unsigned long long from, to;
+  int i, points = DEFAULT_CURVE_POINTS;
+
+  if (argc < 3) return -1;
+  from = queryParseTime(argv[1]);
+  to = queryParseTime(argv[2]);
+  if (argc > 3) points = atoi(argv[3]);
+  if (to <= from || points < 1 || points > MAX_CURVE_POINTS) return -1;
+
+  rollupDigest(ctx, from, to, &digest);
+  for (i = 0; i <= points; i++)
+    {
+      double share = (double)i / points;
+      fprintf(out, "%.2f %.1f\n", 100 * share, tdigestQuantile(&digest, 1 - share));
+    }
+  return 0;
+}
+
+void rollupRegisterQueries(RollupStruct *r)
+{
+  queryRegister("PERCENTILE", "<from> <to> [percent ...]", queryPercentile, r);
+  queryRegister("LOADCURVE", "<from> <to> [points]", queryLoadCurve, r);
+}
@@ -0,0 +1,114 @@
+/******************************************************************************/
+/**
+ * \file rollup.h
+ *
+ * \brief 15 minute rollups of the 1 s power series.
+ *
+ *        Each rollup row holds the energy of its 15 minutes and a t-digest
+ *        of the 1 s power values in it. The rows of the last ROLLUP_DAYS
+ *        days are kept in a ring, so percentiles and load-duration curves
+ *        over any range in it are a merge of at most that many digests.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "resampler.h"
+#include "tdigest.h"
+
+#define ROLLUP_PERIOD (15 * 60 * 1000000000ULL)
+#define ROLLUP_DAYS (40)
+#define ROLLUP_ROWS (ROLLUP_DAYS * 24 * 4)
+
+typedef struct
+{
+  uint64_t start;        /* Row start, ns since the epoch */
+  double energy;         /* Wh */
+  uint32_t seconds;      /* Number of 1 s values in the row */
+  TDigestStruct digest;  /* 1 s power values, W */
+} RollupRowStruct;
+
+typedef struct RollupStruct RollupStruct;
+
+/* Called with every completed row, and again when one is adjusted */
+typedef void (*RollupCloseFn)(void *ctx, const RollupRowStruct *row);
+
+struct RollupStruct
+{
+  RollupRowStruct rows[ROLLUP_ROWS];
+  size_t head;                   /* Next row to write */
+  size_t count;                  /* Completed rows in the ring */
+  RollupRowStruct cur;           /* Row being filled */
+  TDigestBuilderStruct builder;  /* Digest of cur */
+  int haveCur;
+  RollupCloseFn onClose;
+  RollupCloseFn onAdjust;
+  void *ctx;
+};
+
+void rollupInit(RollupStruct *r, RollupCloseFn onClose, RollupCloseFn onAdjust, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Add a 1 s value from the resampler, completes the current row when the
+ * value belongs to a later one
+ *
+ ******************************************************************************/
+void rollupAddSecond(RollupStruct *r, const ResampleRowStruct *second);
+
+/******************************************************************************/
+/**
+ *
+ * Completed row number i, 0 being the oldest in the ring
+ *
+ ******************************************************************************/
+RollupRowStruct *rollupRow(RollupStruct *r, size_t i);
+
+/******************************************************************************/
+/**
+ *
+ * Index of the first completed row starting at or after ts
+ *
+ * \return the index, rollup->count if there is none
+ *
+ ******************************************************************************/
+size_t rollupFind(RollupStruct *r, uint64_t ts);
+
+/******************************************************************************/
+/**
+ *
+ * Merge the digests of all rows, including the current one, that start
+ * in [from, to)
+ *
+ * \return the number of rows merged
+ *
+ ******************************************************************************/
+size_t rollupDigest(RollupStruct *r, uint64_t from, uint64_t to, TDigestStruct *out);
+
+/******************************************************************************/
+/**
+ *
+ * Spread energy evenly over [from, to), adding it to the rows covering
+ * that time, including the current one. Used to put back energy of lost
+ * pulses, the digests are left as they are. Completed rows that change
+ * are passed to onAdjust.
+ *
+ * \return the energy that fell on rows in the ring, Wh
+ *
+ ******************************************************************************/
+double rollupAdjust(RollupStruct *r, uint64_t from, uint64_t to, double wh);
+
+/******************************************************************************/
+/**
+ *
+ * Add the PERCENTILE and LOADCURVE query commands
+ *
+ ******************************************************************************/
+void rollupRegisterQueries(RollupStruct *r);
+
+#endif
@@ -0,0 +1,161 @@
+/******************************************************************************/
+/**
+ * \file spsc.c
+ *
+ * \brief Lock-free single producer, single consumer queue, see spsc.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "query.h"
+#include "spsc.h"
+
+#define MAX_QUEUES (8)
+
+static SpscStruct *queues[MAX_QUEUES];
+static int numQueues = 0;
+
+int spscInit(SpscStruct *q, const char *name, size_t elemSize, size_t capacity)
+{
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) return -1;
+  memset(q, 0, sizeof(*q));
+  q->name = name;
+  q->elemSize = elemSize;
+  q->mask = capacity - 1;
+  q->buf = malloc(elemSize * capacity);
+  if (q->buf == NULL) return -1;
+  q->wakeFd = eventfd(0, EFD_NONBLOCK);
+  if (q->wakeFd < 0)
+    {
+      free(q->buf);
+      return -1;
+    }
+  if (numQueues < MAX_QUEUES) queues[numQueues++] = q;
+  return 0;
+}
+
+int spscPut(SpscStruct *q, const void *elem)
+{
+  /* Only reload the consumer's position when the cached one says full */
+  if (q->pending - q->cachedTail > q->mask)
+    {
+      q->cachedTail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+      if (q->pending - q->cachedTail > q->mask)
+	{
+	  __atomic_store_n(&q->dropped, q->dropped + 1, __ATOMIC_RELAXED);
+	  return -1;
+	}
+    }
+  memcpy(q->buf + (q->pending & q->mask) * q->elemSize, elem, q->elemSize);
+  q->pending++;
+  return 0;
+}
+
+void spscFlush(SpscStruct *q)
+{
+  uint64_t one = 1;
+  size_t depth;
+
+  if (q->pending == q->head) return;
+  __atomic_store_n(&q->head, q->pending, __ATOMIC_RELEASE);
+  q->cachedTail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+  depth = q->pending - q->cachedTail;
+  if (depth > q->maxDepth) __atomic_store_n(&q->maxDepth, depth, __ATOMIC_RELAXED);
+  if (write(q->wakeFd, &one, sizeof(one)) < 0)
+    {
+      /* The counter is already non-zero, the consumer will wake anyway */
+    }
+}
+
+size_t spscGet(SpscStruct *q, void *elems, size_t max)
+{
+  size_t n, first, tail = q->tail;
+  char *out = elems;
+
+  if (q->cachedHead == tail) q->cachedHead = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+  n = q->cachedHead - tail;
+  if (n == 0) return 0;
+  if (n > max) n = max;
+
+  /* At most two copies, up to the end of the ring and from its start */
+  first = q->mask + 1 - (tail & q->mask);
+  if (first > n) first = n;
+  memcpy(out, q->buf + (tail & q->mask) * q->elemSize, first * q->elemSize);
+  memcpy(out + first * q->elemSize, q->buf, (n - first) * q->elemSize);
+
+  __atomic_store_n(&q->tail, tail + n, __ATOMIC_RELEASE);
+  __atomic_store_n(&q->batches, q->batches + 1, __ATOMIC_RELAXED);
+  return n;
+}
+
+int spscWait(SpscStruct *q, int timeoutMs)
+{
+  struct pollfd pfd;
+  uint64_t count;
+
+  pfd.fd = q->wakeFd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, timeoutMs) <= 0) return 0;
+  return read(q->wakeFd, &count, sizeof(count)) == sizeof(count);
+}
+
+int spscWakeFd(const SpscStruct *q)
+{
+  return q->wakeFd;
+}
+
+size_t spscDepth(const SpscStruct *q)
+{
+  return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+uint64_t spscDropped(const SpscStruct *q)
+{
+  return __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+}
+
+SpscStruct *spscQueue(int i)
+{
+  return (i >= 0 && i < numQueues) ? queues[i] : NULL;
+}
+
+/******************************************************************************/
+/**
+ *
+ * STATS
+ *
+ * Prints one line per queue between the stages
+ *
+ *        | queue <name> depth <n> max <n> total <n> batches <n> dropped <n> |
+ *
+ ******************************************************************************/
+static int queryStats(void *ctx, FILE *out, int argc, char *argv[])
+{
+  int i;
+
+  (void)ctx;
+  (void)argc;
+  (void)argv;
+  for (i = 0; i < numQueues; i++)
+    {
+      SpscStruct *q = queues[i];
+
+      fprintf(out, "queue %s depth %zu max %llu total %zu batches %llu dropped %llu\n",
+	      q->name, spscDepth(q),
+	      (unsigned long long)__atomic_load_n(&q->maxDepth, __ATOMIC_RELAXED),
+	      __atomic_load_n(&q->head, __ATOMIC_RELAXED),
+	      (unsigned long long)__atomic_load_n(&q->batches, __ATOMIC_RELAXED),
+	      (unsigned long long)spscDropped(q));
+    }
+  return 0;
+}
+
+void spscRegisterQueries(void)
+{
+  queryRegister("STATS", "", queryStats, NULL);
+}
@@ -0,0 +1,149 @@
+/******************************************************************************/
+/**
+ * \file spsc.h
+ *
+ * \brief Lock-free single producer, single consumer queue between stages.
+ *
+ *        The server is split in stages running in their own threads,
+ *        capture -> compute -> store, compute -> publish and compute <->
+ *        query, each pair connected by one of these rings. Nothing is
+ *        locked and a full queue never blocks the producer, the element is
+ *        dropped and counted instead, so a stalled stage cannot hold up
+ *        the others.
+ *
+ *        Handoff is batched: the producer puts any number of elements and
+ *        publishes them with one spscFlush(), which also wakes the
+ *        consumer through an eventfd that can be poll()ed.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPSC_CACHE_LINE (64)
+
+typedef struct
+{
+  /* Producer side */
+  size_t head __attribute__((aligned(SPSC_CACHE_LINE)));  /* Published to the consumer */
+  size_t pending;                                          /* Put but not yet flushed */
+  size_t cachedTail;
+  uint64_t dropped;
+  uint64_t maxDepth;
+
+  /* Consumer side */
+  size_t tail __attribute__((aligned(SPSC_CACHE_LINE)));
+  size_t cachedHead;
+  uint64_t batches;
+
+  /* Set up once */
+  const char *name __attribute__((aligned(SPSC_CACHE_LINE)));
+  char *buf;
+  size_t elemSize;
+  size_t mask;
+  int wakeFd;
+} SpscStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Set up a queue
+ *
+ * \param q, the queue
+ * \param name, shown by the STATS query
+ * \param elemSize, size of one element in bytes
+ * \param capacity, number of elements, a power of two
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int spscInit(SpscStruct *q, const char *name, size_t elemSize, size_t capacity);
+
+/******************************************************************************/
+/**
+ *
+ * Producer: copy an element into the queue, not visible until spscFlush()
+ *
+ * \return 0 if successful, -1 if the queue was full and it was dropped
+ *
+ ******************************************************************************/
+int spscPut(SpscStruct *q, const void *elem);
+
+/******************************************************************************/
+/**
+ *
+ * Producer: hand over everything put since the last flush, and wake the
+ * consumer if there was anything
+ *
+ ******************************************************************************/
+void spscFlush(SpscStruct *q);
+
+/******************************************************************************/
+/**
+ *
+ * Consumer: take up to max elements
+ *
+ * \return the number of elements copied to elems
+ *
+ ******************************************************************************/
+size_t spscGet(SpscStruct *q, void *elems, size_t max);
+
+/******************************************************************************/
+/**
+ *
+ * Consumer: wait until there is something to get
+ *
+ * \param q, the queue
+ * \param timeoutMs, max time to wait, -1 for no limit
+ * \return 1 if woken by the producer, 0 on timeout
+ *
+ ******************************************************************************/
+int spscWait(SpscStruct *q, int timeoutMs);
+
+/******************************************************************************/
+/**
+ *
+ * Consumer: the eventfd that becomes readable on spscFlush(), for consumers
+ * that poll() other descriptors too. Call spscWait(q, 0) to reset it.
+ *
+ ******************************************************************************/
+int spscWakeFd(const SpscStruct *q);
+
+/******************************************************************************/
+/**
+ *
+ * Elements waiting in the queue, safe to call from any thread
+ *
+ ******************************************************************************/
+size_t spscDepth(const SpscStruct *q);
+
+/******************************************************************************/
+/**
+ *
+ * Elements dropped because the queue was full, safe to call from any thread
+ *
+ ******************************************************************************/
+uint64_t spscDropped(const SpscStruct *q);
+
+/******************************************************************************/
+/**
+ *
+ * Queue number i in the order they were set up
+ *
+ * \return the queue, NULL if there are not that many
+ *
+ ******************************************************************************/
+SpscStruct *spscQueue(int i);
+
+/******************************************************************************/
+/**
+ *
+ * Add the STATS query command, listing all queues
+ *
+ ******************************************************************************/
+void spscRegisterQueries(void);
+
+#endif
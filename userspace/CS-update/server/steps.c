@@ -0,0 +1,238 @@
+/******************************************************************************/
+/**
+ * \file steps.c
+ *
+ * \brief Step detection and appliance signatures, see steps.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <math.h>
+#include "query.h"
+#include "steps.h"
+
+#define NS_PER_S (1000000000ULL)
+#define RING (2 * STEPS_WINDOW)
+
+/* Steps within this share of a signature, or MIN_TOLERANCE W, match it */
+#define TOLERANCE (0.1)
+#define MIN_TOLERANCE (50.0)
+
+/* Signatures average over at most this many steps to follow slow drift */
+#define MAX_AVERAGE (20)
+
+void stepsInit(StepsStruct *s, StepEventFn onEvent, void *ctx)
+{
+  s->lastTs = 0;
+  s->pos = 0;
+  s->filled = 0;
+  s->sumOld = 0;
+  s->sumNew = 0;
+  s->inStep = 0;
+  s->numSignatures = 0;
+  s->numEvents = 0;
+  s->eventPos = 0;
+  s->onEvent = onEvent;
+  s->ctx = ctx;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Find the signature closest to a step size, within the tolerance
+ *
+ * \param s, the detector
+ * \param watt, the size of the step, positive
+ * \param onlyOn, only consider signatures that are on
+ * \return the index, or -1 if none matches
+ *
+ ******************************************************************************/
+static int findSignature(const StepsStruct *s, float watt, int onlyOn)
+{
+  float best = 0;
+  int i, found = -1;
+
+  for (i = 0; i < s->numSignatures; i++)
+    {
+      const StepSignatureStruct *sig = &s->signatures[i];
+      float dist = fabsf(watt - sig->watt);
+
+      if (onlyOn && sig->lastOn == 0) continue;
+      if (dist > fmaxf(TOLERANCE * sig->watt, MIN_TOLERANCE)) continue;
+      if (found < 0 || dist < best)
+	{
+	  found = i;
+	  best = dist;
+	}
+    }
+  return found;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Match a step on to a signature, creating one or replacing the least
+ * seen one when nothing matches
+ *
+ ******************************************************************************/
+static int classifyOn(StepsStruct *s, uint64_t ts, float watt)
+{
+  StepSignatureStruct *sig;
+  int i = findSignature(s, watt, 0);
+
+  if (i < 0)
+    {
+      if (s->numSignatures < STEPS_SIGNATURES)
+	{
+	  i = s->numSignatures++;
+	}
+      else
+	{
+	  int j;
+	  for (i = 0, j = 1; j < STEPS_SIGNATURES; j++)
+	    {
+	      if (s->signatures[j].numOn + s->signatures[j].numOff <
+		  s->signatures[i].numOn + s->signatures[i].numOff) i = j;
+	    }
+	}
+      s->signatures[i].watt = watt;
+      s->signatures[i].numOn = 0;
+      s->signatures[i].numOff = 0;
+    }
+
+  sig = &s->signatures[i];
+  sig->numOn++;
+  sig->watt += (watt - sig->watt) / (sig->numOn < MAX_AVERAGE ? sig->numOn : MAX_AVERAGE);
+  sig->lastOn = ts;
+  return i;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Match a step off, preferring signatures that are on
+ *
+ ******************************************************************************/
+static int classifyOff(StepsStruct *s, float watt)
+{
+  int i = findSignature(s, watt, 1);
+
+  if (i < 0) i = findSignature(s, watt, 0);
+  if (i < 0) return -1;
+  s->signatures[i].numOff++;
+  s->signatures[i].lastOn = 0;
+  return i;
+}
+
+static void emit(StepsStruct *s)
+{
+  StepEventStruct *event = &s->events[s->eventPos];
+
+  event->ts = s->bestTs;
+  event->watt = s->bestDiff;
+  event->signature = (s->bestDiff > 0) ?
+    classifyOn(s, s->bestTs, s->bestDiff) : classifyOff(s, -s->bestDiff);
+
+  s->eventPos = (s->eventPos + 1) % STEPS_EVENTS;
+  if (s->numEvents < STEPS_EVENTS) s->numEvents++;
+  if (s->onEvent) s->onEvent(s->ctx, event);
+}
+
+void stepsPush(StepsStruct *s, uint64_t ts, float watt)
+{
+  float diff;
+  int i;
+
+  /* A hole in the series breaks the windows, start over */
+  if (s->lastTs != 0 && ts != s->lastTs + NS_PER_S)
+    {
+      s->filled = 0;
+      s->pos = 0;
+      s->sumOld = 0;
+      s->sumNew = 0;
+      s->inStep = 0;
+    }
+  s->lastTs = ts;
+
+  if (s->filled < STEPS_WINDOW) s->sumOld += watt;
+  else if (s->filled < RING) s->sumNew += watt;
+  else
+    {
+      float boundary = s->samples[(s->pos + STEPS_WINDOW) % RING];
+
+      s->sumOld += boundary - s->samples[s->pos];
+      s->sumNew += watt - boundary;
+    }
+  s->samples[s->pos] = watt;
+  s->pos = (s->pos + 1) % RING;
+  if (s->filled < RING) s->filled++;
+  if (s->filled < RING) return;
+
+  /* Recompute the sums once per lap so rounding never builds up */
+  if (s->pos == 0)
+    {
+      s->sumOld = 0;
+      s->sumNew = 0;
+      for (i = 0; i < STEPS_WINDOW; i++)
+	{
+	  s->sumOld += s->samples[i];
+	  s->sumNew += s->samples[i + STEPS_WINDOW];
+	}
+    }
+
+  diff = (s->sumNew - s->sumOld) / STEPS_WINDOW;
+  if (fabsf(diff) > STEPS_MIN_WATT)
+    {
+      /* Follow the peak of the difference, that is where the step is */
+      if (!s->inStep || (diff > 0) != (s->bestDiff > 0) || fabsf(diff) > fabsf(s->bestDiff))
+	{
+	  if (s->inStep && (diff > 0) != (s->bestDiff > 0)) emit(s);
+	  s->bestDiff = diff;
+	  s->bestTs = ts - (STEPS_WINDOW - 1) * NS_PER_S;
+	}
+      s->inStep = 1;
+    }
+  else if (s->inStep && fabsf(diff) < STEPS_MIN_WATT / 2)
+    {
+      emit(s);
+      s->inStep = 0;
+    }
+}
+
+/******************************************************************************/
+/**
+ *
+ * STEPS
+ *
+ * Prints the signatures and the latest events, oldest first
+ *
+ *        | signature <id> <W> <times on> <times off> <on|off> |
+ *        | event <s since the epoch> <W> <signature id> |
+ *
+ ******************************************************************************/
+static int querySteps(void *ctx, FILE *out, int argc, char *argv[])
+{
+  StepsStruct *s = ctx;
+  int i;
+
+  (void)argc;
+  (void)argv;
+  for (i = 0; i < s->numSignatures; i++)
+    {
+      const StepSignatureStruct *sig = &s->signatures[i];
+      fprintf(out, "signature %d %.0f %u %u %s\n", i, sig->watt, sig->numOn, sig->numOff,
+              sig->lastOn ? "on" : "off");
+    }
+  for (i = 0; i < s->numEvents; i++)
+    {
+      const StepEventStruct *e = &s->events[(s->eventPos + STEPS_EVENTS - s->numEvents + i) % STEPS_EVENTS];
+      fprintf(out, "event %llu %+.0f %d\n", (unsigned long long)(e->ts / NS_PER_S),
+              e->watt, e->signature);
+    }
+  return 0;
+}
+
+void stepsRegisterQueries(StepsStruct *s)
+{
+  queryRegister("STEPS", "", querySteps, s);
+}
@@ -0,0 +1,91 @@
+/******************************************************************************/
+/**
+ * \file steps.h
+ *
+ * \brief Detects appliances switching on and off from the 1 s power series.
+ *
+ *        Two adjacent windows of STEPS_WINDOW seconds slide over the series
+ *        and a step is found where their means differ by more than
+ *        STEPS_MIN_WATT. The position with the largest difference is taken
+ *        as the switching time and its size as the appliance power.
+ *
+ *        Steps of similar size are clustered into signatures, so recurring
+ *        appliances get a stable id. Every second costs a constant amount
+ *        of work, a few additions and compares.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef STEPS_H
+#define STEPS_H
+
+#include <stdint.h>
+
+#define STEPS_WINDOW (10)
+#define STEPS_MIN_WATT (150.0)
+#define STEPS_SIGNATURES (16)
+#define STEPS_EVENTS (32)
+
+typedef struct
+{
+  uint64_t ts;       /* Time of the step, ns since the epoch */
+  float watt;        /* Size of the step, negative when switching off */
+  int16_t signature; /* Index into the signatures */
+} StepEventStruct;
+
+typedef struct
+{
+  float watt;        /* Mean size of the steps on */
+  uint32_t numOn;
+  uint32_t numOff;
+  uint64_t lastOn;   /* ns since the epoch, 0 when off */
+} StepSignatureStruct;
+
+typedef void (*StepEventFn)(void *ctx, const StepEventStruct *event);
+
+typedef struct
+{
+  float samples[2 * STEPS_WINDOW];   /* Ring of the last 1 s values */
+  uint64_t lastTs;
+  int pos;
+  int filled;
+  double sumOld, sumNew;             /* Sums of the older and newer window */
+
+  int inStep;                        /* Difference above the limit */
+  float bestDiff;
+  uint64_t bestTs;
+
+  StepSignatureStruct signatures[STEPS_SIGNATURES];
+  int numSignatures;
+  StepEventStruct events[STEPS_EVENTS];  /* Ring of the latest events */
+  int numEvents;
+  int eventPos;
+
+  StepEventFn onEvent;
+  void *ctx;
+} StepsStruct;
+
+void stepsInit(StepsStruct *s, StepEventFn onEvent, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Add a 1 s power value, emits an event when a step has been completed
+ *
+ * \param s, the detector
+ * \param ts, start of the second in ns
+ * \param watt, the average power of the second
+ * \return None
+ *
+ ******************************************************************************/
+void stepsPush(StepsStruct *s, uint64_t ts, float watt);
+
+/******************************************************************************/
+/**
+ *
+ * Add the STEPS query command
+ *
+ ******************************************************************************/
+void stepsRegisterQueries(StepsStruct *s);
+
+#endif
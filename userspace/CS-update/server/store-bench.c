@@ -0,0 +1,204 @@
+/******************************************************************************/
+/**
+ * \file store-bench.c
+ *
+ * \brief Compares the throughput of the storage engines, see store.h
+ *
+ *        A synthetic mix of pulses, 1 s rows, 15 min rows and events is
+ *        written to each engine in batches, as the store thread does, with
+ *        a sync every few batches. Run it on the target and on the disk the
+ *        site uses, the numbers depend on both.
+ *
+ *        | engine | records/s | us/batch | sync ms | bytes/record |
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "store.h"
+
+#define NS_PER_S (1000000000ULL)
+#define DEFAULT_RECORDS (1 << 18)
+#define DEFAULT_BATCH (64)
+#define DEFAULT_SYNC (100)
+
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+static void usage(void)
+{
+  printf("store-bench [-n records] [-b batch] [-s batches per sync] [-d dir]");
+  printf("\n");
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+/**
+ *
+ * About 3 kW: a pulse, or a 1 s row when no pulse is due, a quarter row
+ * every 900 s and an event now and then
+ *
+ ******************************************************************************/
+static void generate(StoreRecordStruct *recs, size_t n)
+{
+  uint64_t t = 1500000000ULL * NS_PER_S;
+  uint64_t second = t, nextPulse = t, quarter = t;
+  unsigned int seed = 1;
+  size_t i;
+
+  memset(recs, 0, n * sizeof(*recs));
+  for (i = 0; i < n; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      if (nextPulse < second + NS_PER_S)
+	{
+	  recs[i].file = STORE_PULSE;
+	  recs[i].ts = nextPulse;
+	  recs[i].missed = (seed >> 8) % 1000 == 0;
+	  nextPulse += 800000000ULL + (seed >> 8) % 800000000ULL;
+	}
+      else if (second >= quarter + 900 * NS_PER_S)
+	{
+	  recs[i].file = STORE_QUARTER;
+	  recs[i].ts = quarter;
+	  quarter += 900 * NS_PER_S;
+	  recs[i].power = 3000;
+	  recs[i].energy = 750;
+	}
+      else if ((seed >> 8) % 500 == 0)
+	{
+	  recs[i].file = STORE_EVENT;
+	  recs[i].ts = second;
+	  snprintf(recs[i].text, sizeof(recs[i].text), "step %+.0f %d", 1500.0, 3);
+	}
+      else
+	{
+	  recs[i].file = STORE_SECOND;
+	  recs[i].ts = second;
+	  recs[i].power = 2000 + (seed >> 8) % 2000;
+	  recs[i].energy = recs[i].power / 3600;
+	  second += NS_PER_S;
+	}
+    }
+}
+
+/* Size of the files an engine left behind, which are then removed */
+static long long removeFiles(const char *prefix)
+{
+  static const char *const suffixes[] =
+    {
+      "-1s.csv", "-15min.csv", "-events.log", "-pulses.log", ".db", ".db-wal", ".db-shm"
+    };
+  char name[256];
+  struct stat st;
+  long long bytes = 0;
+  size_t i;
+
+  for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    {
+      snprintf(name, sizeof(name), "%s%s", prefix, suffixes[i]);
+      if (stat(name, &st) != 0) continue;
+      bytes += st.st_size;
+      unlink(name);
+    }
+  return bytes;
+}
+
+static void run(const StoreEngineStruct *engine, const char *prefix,
+		const StoreRecordStruct *recs, size_t n, size_t batch, int syncEvery)
+{
+  double start, syncTime = 0, t;
+  size_t i, numBatches = 0, numSyncs = 0;
+  int fails = 0;
+  void *db;
+
+  removeFiles(prefix);
+  db = engine->open(prefix);
+  if (db == NULL) error("Failed to open engine");
+
+  start = now();
+  for (i = 0; i < n; i += batch)
+    {
+      if (engine->write(db, recs + i, (n - i < batch) ? n - i : batch) != 0) fails++;
+      if (++numBatches % syncEvery == 0)
+	{
+	  t = now();
+	  if (engine->sync(db) != 0) fails++;
+	  syncTime += now() - t;
+	  numSyncs++;
+	}
+    }
+  t = now();
+  if (engine->sync(db) != 0) fails++;
+  syncTime += now() - t;
+  numSyncs++;
+  t = now() - start;
+  engine->close(db);
+
+  printf("%-8s %10.0f records/s %8.1f us/batch %8.2f sync ms %6.1f bytes/record%s\n",
+	 engine->name, n / t, (t - syncTime) * 1e6 / numBatches, syncTime * 1e3 / numSyncs,
+	 (double)removeFiles(prefix) / n, fails ? " FAILED" : "");
+}
+
+int main(int argc, char *argv[])
+{
+  int32_t opt;
+  size_t n = DEFAULT_RECORDS;
+  size_t batch = DEFAULT_BATCH;
+  int syncEvery = DEFAULT_SYNC;
+  const char *dir = "/tmp";
+  char prefix[200];
+  StoreRecordStruct *recs;
+
+  while ((opt = getopt(argc, argv, "hn:b:s:d:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'n':
+	  n = strtoul(optarg, NULL, 0);
+	  break;
+	case 'b':
+	  batch = strtoul(optarg, NULL, 0);
+	  break;
+	case 's':
+	  syncEvery = atoi(optarg);
+	  break;
+	case 'd':
+	  dir = optarg;
+	  break;
+	case 'h':
+	  usage();
+	  return 0;
+	default:
+	  usage();
+	  error("Unrecognized input");
+	  break;
+	}
+    }
+  if (n < 1 || batch < 1 || syncEvery < 1) error("Bad arguments");
+
+  recs = malloc(n * sizeof(*recs));
+  if (!recs) error("malloc() Failed");
+  generate(recs, n);
+  snprintf(prefix, sizeof(prefix), "%s/store-bench-%d", dir, (int)getpid());
+
+  printf("%zu records in batches of %zu, sync every %d batches\n", n, batch, syncEvery);
+  run(&storeLogEngine, prefix, recs, n, batch, syncEvery);
+  run(&storeSqliteEngine, prefix, recs, n, batch, syncEvery);
+  return 0;
+}
@@ -0,0 +1,270 @@
+/******************************************************************************/
+/**
+ * \file store-log.c
+ *
+ * \brief The native storage engine, plain files appended to.
+ *
+ *        | <prefix>-1s.csv     | start, average W, Wh per second         |
+ *        | <prefix>-15min.csv  | start, average W, Wh per quarter        |
+ *        | <prefix>-events.log | s since the epoch, text                 |
+ *        | <prefix>-pulses.log | blocks of raw pulses                    |
+ *
+ *        Pulses are collected into blocks laid out like the blocks of the
+ *        pulse log, see pulselog.h, in native byte order:
+ *
+ *        | "WPLB" | uint32 n | int64 ts[n], ns | uint32 missed[n] |
+ *
+ *        A block is written when it is full or at a sync, so the blocks
+ *        hold PULSELOG_BLOCK_SIZE pulses or less.
+ *
+ *        The files are only appended to, so a corrected row, see
+ *        rollupAdjust(), is written again further down and the last row for
+ *        a start is the one that counts. Reading back sorts that out.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pulselog.h"
+#include "store.h"
+
+#define NS_PER_S (1000000000ULL)
+
+typedef struct
+{
+  FILE *files[STORE_FILES];
+  PulseLogBlockStruct block;
+} LogDbStruct;
+
+/* A row read back, seq in order of the file */
+typedef struct
+{
+  uint64_t start;
+  size_t seq;
+  double power;
+  double energy;
+} LogRowStruct;
+
+static const char *const suffixes[STORE_FILES] =
+  {
+    "-1s.csv", "-15min.csv", "-events.log", "-pulses.log"
+  };
+
+static void writeBlock(LogDbStruct *db)
+{
+  FILE *fd = db->files[STORE_PULSE];
+  uint32_t n = db->block.n;
+
+  if (n == 0) return;
+  db->block.n = 0;
+  if (fd == NULL) return;
+  fwrite("WPLB", 1, 4, fd);
+  fwrite(&n, sizeof(n), 1, fd);
+  fwrite(db->block.ts, sizeof(db->block.ts[0]), n, fd);
+  fwrite(db->block.missed, sizeof(db->block.missed[0]), n, fd);
+}
+
+static void *logOpen(const char *prefix)
+{
+  LogDbStruct *db = malloc(sizeof(*db));
+  char name[256];
+  int f;
+
+  if (db == NULL) return NULL;
+  for (f = 0; f < STORE_FILES; f++)
+    {
+      snprintf(name, sizeof(name), "%s%s", prefix, suffixes[f]);
+      db->files[f] = fopen(name, "a");
+    }
+  db->block.n = 0;
+  return db;
+}
+
+static int logWrite(void *arg, const StoreRecordStruct *recs, size_t n)
+{
+  LogDbStruct *db = arg;
+  const StoreRecordStruct *rec;
+  FILE *fd;
+  size_t i;
+  int f, ret = 0;
+
+  for (i = 0; i < n; i++)
+    {
+      rec = &recs[i];
+      fd = db->files[rec->file];
+      if (rec->file == STORE_PULSE)
+	{
+	  db->block.ts[db->block.n] = rec->ts;
+	  db->block.missed[db->block.n] = rec->missed;
+	  if (++db->block.n == PULSELOG_BLOCK_SIZE) writeBlock(db);
+	}
+      else if (fd == NULL)
+	{
+	  continue;
+	}
+      else if (rec->file == STORE_EVENT)
+	{
+	  fprintf(fd, "%llu %s\n", (unsigned long long)(rec->ts / NS_PER_S), rec->text);
+	}
+      else
+	{
+	  fprintf(fd, "%llu,%.1f,%.4f\n", (unsigned long long)(rec->ts / NS_PER_S),
+		  rec->power, rec->energy);
+	}
+    }
+
+  /* Rows show up in the files per batch */
+  for (f = 0; f < STORE_FILES; f++)
+    {
+      if (db->files[f] != NULL && fflush(db->files[f]) != 0) ret = -1;
+    }
+  return ret;
+}
+
+static int logSync(void *arg)
+{
+  LogDbStruct *db = arg;
+  int f, ret = 0;
+
+  writeBlock(db);
+  for (f = 0; f < STORE_FILES; f++)
+    {
+      if (db->files[f] == NULL) continue;
+      if (fflush(db->files[f]) != 0 || fsync(fileno(db->files[f])) != 0) ret = -1;
+    }
+  return ret;
+}
+
+static void logClose(void *arg)
+{
+  LogDbStruct *db = arg;
+  int f;
+
+  logSync(db);
+  for (f = 0; f < STORE_FILES; f++)
+    {
+      if (db->files[f] != NULL) fclose(db->files[f]);
+    }
+  free(db);
+}
+
+static FILE *openRead(const char *prefix, int file)
+{
+  char name[256];
+
+  snprintf(name, sizeof(name), "%s%s", prefix, suffixes[file]);
+  return fopen(name, "r");
+}
+
+static int compareRows(const void *a, const void *b)
+{
+  const LogRowStruct *x = a, *y = b;
+
+  if (x->start != y->start) return (x->start < y->start) ? -1 : 1;
+  return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+static int logRead(const char *prefix, int file, uint64_t from, uint64_t to, StoreReadFn fn, void *ctx)
+{
+  StoreRecordStruct rec;
+  LogRowStruct *rows = NULL, *more;
+  char line[STORE_TEXT + 32];
+  unsigned long long s;
+  size_t n = 0, size = 0, i;
+  int len, ok = 1, stop = 0;
+  FILE *fd;
+
+  fd = openRead(prefix, file);
+  if (fd == NULL) return -1;
+  memset(&rec, 0, sizeof(rec));
+  rec.file = file;
+  while (ok && !stop && fgets(line, sizeof(line), fd) != NULL)
+    {
+      /* The last line may be only partly written yet */
+      if (strchr(line, '\n') == NULL) break;
+      line[strcspn(line, "\n")] = '\0';
+
+      if (file == STORE_EVENT)
+	{
+	  if (sscanf(line, "%llu %n", &s, &len) != 1) continue;
+	  rec.ts = s * NS_PER_S;
+	  if (rec.ts < from || rec.ts >= to) continue;
+	  snprintf(rec.text, sizeof(rec.text), "%s", line + len);
+	  stop = fn(ctx, &rec);
+	  continue;
+	}
+
+      if (sscanf(line, "%llu,%lf,%lf", &s, &rec.power, &rec.energy) != 3) continue;
+      if (s * NS_PER_S < from || s * NS_PER_S >= to) continue;
+      if (n == size)
+	{
+	  size = (size == 0) ? 1024 : 2 * size;
+	  more = realloc(rows, size * sizeof(rows[0]));
+	  if (more == NULL)
+	    {
+	      ok = 0;
+	      break;
+	    }
+	  rows = more;
+	}
+      rows[n].start = s * NS_PER_S;
+      rows[n].seq = n;
+      rows[n].power = rec.power;
+      rows[n].energy = rec.energy;
+      n++;
+    }
+  if (ferror(fd)) ok = 0;
+  fclose(fd);
+
+  if (ok && n > 0) qsort(rows, n, sizeof(rows[0]), compareRows);
+  for (i = 0; ok && !stop && i < n; i++)
+    {
+      if (i + 1 < n && rows[i + 1].start == rows[i].start) continue;
+      rec.ts = rows[i].start;
+      rec.power = rows[i].power;
+      rec.energy = rows[i].energy;
+      stop = fn(ctx, &rec);
+    }
+  free(rows);
+  return ok ? 0 : -1;
+}
+
+static int logReadPulses(const char *prefix, uint64_t from, uint64_t to, StorePulsesFn fn, void *ctx)
+{
+  PulseLogBlockStruct *block = malloc(sizeof(*block));
+  char magic[4];
+  uint32_t n;
+  FILE *fd;
+  int ok;
+
+  if (block == NULL) return -1;
+  fd = openRead(prefix, STORE_PULSE);
+  if (fd == NULL)
+    {
+      free(block);
+      return -1;
+    }
+
+  /* A short block at the end is still being written */
+  while (fread(magic, 1, 4, fd) == 4 && memcmp(magic, "WPLB", 4) == 0 &&
+	 fread(&n, sizeof(n), 1, fd) == 1 && n > 0 && n <= PULSELOG_BLOCK_SIZE &&
+	 fread(block->ts, sizeof(block->ts[0]), n, fd) == n &&
+	 fread(block->missed, sizeof(block->missed[0]), n, fd) == n)
+    {
+      block->n = n;
+      if ((uint64_t)block->ts[n - 1] < from) continue;
+      if ((uint64_t)block->ts[0] >= to) break;
+      if (fn(ctx, block) != 0) break;
+    }
+  ok = !ferror(fd);
+  fclose(fd);
+  free(block);
+  return ok ? 0 : -1;
+}
+
+const StoreEngineStruct storeLogEngine =
+  {
+    "log", logOpen, logWrite, logSync, logClose, logRead, logReadPulses
+  };
@@ -0,0 +1,256 @@
+/******************************************************************************/
+/**
+ * \file store-sqlite.c
+ *
+ * \brief SQLite storage engine, everything in one database file.
+ *
+ *        | power_1s    | start INTEGER, s | power REAL, W | energy REAL, Wh |
+ *        | power_15min | start INTEGER, s | power REAL, W | energy REAL, Wh |
+ *        | events      | ts INTEGER, s    | text TEXT                       |
+ *        | pulses      | ts INTEGER, ns   | missed INTEGER                  |
+ *
+ *        The database is in WAL mode with synchronous=NORMAL, so it can be
+ *        read with the sqlite3 shell while the server writes. Each batch is
+ *        one transaction of prepared inserts, and the sync every
+ *        STORE_SYNC_S checkpoints the WAL, which is when it reaches the disk.
+ *
+ *        | sqlite3 /tmp/power.db "SELECT * FROM power_15min" |
+ *
+ *        Reading back opens its own read-only connection, which WAL mode
+ *        lets run alongside the writes. A corrected row replaces the one
+ *        stored before it.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <sqlite3.h>
+#include <stdlib.h>
+#include <string.h>
+#include "store.h"
+
+#define NS_PER_S (1000000000ULL)
+
+typedef struct
+{
+  sqlite3 *db;
+  sqlite3_stmt *insert[STORE_FILES];
+  sqlite3_stmt *begin;
+  sqlite3_stmt *commit;
+  sqlite3_stmt *rollback;
+} SqliteDbStruct;
+
+static const char schema[] =
+  "PRAGMA journal_mode=WAL;"
+  "PRAGMA synchronous=NORMAL;"
+  "PRAGMA journal_size_limit=1048576;"
+  "CREATE TABLE IF NOT EXISTS power_1s (start INTEGER PRIMARY KEY, power REAL, energy REAL);"
+  "CREATE TABLE IF NOT EXISTS power_15min (start INTEGER PRIMARY KEY, power REAL, energy REAL);"
+  "CREATE TABLE IF NOT EXISTS events (ts INTEGER, text TEXT);"
+  "CREATE TABLE IF NOT EXISTS pulses (ts INTEGER PRIMARY KEY, missed INTEGER);";
+
+static const char *const inserts[STORE_FILES] =
+  {
+    "INSERT OR REPLACE INTO power_1s VALUES (?, ?, ?)",
+    "INSERT OR REPLACE INTO power_15min VALUES (?, ?, ?)",
+    "INSERT INTO events VALUES (?, ?)",
+    "INSERT OR REPLACE INTO pulses VALUES (?, ?)"
+  };
+
+/* Read back, the range bound as ?1 and ?2, in s for series and events */
+static const char *const selects[STORE_FILES] =
+  {
+    "SELECT start, power, energy FROM power_1s WHERE start >= ?1 AND start < ?2 ORDER BY start",
+    "SELECT start, power, energy FROM power_15min WHERE start >= ?1 AND start < ?2 ORDER BY start",
+    "SELECT ts, text FROM events WHERE ts >= ?1 AND ts < ?2 ORDER BY rowid",
+    /* The pulse before the range too, for the interval of the first one */
+    "SELECT ts, missed FROM pulses WHERE ts >= coalesce((SELECT max(ts) FROM pulses WHERE ts < ?1), ?1)"
+    " AND ts < ?2 ORDER BY ts"
+  };
+
+static int prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt)
+{
+  return (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL) == SQLITE_OK) ? 0 : -1;
+}
+
+static int run(sqlite3_stmt *stmt)
+{
+  int rc = sqlite3_step(stmt);
+
+  sqlite3_reset(stmt);
+  return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+static void sqliteClose(void *arg)
+{
+  SqliteDbStruct *d = arg;
+  int f;
+
+  for (f = 0; f < STORE_FILES; f++) sqlite3_finalize(d->insert[f]);
+  sqlite3_finalize(d->begin);
+  sqlite3_finalize(d->commit);
+  sqlite3_finalize(d->rollback);
+  sqlite3_close(d->db);
+  free(d);
+}
+
+static void *sqliteOpen(const char *prefix)
+{
+  SqliteDbStruct *d = calloc(1, sizeof(*d));
+  char name[256];
+  int f, ok;
+
+  if (d == NULL) return NULL;
+  snprintf(name, sizeof(name), "%s.db", prefix);
+  ok = (sqlite3_open(name, &d->db) == SQLITE_OK);
+  if (ok) sqlite3_busy_timeout(d->db, 1000);
+  ok = ok && (sqlite3_exec(d->db, schema, NULL, NULL, NULL) == SQLITE_OK);
+  for (f = 0; f < STORE_FILES; f++)
+    {
+      ok = ok && (prepare(d->db, inserts[f], &d->insert[f]) == 0);
+    }
+  ok = ok && (prepare(d->db, "BEGIN", &d->begin) == 0);
+  ok = ok && (prepare(d->db, "COMMIT", &d->commit) == 0);
+  ok = ok && (prepare(d->db, "ROLLBACK", &d->rollback) == 0);
+  if (!ok)
+    {
+      sqliteClose(d);
+      return NULL;
+    }
+  return d;
+}
+
+static int sqliteWrite(void *arg, const StoreRecordStruct *recs, size_t n)
+{
+  SqliteDbStruct *d = arg;
+  sqlite3_stmt *stmt;
+  size_t i;
+
+  if (run(d->begin) != 0) return -1;
+  for (i = 0; i < n; i++)
+    {
+      stmt = d->insert[recs[i].file];
+      if (recs[i].file == STORE_PULSE)
+	{
+	  sqlite3_bind_int64(stmt, 1, recs[i].ts);
+	  sqlite3_bind_int64(stmt, 2, recs[i].missed);
+	}
+      else if (recs[i].file == STORE_EVENT)
+	{
+	  sqlite3_bind_int64(stmt, 1, recs[i].ts / NS_PER_S);
+	  sqlite3_bind_text(stmt, 2, recs[i].text, -1, SQLITE_STATIC);
+	}
+      else
+	{
+	  sqlite3_bind_int64(stmt, 1, recs[i].ts / NS_PER_S);
+	  sqlite3_bind_double(stmt, 2, recs[i].power);
+	  sqlite3_bind_double(stmt, 3, recs[i].energy);
+	}
+      if (run(stmt) != 0)
+	{
+	  run(d->rollback);
+	  return -1;
+	}
+    }
+  return run(d->commit);
+}
+
+static int sqliteSync(void *arg)
+{
+  SqliteDbStruct *d = arg;
+
+  return (sqlite3_wal_checkpoint_v2(d->db, NULL, SQLITE_CHECKPOINT_PASSIVE, NULL, NULL) == SQLITE_OK) ? 0 : -1;
+}
+
+static int openRead(const char *prefix, int file, uint64_t from, uint64_t to,
+		    sqlite3 **db, sqlite3_stmt **stmt)
+{
+  char name[256];
+  int ok;
+
+  snprintf(name, sizeof(name), "%s.db", prefix);
+  *stmt = NULL;
+  ok = (sqlite3_open_v2(name, db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK);
+  if (ok) sqlite3_busy_timeout(*db, 1000);
+  ok = ok && (sqlite3_prepare_v2(*db, selects[file], -1, stmt, NULL) == SQLITE_OK);
+  if (!ok)
+    {
+      sqlite3_finalize(*stmt);
+      sqlite3_close(*db);
+      return -1;
+    }
+  if (file != STORE_PULSE)
+    {
+      from = (from + NS_PER_S - 1) / NS_PER_S;
+      to = (to + NS_PER_S - 1) / NS_PER_S;
+    }
+  sqlite3_bind_int64(*stmt, 1, from);
+  sqlite3_bind_int64(*stmt, 2, to);
+  return 0;
+}
+
+static int sqliteRead(const char *prefix, int file, uint64_t from, uint64_t to, StoreReadFn fn, void *ctx)
+{
+  StoreRecordStruct rec;
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
+  const unsigned char *text;
+  int rc, stop = 0;
+
+  if (openRead(prefix, file, from, to, &db, &stmt) != 0) return -1;
+  memset(&rec, 0, sizeof(rec));
+  rec.file = file;
+  while (!stop && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+      rec.ts = sqlite3_column_int64(stmt, 0) * NS_PER_S;
+      if (file == STORE_EVENT)
+	{
+	  text = sqlite3_column_text(stmt, 1);
+	  snprintf(rec.text, sizeof(rec.text), "%s", (text != NULL) ? (const char *)text : "");
+	}
+      else
+	{
+	  rec.power = sqlite3_column_double(stmt, 1);
+	  rec.energy = sqlite3_column_double(stmt, 2);
+	}
+      stop = fn(ctx, &rec);
+    }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return (stop || rc == SQLITE_DONE) ? 0 : -1;
+}
+
+static int sqliteReadPulses(const char *prefix, uint64_t from, uint64_t to, StorePulsesFn fn, void *ctx)
+{
+  PulseLogBlockStruct *block = malloc(sizeof(*block));
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
+  int rc, stop = 0;
+
+  if (block == NULL) return -1;
+  if (openRead(prefix, STORE_PULSE, from, to, &db, &stmt) != 0)
+    {
+      free(block);
+      return -1;
+    }
+  block->n = 0;
+  while (!stop && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+      block->ts[block->n] = sqlite3_column_int64(stmt, 0);
+      block->missed[block->n] = sqlite3_column_int64(stmt, 1);
+      if (++block->n == PULSELOG_BLOCK_SIZE)
+	{
+	  stop = fn(ctx, block);
+	  block->n = 0;
+	}
+    }
+  if (!stop && rc == SQLITE_DONE && block->n > 0) fn(ctx, block);
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  free(block);
+  return (stop || rc == SQLITE_DONE) ? 0 : -1;
+}
+
+const StoreEngineStruct storeSqliteEngine =
+  {
+    "sqlite", sqliteOpen, sqliteWrite, sqliteSync, sqliteClose, sqliteRead, sqliteReadPulses
+  };
@@ -0,0 +1,129 @@
+/******************************************************************************/
+/**
+ * \file store.c
+ *
+ * \brief Store stage, see store.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "probes.h"
+#include "store.h"
+
+#define BATCH (64)
+
+static void *storeThread(void *arg)
+{
+  StoreStruct *s = arg;
+  StoreRecordStruct recs[BATCH];
+  time_t lastSync = time(NULL);
+  size_t n;
+  int dirty = 0;
+
+  for (;;)
+    {
+      spscWait(&s->queue, 1000);
+      while ((n = spscGet(&s->queue, recs, BATCH)) > 0)
+	{
+	  PROBE1(store__write, n);
+	  s->engine->write(s->db, recs, n);
+	  dirty = 1;
+	}
+
+      /* Batches are visible as soon as they are written, on disk per sync */
+      if (dirty && time(NULL) - lastSync >= STORE_SYNC_S)
+	{
+	  struct timespec t0, t1;
+
+	  clock_gettime(CLOCK_MONOTONIC, &t0);
+	  s->engine->sync(s->db);
+	  clock_gettime(CLOCK_MONOTONIC, &t1);
+	  PROBE1(store__sync, (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec));
+	  lastSync = time(NULL);
+	  dirty = 0;
+	}
+    }
+  return NULL;
+}
+
+const StoreEngineStruct *storeEngine(const char *name)
+{
+  static const StoreEngineStruct *const engines[] = { &storeLogEngine, &storeSqliteEngine };
+  size_t i;
+
+  for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+    {
+      if (strcmp(engines[i]->name, name) == 0) return engines[i];
+    }
+  return NULL;
+}
+
+int storeStart(StoreStruct *s, const StoreEngineStruct *engine, const char *prefix)
+{
+  if (spscInit(&s->queue, "store", sizeof(StoreRecordStruct), STORE_QUEUE) != 0) return -1;
+  s->engine = engine;
+  s->prefix = prefix;
+  s->db = engine->open(prefix);
+  if (s->db == NULL) return -1;
+  return (pthread_create(&s->thread, NULL, storeThread, s) == 0) ? 0 : -1;
+}
+
+void storeRow(StoreStruct *s, int file, uint64_t start, double power, double energy)
+{
+  StoreRecordStruct rec;
+
+  rec.file = file;
+  rec.ts = start;
+  rec.power = power;
+  rec.energy = energy;
+  rec.missed = 0;
+  rec.text[0] = '\0';
+  spscPut(&s->queue, &rec);
+}
+
+void storePulse(StoreStruct *s, uint64_t ts, uint32_t missed)
+{
+  StoreRecordStruct rec;
+
+  rec.file = STORE_PULSE;
+  rec.ts = ts;
+  rec.power = 0;
+  rec.energy = 0;
+  rec.missed = missed;
+  rec.text[0] = '\0';
+  spscPut(&s->queue, &rec);
+}
+
+void storeEvent(StoreStruct *s, uint64_t ts, const char *format, ...)
+{
+  StoreRecordStruct rec;
+  va_list ap;
+
+  rec.file = STORE_EVENT;
+  rec.ts = ts;
+  rec.power = 0;
+  rec.energy = 0;
+  rec.missed = 0;
+  va_start(ap, format);
+  vsnprintf(rec.text, sizeof(rec.text), format, ap);
+  va_end(ap);
+  spscPut(&s->queue, &rec);
+}
+
+void storeFlush(StoreStruct *s)
+{
+  spscFlush(&s->queue);
+}
+
+int storeRead(StoreStruct *s, int file, uint64_t from, uint64_t to, StoreReadFn fn, void *ctx)
+{
+  return s->engine->read(s->prefix, file, from, to, fn, ctx);
+}
+
+int storeReadPulses(StoreStruct *s, uint64_t from, uint64_t to, StorePulsesFn fn, void *ctx)
+{
+  return s->engine->readPulses(s->prefix, from, to, fn, ctx);
+}
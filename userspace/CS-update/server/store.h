@@ -0,0 +1,201 @@
+/******************************************************************************/
+/**
+ * \file store.h
+ *
+ * \brief Store stage, writes pulses, series and events in its own thread.
+ *
+ *        The compute stage hands over pulses, rows and event lines through
+ *        an SPSC queue. The store thread passes them on to a storage engine
+ *        a batch at a time and has the engine sync to disk every
+ *        STORE_SYNC_S, so a slow disk only grows the queue and never holds
+ *        up pulses, queries or publishing.
+ *
+ *        | log    | CSV series, events log and a binary pulse block log,   |
+ *        |        | see store-log.c                                        |
+ *        | sqlite | one SQLite database in WAL mode, see store-sqlite.c    |
+ *
+ *        Both are given a path prefix, /tmp/power gives /tmp/power-1s.csv
+ *        and so on for the log engine and /tmp/power.db for SQLite.
+ *        store-bench measures the two against each other. What they have
+ *        stored is read back with storeRead() and storeReadPulses(), from
+ *        any thread.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef STORE_H
+#define STORE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pulselog.h"
+#include "spsc.h"
+
+/* Room for more than an hour of 1 s rows while the disk is stalled */
+#define STORE_QUEUE (8192)
+#define STORE_SYNC_S (10)
+#define STORE_TEXT (64)
+
+typedef enum
+{
+  STORE_SECOND,
+  STORE_QUARTER,
+  STORE_EVENT,
+  STORE_PULSE,
+  STORE_FILES
+} StoreFile;
+
+typedef struct
+{
+  int file;                /* StoreFile */
+  uint64_t ts;             /* Row start, event or pulse time, ns since the epoch */
+  double power;            /* W */
+  double energy;           /* Wh */
+  uint32_t missed;         /* Pulses missed before this one */
+  char text[STORE_TEXT];   /* Event line after the time */
+} StoreRecordStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Called with each stored row or event read back, rows in order of start
+ * and events in the order they were stored
+ *
+ * \return 0 to go on, otherwise reading stops
+ *
+ ******************************************************************************/
+typedef int (*StoreReadFn)(void *ctx, const StoreRecordStruct *rec);
+
+/******************************************************************************/
+/**
+ *
+ * Called with stored pulses a block at a time, in time order. A block can
+ * start with pulses before the range asked for, so the first pulse in it
+ * has an interval, see pulseLogRange().
+ *
+ * \return 0 to go on, otherwise reading stops
+ *
+ ******************************************************************************/
+typedef int (*StorePulsesFn)(void *ctx, const PulseLogBlockStruct *block);
+
+/* A storage engine, written to one batch of records at a time. The readers
+   open the storage on their own, so any thread can read while the store
+   thread writes. */
+typedef struct
+{
+  const char *name;
+  void *(*open)(const char *prefix);
+  int (*write)(void *db, const StoreRecordStruct *recs, size_t n);
+  int (*sync)(void *db);
+  void (*close)(void *db);
+  int (*read)(const char *prefix, int file, uint64_t from, uint64_t to, StoreReadFn fn, void *ctx);
+  int (*readPulses)(const char *prefix, uint64_t from, uint64_t to, StorePulsesFn fn, void *ctx);
+} StoreEngineStruct;
+
+extern const StoreEngineStruct storeLogEngine;
+extern const StoreEngineStruct storeSqliteEngine;
+
+typedef struct
+{
+  SpscStruct queue;
+  const StoreEngineStruct *engine;
+  void *db;
+  const char *prefix;
+  pthread_t thread;
+} StoreStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Look up a storage engine by name
+ *
+ * \param name, "log" or "sqlite"
+ * \return the engine, NULL if there is no such engine
+ *
+ ******************************************************************************/
+const StoreEngineStruct *storeEngine(const char *name);
+
+/******************************************************************************/
+/**
+ *
+ * Open the storage and start the store thread
+ *
+ * \param s, the store
+ * \param engine, the storage engine
+ * \param prefix, path prefix of the files the engine writes
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int storeStart(StoreStruct *s, const StoreEngineStruct *engine, const char *prefix);
+
+/******************************************************************************/
+/**
+ *
+ * Queue a series row
+ *
+ *        | start, s since the epoch | average W | Wh |
+ *
+ * \param s, the store
+ * \param file, STORE_SECOND or STORE_QUARTER
+ * \param start, start of the period in ns
+ * \param power, average power in W
+ * \param energy, energy in Wh
+ * \return None
+ *
+ ******************************************************************************/
+void storeRow(StoreStruct *s, int file, uint64_t start, double power, double energy);
+
+/******************************************************************************/
+/**
+ *
+ * Queue a raw pulse
+ *
+ ******************************************************************************/
+void storePulse(StoreStruct *s, uint64_t ts, uint32_t missed);
+
+/******************************************************************************/
+/**
+ *
+ * Queue an event line, printf style
+ *
+ *        | s since the epoch | text |
+ *
+ ******************************************************************************/
+void storeEvent(StoreStruct *s, uint64_t ts, const char *format, ...)
+  __attribute__((format(printf, 3, 4)));
+
+/******************************************************************************/
+/**
+ *
+ * Hand everything queued since the last call over to the store thread
+ *
+ ******************************************************************************/
+void storeFlush(StoreStruct *s);
+
+/******************************************************************************/
+/**
+ *
+ * Read back stored rows or events in [from, to). What the store thread has
+ * written is there, pulses once they are synced, see STORE_SYNC_S.
+ *
+ * \param s, the store
+ * \param file, STORE_SECOND, STORE_QUARTER or STORE_EVENT
+ * \param from, start in ns
+ * \param to, end in ns
+ * \param fn, called with each row or event
+ * \param ctx, passed to fn
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int storeRead(StoreStruct *s, int file, uint64_t from, uint64_t to, StoreReadFn fn, void *ctx);
+
+/******************************************************************************/
+/**
+ *
+ * Read back stored pulses in [from, to), see storeRead()
+ *
+ ******************************************************************************/
+int storeReadPulses(StoreStruct *s, uint64_t from, uint64_t to, StorePulsesFn fn, void *ctx);
+
+#endif
@@ -0,0 +1,294 @@
+/******************************************************************************/
+/**
+ * \file subscribe.c
+ *
+ * \brief Pushes live values to subscribers, see subscribe.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "query.h"
+#include "subscribe.h"
+
+#define NS_PER_S (1000000000ULL)
+
+int subscribeInit(SubscribeStruct *s)
+{
+  s->numSubs = 0;
+  s->lastTick = time(NULL);
+  return spscInit(&s->added, "subscribe", sizeof(SubscriberStruct), SUBSCRIBE_MAX);
+}
+
+static uint64_t nsOf(const struct timespec *t)
+{
+  return (uint64_t)t->tv_sec * NS_PER_S + t->tv_nsec;
+}
+
+/* CLOCK_MONOTONIC at a given CLOCK_REALTIME, valid unless the clock stepped in between */
+static uint64_t monoOf(uint64_t real)
+{
+  struct timespec r, m;
+
+  clock_gettime(CLOCK_REALTIME, &r);
+  clock_gettime(CLOCK_MONOTONIC, &m);
+  return real - nsOf(&r) + nsOf(&m);
+}
+
+static void drop(SubscribeStruct *s, int i)
+{
+  close(s->subs[i].fd);
+  s->subs[i] = s->subs[--s->numSubs];
+}
+
+/******************************************************************************/
+/**
+ *
+ * Send a line to every subscriber, or only to those that want TRACE lines,
+ * one that cannot take all of it at once is dropped so no subscriber ever
+ * gets half a line
+ *
+ ******************************************************************************/
+static void sendAll(SubscribeStruct *s, const char *line, int len, int traced)
+{
+  int i = 0;
+
+  while (i < s->numSubs)
+    {
+      if (traced && !s->subs[i].trace) i++;
+      else if (send(s->subs[i].fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len) drop(s, i);
+      else i++;
+    }
+}
+
+static void adopt(SubscribeStruct *s)
+{
+  static const char ok[] = "OK SUBSCRIBED\n";
+  static const char full[] = "ERR too many subscribers\n";
+  SubscriberStruct sub;
+  int on = 1;
+
+  while (spscGet(&s->added, &sub, 1) == 1)
+    {
+      if (s->numSubs == SUBSCRIBE_MAX)
+	{
+	  send(sub.fd, full, sizeof(full) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+	  close(sub.fd);
+	  continue;
+	}
+      if (send(sub.fd, ok, sizeof(ok) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(ok) - 1)
+	{
+	  close(sub.fd);
+	  continue;
+	}
+      /* Replies to SYNC must not wait on Nagle for the last LIVE to be acked */
+      setsockopt(sub.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      setsockopt(sub.fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+      s->subs[s->numSubs++] = sub;
+    }
+}
+
+/******************************************************************************/
+/**
+ *
+ * Answer a request line from a subscriber
+ *
+ * \param sub, the subscriber
+ * \param line, the request
+ * \param arrived, CLOCK_REALTIME when the kernel received it
+ * \return 0 if successful, -1 if the subscriber should be dropped
+ *
+ ******************************************************************************/
+static int request(SubscriberStruct *sub, const char *line, uint64_t arrived)
+{
+  unsigned long long t1;
+  struct timespec now;
+  char reply[SUBSCRIBE_LINE + 64];
+  int len;
+
+  if (sscanf(line, "SYNC %llu", &t1) != 1) return 0;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  len = snprintf(reply, sizeof(reply), "SYNC %llu %llu %llu\n", t1,
+		 (unsigned long long)monoOf(arrived), (unsigned long long)nsOf(&now));
+  return (send(sub->fd, reply, len, MSG_NOSIGNAL | MSG_DONTWAIT) == len) ? 0 : -1;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Read what a subscriber sent, with the kernel's time of arrival
+ *
+ * \return 0 if successful, -1 if the subscriber should be dropped
+ *
+ ******************************************************************************/
+static int receive(SubscriberStruct *sub)
+{
+  char control[CMSG_SPACE(sizeof(struct timespec))];
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  uint64_t arrived;
+  char *start, *nl;
+  ssize_t r;
+
+  for (;;)
+    {
+      iov.iov_base = sub->buf + sub->n;
+      iov.iov_len = sizeof(sub->buf) - sub->n;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      r = recvmsg(sub->fd, &msg, MSG_DONTWAIT);
+      if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+      if (r <= 0) return -1;
+
+      arrived = 0;
+      for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+	  if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+	    {
+	      struct timespec ts;
+
+	      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+	      arrived = nsOf(&ts);
+	    }
+	}
+      if (arrived == 0)
+	{
+	  struct timespec now;
+
+	  clock_gettime(CLOCK_REALTIME, &now);
+	  arrived = nsOf(&now);
+	}
+
+      sub->n += r;
+      start = sub->buf;
+      while ((nl = memchr(start, '\n', sub->buf + sub->n - start)) != NULL)
+	{
+	  *nl = '\0';
+	  if (request(sub, start, arrived) != 0) return -1;
+	  start = nl + 1;
+	}
+      sub->n -= start - sub->buf;
+      memmove(sub->buf, start, sub->n);
+      if (sub->n == sizeof(sub->buf)) return -1;
+    }
+}
+
+/******************************************************************************/
+/**
+ *
+ * Send a live line, and its trace to those that want it
+ *
+ ******************************************************************************/
+static void sendLive(SubscribeStruct *s, const PublishRecordStruct *rec)
+{
+  TraceStruct trace = rec->trace;
+  char line[160];
+  int len, hop;
+
+  traceStamp(&trace, TRACE_SEND);
+  len = snprintf(line, sizeof(line), "LIVE %llu %.1f %.4f %llu\n",
+		 (unsigned long long)rec->ts, rec->power, rec->energy,
+		 (unsigned long long)monoOf(rec->ts));
+  sendAll(s, line, len, 0);
+  if (trace.at[TRACE_EDGE] == 0) return;
+
+  len = snprintf(line, sizeof(line), "TRACE %llu", (unsigned long long)rec->ts);
+  for (hop = 0; hop < TRACE_HOPS; hop++)
+    {
+      len += snprintf(line + len, sizeof(line) - len, " %llu",
+		      (unsigned long long)monoOf(trace.at[hop]));
+    }
+  len += snprintf(line + len, sizeof(line) - len, "\n");
+  sendAll(s, line, len, 1);
+}
+
+void subscribeSink(void *ctx, const PublishRecordStruct *rec)
+{
+  SubscribeStruct *s = ctx;
+  char line[PUBLISH_TEXT + 48];
+  struct timespec now;
+  int i, len = 0;
+
+  adopt(s);
+  if (s->numSubs == 0) return;
+
+  switch (rec->type)
+    {
+    case PUBLISH_LIVE:
+      sendLive(s, rec);
+      return;
+    case PUBLISH_ROW:
+      len = snprintf(line, sizeof(line), "ROW %llu %.1f %.4f\n",
+		     (unsigned long long)rec->ts, rec->power, rec->energy);
+      break;
+    case PUBLISH_ALERT:
+      len = snprintf(line, sizeof(line), "ALERT %llu %s\n", (unsigned long long)rec->ts, rec->text);
+      break;
+    case PUBLISH_TICK:
+      /* Requests are stamped on arrival, so reading them a tick late is fine */
+      i = 0;
+      while (i < s->numSubs)
+	{
+	  if (receive(&s->subs[i]) != 0) drop(s, i);
+	  else i++;
+	}
+      clock_gettime(CLOCK_REALTIME, &now);
+      if (now.tv_sec - s->lastTick < SUBSCRIBE_KEEPALIVE_S) return;
+      s->lastTick = now.tv_sec;
+      len = snprintf(line, sizeof(line), "TICK %llu %llu\n", (unsigned long long)nsOf(&now),
+		     (unsigned long long)monoOf(nsOf(&now)));
+      break;
+    default:
+      return;
+    }
+  if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+  sendAll(s, line, len, 0);
+}
+
+/******************************************************************************/
+/**
+ *
+ * SUBSCRIBE [TRACE]
+ *
+ * The connection is handed over to the publish thread, which answers
+ *
+ ******************************************************************************/
+static int querySubscribe(void *ctx, FILE *out, int argc, char *argv[])
+{
+  SubscribeStruct *s = ctx;
+  SubscriberStruct sub;
+
+  sub.trace = 0;
+  sub.n = 0;
+  if (argc > 1)
+    {
+      if (strcasecmp(argv[1], "TRACE") != 0) return -1;
+      sub.trace = 1;
+    }
+  fflush(out);
+  sub.fd = dup(fileno(out));
+  if (sub.fd < 0 || spscPut(&s->added, &sub) != 0)
+    {
+      if (sub.fd >= 0) close(sub.fd);
+      fprintf(out, "ERR busy\n");
+      return 0;
+    }
+  spscFlush(&s->added);
+  return 0;
+}
+
+void subscribeRegisterQueries(SubscribeStruct *s)
+{
+  queryRegisterDirect("SUBSCRIBE", "[TRACE]", querySubscribe, s);
+}
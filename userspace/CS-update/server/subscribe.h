@@ -0,0 +1,98 @@
+/******************************************************************************/
+/**
+ * \file subscribe.h
+ *
+ * \brief Pushes live values to subscribers, such as the collector.
+ *
+ *        | SUBSCRIBE [TRACE] |
+ *
+ *        on QUERY_PORT keeps the connection open, and the publish thread
+ *        writes a line per published record to it until the subscriber
+ *        goes away:
+ *
+ *        | OK SUBSCRIBED                  | once                          |
+ *        | LIVE <ns> <W> <Wh> <mono ns>   | per pulse, total energy       |
+ *        | ROW <start ns> <W> <Wh>        | per 15 minute rollup row      |
+ *        | ALERT <ns> <text>              | per alert                     |
+ *        | TICK <ns> <mono ns>            | every SUBSCRIBE_KEEPALIVE_S   |
+ *        | TRACE <ns> <edge> <read> <compute> <publish> <send> |            |
+ *        |                                | after LIVE, with TRACE        |
+ *
+ *        Times are CLOCK_REALTIME, and the same time on CLOCK_MONOTONIC,
+ *        which never steps, where there is a mono field. A subscriber can
+ *        measure how this clock relates to its own by sending
+ *
+ *        | SYNC <t1>\n |
+ *
+ *        with t1 taken from its own clock, which is answered with
+ *
+ *        | SYNC <t1> <t2> <t3> |
+ *
+ *        t2 being when the request arrived, stamped by the kernel, and t3
+ *        when the answer was sent, both CLOCK_MONOTONIC. This is the NTP
+ *        exchange, the subscriber notes t4 on arrival.
+ *
+ *        The TRACE line has the hops of the pulse behind the LIVE line
+ *        before it, see trace.h, in CLOCK_MONOTONIC so that they can be
+ *        compared with the subscriber's clock through SYNC.
+ *
+ *        A subscriber that does not keep up is disconnected rather than
+ *        buffered for, it is expected to subscribe again.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef SUBSCRIBE_H
+#define SUBSCRIBE_H
+
+#include <time.h>
+#include "publish.h"
+#include "spsc.h"
+
+#define SUBSCRIBE_MAX (8)
+#define SUBSCRIBE_KEEPALIVE_S (5)
+#define SUBSCRIBE_LINE (64)
+
+typedef struct
+{
+  int fd;
+  int trace;                 /* Wants TRACE lines */
+  size_t n;                  /* Bytes of a request line in buf */
+  char buf[SUBSCRIBE_LINE];
+} SubscriberStruct;
+
+typedef struct
+{
+  SpscStruct added;          /* Subscribers from SUBSCRIBE to adopt */
+  SubscriberStruct subs[SUBSCRIBE_MAX];  /* Owned by the publish thread */
+  int numSubs;
+  time_t lastTick;
+} SubscribeStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Set up, before publishStart()
+ *
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int subscribeInit(SubscribeStruct *s);
+
+/******************************************************************************/
+/**
+ *
+ * Publish sink writing to the subscribers, ctx is the SubscribeStruct
+ *
+ ******************************************************************************/
+void subscribeSink(void *ctx, const PublishRecordStruct *rec);
+
+/******************************************************************************/
+/**
+ *
+ * Add the SUBSCRIBE query command
+ *
+ ******************************************************************************/
+void subscribeRegisterQueries(SubscribeStruct *s);
+
+#endif
@@ -0,0 +1,218 @@
+/******************************************************************************/
+/**
+ * \file tariff.c
+ *
+ * \brief Time-of-use tariff, see tariff.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "query.h"
+#include "tariff.h"
+
+#define NS_PER_S (1000000000ULL)
+#define SLOT_NS (15 * 60 * NS_PER_S)
+#define MAX_LINE (128)
+
+/******************************************************************************/
+/**
+ *
+ * Parse "hh:mm" on a quarter into a slot number, 24:00 gives TARIFF_SLOTS
+ *
+ * \return the slot, or -1 if invalid
+ *
+ ******************************************************************************/
+static int parseSlot(int h, int m)
+{
+  if (h < 0 || m < 0 || m > 59 || m % 15 != 0) return -1;
+  if (h * 4 + m / 15 > TARIFF_SLOTS) return -1;
+  return h * 4 + m / 15;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Add one line of a tariff file, comments already cut off
+ *
+ * \return 0 if successful or empty, -1 on errors
+ *
+ ******************************************************************************/
+static int parseLine(TariffStruct *t, const char *buf)
+{
+  char day[16];
+  int h1, m1, h2, m2, y, mo, d, from, to, type, i;
+  double price;
+
+  if (sscanf(buf, "%15s", day) != 1) return 0;
+
+  if (strcmp(day, "holiday") == 0)
+    {
+      if (sscanf(buf, "%*s %d-%d-%d", &y, &mo, &d) != 3 ||
+	  t->numHolidays == TARIFF_MAX_HOLIDAYS) return -1;
+      t->holidays[t->numHolidays++] = y * 10000 + mo * 100 + d;
+      return 0;
+    }
+
+  if (strcmp(day, "weekday") == 0) type = TARIFF_WEEKDAY;
+  else if (strcmp(day, "weekend") == 0) type = TARIFF_WEEKEND;
+  else return -1;
+  if (sscanf(buf, "%*s %d:%d %d:%d %lf", &h1, &m1, &h2, &m2, &price) != 5) return -1;
+  from = parseSlot(h1, m1);
+  to = parseSlot(h2, m2);
+  if (from < 0 || to <= from || price < 0) return -1;
+  for (i = from; i < to; i++) t->price[type][i] = price;
+  return 0;
+}
+
+int tariffLoad(TariffStruct *t, const char *fileName, int *line)
+{
+  char buf[MAX_LINE];
+  FILE *fd;
+  int ret;
+
+  memset(t, 0, sizeof(*t));
+  *line = 0;
+  fd = fopen(fileName, "r");
+  if (fd == NULL) return -1;
+
+  while (fgets(buf, sizeof(buf), fd) != NULL)
+    {
+      char *hash = strchr(buf, '#');
+
+      (*line)++;
+      if (hash) *hash = '\0';
+      if (parseLine(t, buf) != 0)
+	{
+	  fclose(fd);
+	  errno = EINVAL;
+	  return -1;
+	}
+    }
+  ret = ferror(fd) ? -1 : 0;
+  fclose(fd);
+  return ret;
+}
+
+static int isHoliday(const TariffStruct *t, int date)
+{
+  int i;
+
+  for (i = 0; i < t->numHolidays; i++)
+    {
+      if (t->holidays[i] == date) return 1;
+    }
+  return 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Look up the quarter ts falls in
+ *
+ * \param t, the tariff
+ * \param ts, time in ns
+ * \param tm, filled in with the local time
+ * \param slotStart, filled in with the start of the quarter in ns
+ * \return the price of the quarter
+ *
+ ******************************************************************************/
+static double lookup(const TariffStruct *t, uint64_t ts, struct tm *tm, uint64_t *slotStart)
+{
+  time_t s = ts / NS_PER_S;
+  int date, type;
+
+  localtime_r(&s, tm);
+  date = (tm->tm_year + 1900) * 10000 + (tm->tm_mon + 1) * 100 + tm->tm_mday;
+  type = (tm->tm_wday == 0 || tm->tm_wday == 6 || isHoliday(t, date)) ?
+    TARIFF_WEEKEND : TARIFF_WEEKDAY;
+  *slotStart = (uint64_t)(s - (tm->tm_min % 15) * 60 - tm->tm_sec) * NS_PER_S;
+  return t->price[type][tm->tm_hour * 4 + tm->tm_min / 15];
+}
+
+/******************************************************************************/
+/**
+ *
+ * Move to the quarter ts falls in, rolling the day and month totals over
+ * when it is in a new day or month
+ *
+ ******************************************************************************/
+static void enterSlot(TariffStruct *t, uint64_t ts)
+{
+  struct tm tm;
+  int month, date;
+
+  t->slotPrice = lookup(t, ts, &tm, &t->slotStart);
+  t->slotEnd = t->slotStart + SLOT_NS;
+
+  month = (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+  date = month * 100 + tm.tm_mday;
+  if (date != t->day.date)
+    {
+      if (t->day.date != 0) t->prevDay = t->day;
+      t->day.date = date;
+      t->day.energy = 0;
+      t->day.cost = 0;
+    }
+  if (month != t->month.date)
+    {
+      if (t->month.date != 0) t->prevMonth = t->month;
+      t->month.date = month;
+      t->month.energy = 0;
+      t->month.cost = 0;
+    }
+}
+
+void tariffPush(TariffStruct *t, uint64_t ts, double wh)
+{
+  double kwh = wh / 1000;
+
+  if (ts < t->slotStart || ts >= t->slotEnd) enterSlot(t, ts);
+  t->day.energy += kwh;
+  t->day.cost += kwh * t->slotPrice;
+  t->month.energy += kwh;
+  t->month.cost += kwh * t->slotPrice;
+}
+
+static void printTotal(FILE *out, const char *name, const TariffTotalStruct *total)
+{
+  if (total->date == 0) return;
+  fprintf(out, "%s %d %.3f %.2f\n", name, total->date, total->energy, total->cost);
+}
+
+/******************************************************************************/
+/**
+ *
+ * COST
+ *
+ * Prints the price now and the totals of the days and months with pulses
+ *
+ *        | price <per kWh> |
+ *        | day <yyyymmdd> <kWh> <cost> |
+ *        | month <yyyymm> <kWh> <cost> |
+ *        | prevday ... | prevmonth ... |
+ *
+ ******************************************************************************/
+static int queryCost(void *ctx, FILE *out, int argc, char *argv[])
+{
+  TariffStruct *t = ctx;
+  struct tm tm;
+  uint64_t slotStart;
+
+  (void)argc;
+  (void)argv;
+  fprintf(out, "price %.4f\n", lookup(t, (uint64_t)time(NULL) * NS_PER_S, &tm, &slotStart));
+  printTotal(out, "day", &t->day);
+  printTotal(out, "month", &t->month);
+  printTotal(out, "prevday", &t->prevDay);
+  printTotal(out, "prevmonth", &t->prevMonth);
+  return 0;
+}
+
+void tariffRegisterQueries(TariffStruct *t)
+{
+  queryRegister("COST", "", queryCost, t);
+}
@@ -0,0 +1,90 @@
+/******************************************************************************/
+/**
+ * \file tariff.h
+ *
+ * \brief Time-of-use tariff, accumulates the cost of every pulse.
+ *
+ *        The tariff file lists prices per kWh for hour bands on weekdays
+ *        and weekends, and holidays that are priced as weekends:
+ *
+ *        # day     from  to    price
+ *        weekday   07:00 22:00 1.25
+ *        weekday   22:00 24:00 0.80
+ *        weekend   00:00 24:00 0.80
+ *        holiday   2026-12-25
+ *
+ *        Times are local and have 15 minute resolution. Unlisted times
+ *        cost nothing. The file is compiled into a table of prices per
+ *        quarter, so a pulse costs a table lookup, and a call to
+ *        localtime_r() only when it falls in a new quarter.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef TARIFF_H
+#define TARIFF_H
+
+#include <stdint.h>
+
+#define TARIFF_SLOTS (24 * 4)
+#define TARIFF_MAX_HOLIDAYS (64)
+
+enum { TARIFF_WEEKDAY, TARIFF_WEEKEND, TARIFF_DAY_TYPES };
+
+typedef struct
+{
+  int date;        /* yyyymmdd, or yyyymm for a month */
+  double energy;   /* kWh */
+  double cost;
+} TariffTotalStruct;
+
+typedef struct
+{
+  double price[TARIFF_DAY_TYPES][TARIFF_SLOTS];  /* Per kWh */
+  int holidays[TARIFF_MAX_HOLIDAYS];             /* yyyymmdd */
+  int numHolidays;
+
+  /* The quarter the last pulse fell in */
+  uint64_t slotStart;
+  uint64_t slotEnd;
+  double slotPrice;
+
+  TariffTotalStruct day, prevDay;
+  TariffTotalStruct month, prevMonth;
+} TariffStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Read and compile a tariff file
+ *
+ * \param t, the tariff
+ * \param fileName, the tariff file
+ * \return 0 if successful, otherwise -1 with the line number in *line,
+ *         0 if the file could not be opened
+ *
+ ******************************************************************************/
+int tariffLoad(TariffStruct *t, const char *fileName, int *line);
+
+/******************************************************************************/
+/**
+ *
+ * Add the cost of a pulse to the day and month totals
+ *
+ * \param t, the tariff
+ * \param ts, time of the pulse in ns
+ * \param wh, energy of the pulse in Wh
+ * \return None
+ *
+ ******************************************************************************/
+void tariffPush(TariffStruct *t, uint64_t ts, double wh);
+
+/******************************************************************************/
+/**
+ *
+ * Add the COST query command
+ *
+ ******************************************************************************/
+void tariffRegisterQueries(TariffStruct *t);
+
+#endif
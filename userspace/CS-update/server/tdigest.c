@@ -0,0 +1,201 @@
+/******************************************************************************/
+/**
+ * \file tdigest.c
+ *
+ * \brief Mergeable t-digest, see tdigest.h
+ *
+ *        Centroids are merged greedily with the arcsine scale function,
+ *        which allows each centroid to cover one unit of
+ *        k(q) = delta / (2 pi) * asin(2q - 1). Greedy merging ends up with
+ *        well below delta centroids, so delta is set a third above the
+ *        room we have, and the last slot takes the rest in the rare case
+ *        it is reached.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include "tdigest.h"
+
+#define DELTA (TDIGEST_CENTROIDS * 4 / 3.0)
+
+static double scaleK(double q)
+{
+  return DELTA / (2 * M_PI) * asin(2 * q - 1);
+}
+
+void tdigestInit(TDigestStruct *d)
+{
+  d->n = 0;
+  d->min = 0;
+  d->max = 0;
+  d->weight = 0;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Compress sorted centroids into d
+ *
+ * \param d, destination, min and max must already be set
+ * \param in, centroids sorted on mean
+ * \param n, number of centroids in
+ * \param total, sum of the weights in
+ * \return None
+ *
+ ******************************************************************************/
+static void compress(TDigestStruct *d, const CentroidStruct *in, int n, double total)
+{
+  CentroidStruct cur;
+  double before = 0;   /* Weight of the centroids already emitted */
+  double kLeft;
+  int i;
+
+  d->n = 0;
+  d->weight = total;
+  if (n == 0) return;
+
+  cur = in[0];
+  kLeft = scaleK(0);
+  for (i = 1; i < n; i++)
+    {
+      double w = cur.weight + in[i].weight;
+
+      if (scaleK((before + w) / total) - kLeft <= 1 || d->n == TDIGEST_CENTROIDS - 1)
+	{
+	  cur.mean += (in[i].mean - cur.mean) * in[i].weight / w;
+	  cur.weight = w;
+	}
+      else
+	{
+	  d->c[d->n++] = cur;
+	  before += cur.weight;
+	  kLeft = scaleK(before / total);
+	  cur = in[i];
+	}
+    }
+  d->c[d->n++] = cur;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Merge two sorted centroid lists into out
+ *
+ * \return number of centroids in out
+ *
+ ******************************************************************************/
+static int mergeSorted(CentroidStruct *out, const CentroidStruct *a, int na,
+                       const CentroidStruct *b, int nb)
+{
+  int i = 0, j = 0, n = 0;
+
+  while (i < na && j < nb)
+    {
+      out[n++] = (a[i].mean <= b[j].mean) ? a[i++] : b[j++];
+    }
+  while (i < na) out[n++] = a[i++];
+  while (j < nb) out[n++] = b[j++];
+  return n;
+}
+
+void tdigestMerge(TDigestStruct *dst, const TDigestStruct *src)
+{
+  CentroidStruct tmp[2 * TDIGEST_CENTROIDS];
+  int n;
+
+  if (src->n == 0) return;
+  if (dst->n == 0)
+    {
+      *dst = *src;
+      return;
+    }
+  if (src->min < dst->min) dst->min = src->min;
+  if (src->max > dst->max) dst->max = src->max;
+  n = mergeSorted(tmp, dst->c, dst->n, src->c, src->n);
+  compress(dst, tmp, n, dst->weight + src->weight);
+}
+
+double tdigestQuantile(const TDigestStruct *d, double q)
+{
+  double target, cum = 0, prevCenter, prevMean;
+  int i;
+
+  if (d->n == 0) return 0;
+  if (q <= 0) return d->min;
+  if (q >= 1) return d->max;
+
+  /* Each centroid is taken to sit at the middle of its weight, values are
+   * interpolated between neighbouring centres and towards min and max */
+  target = q * d->weight;
+  prevCenter = 0;
+  prevMean = d->min;
+  for (i = 0; i < d->n; i++)
+    {
+      double center = cum + d->c[i].weight / 2;
+
+      if (target < center)
+	{
+	  return prevMean + (d->c[i].mean - prevMean) * (target - prevCenter) / (center - prevCenter);
+	}
+      cum += d->c[i].weight;
+      prevCenter = center;
+      prevMean = d->c[i].mean;
+    }
+  if (d->weight <= prevCenter) return d->max;
+  return prevMean + (d->max - prevMean) * (target - prevCenter) / (d->weight - prevCenter);
+}
+
+void tdigestBuilderInit(TDigestBuilderStruct *b)
+{
+  tdigestInit(&b->digest);
+  b->nbuf = 0;
+}
+
+static int compareFloat(const void *a, const void *b)
+{
+  float x = *(const float *)a, y = *(const float *)b;
+
+  return (x > y) - (x < y);
+}
+
+/******************************************************************************/
+/**
+ *
+ * Merge the buffered samples into the digest
+ *
+ ******************************************************************************/
+static void flush(TDigestBuilderStruct *b)
+{
+  CentroidStruct samples[TDIGEST_BUFFER];
+  CentroidStruct tmp[TDIGEST_CENTROIDS + TDIGEST_BUFFER];
+  TDigestStruct *d = &b->digest;
+  int i, n;
+
+  if (b->nbuf == 0) return;
+  qsort(b->buf, b->nbuf, sizeof(float), compareFloat);
+  for (i = 0; i < b->nbuf; i++)
+    {
+      samples[i].mean = b->buf[i];
+      samples[i].weight = 1;
+    }
+  if (d->n == 0 || b->buf[0] < d->min) d->min = b->buf[0];
+  if (d->n == 0 || b->buf[b->nbuf - 1] > d->max) d->max = b->buf[b->nbuf - 1];
+
+  n = mergeSorted(tmp, d->c, d->n, samples, b->nbuf);
+  compress(d, tmp, n, d->weight + b->nbuf);
+  b->nbuf = 0;
+}
+
+void tdigestBuilderAdd(TDigestBuilderStruct *b, float value)
+{
+  if (b->nbuf == TDIGEST_BUFFER) flush(b);
+  b->buf[b->nbuf++] = value;
+}
+
+const TDigestStruct *tdigestBuilderDigest(TDigestBuilderStruct *b)
+{
+  flush(b);
+  return &b->digest;
+}
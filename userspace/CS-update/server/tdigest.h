@@ -0,0 +1,80 @@
+/******************************************************************************/
+/**
+ * \file tdigest.h
+ *
+ * \brief Fixed size, mergeable t-digest for power percentiles.
+ *
+ *        A digest summarizes any number of samples in at most
+ *        TDIGEST_CENTROIDS centroids, with the best accuracy at the tails
+ *        where P5 and P99 live. Two digests merge into one of the same
+ *        size, so a percentile over any range is the merge of the digests
+ *        of the buckets in it.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef TDIGEST_H
+#define TDIGEST_H
+
+#include <stdint.h>
+
+#define TDIGEST_CENTROIDS (48)
+#define TDIGEST_BUFFER (128)
+
+typedef struct
+{
+  float mean;
+  float weight;
+} CentroidStruct;
+
+typedef struct
+{
+  uint16_t n;        /* Centroids in use, sorted on mean */
+  float min;
+  float max;
+  double weight;     /* Total weight of all centroids */
+  CentroidStruct c[TDIGEST_CENTROIDS];
+} TDigestStruct;
+
+/* A digest that is being filled, samples are buffered and merged in bulk */
+typedef struct
+{
+  TDigestStruct digest;
+  uint16_t nbuf;
+  float buf[TDIGEST_BUFFER];
+} TDigestBuilderStruct;
+
+void tdigestInit(TDigestStruct *d);
+
+/******************************************************************************/
+/**
+ *
+ * Merge src into dst, dst keeps at most TDIGEST_CENTROIDS centroids
+ *
+ ******************************************************************************/
+void tdigestMerge(TDigestStruct *dst, const TDigestStruct *src);
+
+/******************************************************************************/
+/**
+ *
+ * Estimate the value below which a fraction q of the weight lies
+ *
+ * \param d, the digest
+ * \param q, fraction 0..1
+ * \return the estimate, 0 for an empty digest
+ *
+ ******************************************************************************/
+double tdigestQuantile(const TDigestStruct *d, double q);
+
+void tdigestBuilderInit(TDigestBuilderStruct *b);
+void tdigestBuilderAdd(TDigestBuilderStruct *b, float value);
+
+/******************************************************************************/
+/**
+ *
+ * Merge the buffered samples and return the digest of everything added
+ *
+ ******************************************************************************/
+const TDigestStruct *tdigestBuilderDigest(TDigestBuilderStruct *b);
+
+#endif
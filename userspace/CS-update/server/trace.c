@@ -0,0 +1,26 @@
+/******************************************************************************/
+/**
+ * \file trace.c
+ *
+ * \brief Latency trace of a pulse, see trace.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+void traceBegin(TraceStruct *t, uint64_t edge)
+{
+  memset(t, 0, sizeof(*t));
+  t->at[TRACE_EDGE] = edge;
+}
+
+void traceStamp(TraceStruct *t, TraceHop hop)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  t->at[hop] = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,58 @@
+/******************************************************************************/
+/**
+ * \file trace.h
+ *
+ * \brief Latency trace of a pulse, from the GPIO edge to the subscriber.
+ *
+ *        Every pulse carries the time it passed each hop, all CLOCK_REALTIME
+ *        like the module's own time stamp:
+ *
+ *        | TRACE_EDGE    | the module's interrupt handler                 |
+ *        | TRACE_READ    | the capture thread read lastPulse              |
+ *        | TRACE_COMPUTE | the compute stage took it off the capture queue|
+ *        | TRACE_PUBLISH | the publish thread took the live record        |
+ *        | TRACE_SEND    | the live line was handed to the sockets        |
+ *
+ *        Subscribers that ask for it get the hops after every live line,
+ *        see subscribe.h, and the client adds its own, see its -t option.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+typedef enum
+{
+  TRACE_EDGE,
+  TRACE_READ,
+  TRACE_COMPUTE,
+  TRACE_PUBLISH,
+  TRACE_SEND,
+  TRACE_HOPS
+} TraceHop;
+
+typedef struct
+{
+  uint64_t at[TRACE_HOPS];   /* ns since the epoch, 0 if not passed */
+} TraceStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Start a trace at the edge, clearing the later hops
+ *
+ ******************************************************************************/
+void traceBegin(TraceStruct *t, uint64_t edge);
+
+/******************************************************************************/
+/**
+ *
+ * Note that the pulse passes a hop now
+ *
+ ******************************************************************************/
+void traceStamp(TraceStruct *t, TraceHop hop);
+
+#endif
@@ -1,16 +1,28 @@
 #include <stdio.h>
+#include <unistd.h>
 
 #define SCALE (3600)
 
-const char *fileName = "/sys/tomas/gpio60/diffTime";
+const char *dirName = "/sys/tomas/gpio60";
 
-int main(void)
+int main(int argc, char *argv[])
 {
   FILE *fd;
+  char fileName[256];
   float diffTime;
   int power;
+  int opt;
+
+  /* -d dir reads a fake tree, see pulse-replay */
+  while ((opt = getopt(argc, argv, "d:")) != -1)
+    {
+      if (opt != 'd') return 1;
+      dirName = optarg;
+    }
+  snprintf(fileName, sizeof(fileName), "%s/diffTime", dirName);
 
   fd = fopen(fileName, "r");
+  if (fd == NULL) return 1;
   fscanf(fd, "%f", &diffTime);
 
   power = (SCALE/diffTime);
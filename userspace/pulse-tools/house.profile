@@ -0,0 +1,17 @@
+# The built in profile of pulse-gen, as a starting point for others
+pulses 1000
+base 60
+noise 0.05
+
+#         name        W     minutes  per day  from  to (UTC)
+appliance fridge      100   20       36
+appliance freezer     90    25       30
+appliance waterheater 3000  30       2
+appliance kettle      2000  3        4        6     22
+appliance hob         1500  30       1        11    20
+appliance oven        2500  40       0.7      16    20
+appliance dishwasher  1200  60       0.8      18    23
+appliance washer      500   90       0.6      8     21
+appliance dryer       2000  60       0.3      9     22
+appliance lights      150   240      1        17    23
+appliance tv          120   180      1        18    23
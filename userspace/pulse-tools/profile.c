@@ -0,0 +1,198 @@
+/******************************************************************************/
+/**
+ * \file profile.c
+ *
+ * \brief Synthetic household load, see profile.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "profile.h"
+
+#define NS_PER_S (1000000000ULL)
+#define J_PER_KWH (3600000.0)
+#define LINE (256)
+
+static void addAppliance(ProfileStruct *p, const char *name, double power, double minutes,
+			 double perDay, int fromHour, int toHour)
+{
+  ApplianceStruct *a = &p->appliances[p->numAppliances++];
+
+  snprintf(a->name, sizeof(a->name), "%s", name);
+  a->power = power;
+  a->minutes = minutes;
+  a->perDay = perDay;
+  a->fromHour = fromHour;
+  a->toHour = toHour;
+  a->until = 0;
+}
+
+void profileDefault(ProfileStruct *p)
+{
+  memset(p, 0, sizeof(*p));
+  p->pulsesPerKwh = 1000;
+  p->base = 60;
+  p->noise = 0.05;
+  addAppliance(p, "fridge", 100, 20, 36, 0, 24);
+  addAppliance(p, "freezer", 90, 25, 30, 0, 24);
+  addAppliance(p, "waterheater", 3000, 30, 2, 0, 24);
+  addAppliance(p, "kettle", 2000, 3, 4, 6, 22);
+  addAppliance(p, "hob", 1500, 30, 1, 11, 20);
+  addAppliance(p, "oven", 2500, 40, 0.7, 16, 20);
+  addAppliance(p, "dishwasher", 1200, 60, 0.8, 18, 23);
+  addAppliance(p, "washer", 500, 90, 0.6, 8, 21);
+  addAppliance(p, "dryer", 2000, 60, 0.3, 9, 22);
+  addAppliance(p, "lights", 150, 240, 1, 17, 23);
+  addAppliance(p, "tv", 120, 180, 1, 18, 23);
+}
+
+int profileLoad(ProfileStruct *p, const char *fileName)
+{
+  char line[LINE], name[PROFILE_NAME];
+  double value, power, minutes, perDay;
+  int fromHour, toHour, lineNo = 0, n, bad = 0, err;
+  unsigned int pulses;
+  FILE *fd;
+
+  fd = fopen(fileName, "r");
+  if (fd == NULL) return -1;
+  memset(p, 0, sizeof(*p));
+  p->pulsesPerKwh = 1000;
+  while (!bad && fgets(line, sizeof(line), fd) != NULL)
+    {
+      char *hash = strchr(line, '#');
+
+      lineNo++;
+      if (hash != NULL) *hash = '\0';
+      if (sscanf(line, " %31s", name) != 1) continue;
+
+      if (sscanf(line, " pulses %u", &pulses) == 1 && pulses > 0) p->pulsesPerKwh = pulses;
+      else if (sscanf(line, " base %lf", &value) == 1 && value >= 0) p->base = value;
+      else if (sscanf(line, " noise %lf", &value) == 1 && value >= 0) p->noise = value;
+      else if ((n = sscanf(line, " appliance %31s %lf %lf %lf %d %d", name, &power, &minutes,
+			   &perDay, &fromHour, &toHour)) >= 4 && n != 5 &&
+	       p->numAppliances < PROFILE_APPLIANCES && power >= 0 && minutes > 0 && perDay >= 0)
+	{
+	  if (n == 4)
+	    {
+	      fromHour = 0;
+	      toHour = 24;
+	    }
+	  bad = (fromHour < 0 || fromHour > 23 || toHour < 1 || toHour > 24 || fromHour == toHour);
+	  if (!bad) addAppliance(p, name, power, minutes, perDay, fromHour, toHour);
+	}
+      else bad = 1;
+    }
+  err = ferror(fd);
+  fclose(fd);
+  if (bad)
+    {
+      line[strcspn(line, "\n")] = '\0';
+      fprintf(stderr, "%s:%d: %s\n", fileName, lineNo, line);
+      errno = EINVAL;
+      return -1;
+    }
+  return err ? -1 : 0;
+}
+
+static double uniform(ProfileStruct *p)
+{
+  /* xorshift64*, the same on every platform */
+  p->rng ^= p->rng >> 12;
+  p->rng ^= p->rng << 25;
+  p->rng ^= p->rng >> 27;
+  return ((p->rng * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static double gauss(ProfileStruct *p)
+{
+  double u = uniform(p);
+
+  return sqrt(-2 * log(u > 0 ? u : 1e-300)) * cos(2 * M_PI * uniform(p));
+}
+
+/* Hours of the day an appliance may start in, from may be after to, e.g. 22 to 6 */
+static int windowHours(const ApplianceStruct *a)
+{
+  return (a->toHour > a->fromHour) ? a->toHour - a->fromHour : 24 - a->fromHour + a->toHour;
+}
+
+static int inWindow(const ApplianceStruct *a, int hour)
+{
+  if (a->toHour > a->fromHour) return hour >= a->fromHour && hour < a->toHour;
+  return hour >= a->fromHour || hour < a->toHour;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Move on to the next second: start and stop appliances and set the load
+ *
+ ******************************************************************************/
+static void step(ProfileStruct *p)
+{
+  uint64_t second = p->t / NS_PER_S;
+  int hour = (second / 3600) % 24;
+  double power = p->base;
+  int i;
+
+  if (second % 60 == 0 || p->factor == 0)
+    {
+      p->factor = 1 + p->noise * gauss(p);
+      if (p->factor < 0.01) p->factor = 0.01;
+    }
+  for (i = 0; i < p->numAppliances; i++)
+    {
+      ApplianceStruct *a = &p->appliances[i];
+
+      if (a->until <= p->t) a->until = 0;
+      if (a->until == 0 && inWindow(a, hour) &&
+	  uniform(p) < a->perDay / (windowHours(a) * 3600.0))
+	{
+	  a->until = p->t + (uint64_t)(a->minutes * 60 * (0.8 + 0.4 * uniform(p)) * NS_PER_S);
+	}
+      if (a->until != 0) power += a->power;
+    }
+  p->power = power * p->factor;
+  p->stepEnd = (second + 1) * NS_PER_S;
+}
+
+void profileStart(ProfileStruct *p, uint64_t startNs, uint64_t seed)
+{
+  int i;
+
+  p->rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+  p->t = startNs;
+  p->stepEnd = startNs;
+  p->factor = 0;
+  p->joules = 0;
+  for (i = 0; i < p->numAppliances; i++) p->appliances[i].until = 0;
+}
+
+uint64_t profileNext(ProfileStruct *p, uint64_t end)
+{
+  double pulseJ = J_PER_KWH / p->pulsesPerKwh;
+  double ns;
+
+  while (p->t < end)
+    {
+      if (p->t >= p->stepEnd) step(p);
+      if (p->power > 0)
+	{
+	  ns = (pulseJ - p->joules) / p->power * NS_PER_S;
+	  if (p->t + ns < p->stepEnd)
+	    {
+	      p->t += (uint64_t)ns;
+	      p->joules = 0;
+	      return p->t;
+	    }
+	}
+      p->joules += p->power * (p->stepEnd - p->t) / NS_PER_S;
+      p->t = p->stepEnd;
+    }
+  return end;
+}
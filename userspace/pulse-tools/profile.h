@@ -0,0 +1,101 @@
+/******************************************************************************/
+/**
+ * \file profile.h
+ *
+ * \brief Synthetic household load, turned into meter pulses.
+ *
+ *        A profile file has one setting per line, # starts a comment:
+ *
+ *        | pulses <n>                       | impulse constant per kWh    |
+ *        | base <W>                         | always on                   |
+ *        | noise <fraction>                 | spread of the total load,   |
+ *        |                                  | drawn anew every minute     |
+ *        | appliance <name> <W> <minutes>   | runs of about that length,  |
+ *        |   <per day> [<from h> <to h>]    | starting at random, only    |
+ *        |                                  | between the UTC hours given |
+ *
+ *        The load is constant within each second and the pulses fall where
+ *        the energy reaches the next 1/pulses kWh, so the intervals follow
+ *        the load as a real meter's do. The same profile and seed always
+ *        give the same pulses. house.profile is the default profile.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#define PROFILE_APPLIANCES (32)
+#define PROFILE_NAME (32)
+
+typedef struct
+{
+  char name[PROFILE_NAME];
+  double power;              /* W while running */
+  double minutes;            /* Typical length of a run */
+  double perDay;             /* Runs per day */
+  int fromHour, toHour;      /* Runs start in [from, to), UTC */
+  uint64_t until;            /* Running until, ns, 0 if off */
+} ApplianceStruct;
+
+typedef struct
+{
+  uint32_t pulsesPerKwh;
+  double base;
+  double noise;
+  ApplianceStruct appliances[PROFILE_APPLIANCES];
+  int numAppliances;
+
+  uint64_t rng;
+  uint64_t t;                /* Where the generator is, ns since the epoch */
+  uint64_t stepEnd;          /* End of the second the load holds for */
+  double power;              /* Load in this second, W */
+  double factor;             /* Noise factor of this minute */
+  double joules;             /* Energy since the last pulse */
+} ProfileStruct;
+
+/******************************************************************************/
+/**
+ *
+ * A household of about 3800 kWh a year: fridge, freezer, kettle, cooking,
+ * washing, lighting and a standby base load
+ *
+ ******************************************************************************/
+void profileDefault(ProfileStruct *p);
+
+/******************************************************************************/
+/**
+ *
+ * Read a profile file
+ *
+ * \param p, the profile
+ * \param fileName, the file
+ * \return 0 if successful, otherwise -1 with errno set, and the line in
+ *         error printed
+ *
+ ******************************************************************************/
+int profileLoad(ProfileStruct *p, const char *fileName);
+
+/******************************************************************************/
+/**
+ *
+ * Start generating at a time, with a seed for the random choices
+ *
+ ******************************************************************************/
+void profileStart(ProfileStruct *p, uint64_t startNs, uint64_t seed);
+
+/******************************************************************************/
+/**
+ *
+ * Generate the next pulse
+ *
+ * \param end, ns since the epoch to give up at, a profile can have no load
+ *
+ * \return its time, ns since the epoch, or end if there is none before it
+ *
+ ******************************************************************************/
+uint64_t profileNext(ProfileStruct *p, uint64_t end);
+
+#endif
@@ -0,0 +1,175 @@
+/******************************************************************************/
+/**
+ * \file pulse-gen.c
+ *
+ * \brief Generates pulses from a synthetic household load, see profile.h,
+ *        for benchmarks that would otherwise need a meter and real time.
+ *
+ *        The pulses are written as a trace, see pulsetrace.h, or with -t as
+ *        text lines in the format of the module's lastPulse attribute
+ *
+ *        | <numWattHours> <ns since the epoch> |
+ *
+ *        As fast as they can be generated, a year in well under a minute,
+ *        or with -x speed paced at that many times real time, up to
+ *        MAX_SPEED, so a running pipeline can be fed through a pipe:
+ *
+ *        | pulse-gen -d 365 -o year.wmtr     |
+ *        | pulse-gen -d 1 -x 1000 -t | ...   |
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "profile.h"
+#include "pulsetrace.h"
+
+#define NS_PER_S (1000000000ULL)
+#define MAX_SPEED (1000)
+
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+static void usage(void)
+{
+  printf("pulse-gen [-p profile] [-s start] [-d days] [-r seed] [-x speed] [-t] [-o file]");
+  printf("\n");
+  printf("  -p file  load profile, see profile.h, default a typical household");
+  printf("\n");
+  printf("  -s s     start, s since the epoch, default now");
+  printf("\n");
+  printf("  -d days  length of the trace, default 1");
+  printf("\n");
+  printf("  -r seed  seed of the random choices, default 1");
+  printf("\n");
+  printf("  -x speed pace the pulses at speed times real time, up to %d", MAX_SPEED);
+  printf("\n");
+  printf("  -t       text lines as in lastPulse instead of a trace");
+  printf("\n");
+  printf("  -o file  where to write, - for stdout (default)");
+  printf("\n");
+}
+
+/******************************************************************************/
+/**
+ *
+ * Wait until a pulse is due at the given speed
+ *
+ * \param wallStart, CLOCK_MONOTONIC when the first pulse was due
+ * \param sinceStart, ns of trace time from the start to the pulse
+ * \param speed, times real time
+ *
+ ******************************************************************************/
+static void pace(const struct timespec *wallStart, uint64_t sinceStart, double speed)
+{
+  uint64_t ns = (uint64_t)(sinceStart / speed);
+  struct timespec due;
+
+  due.tv_sec = wallStart->tv_sec + ns / NS_PER_S;
+  due.tv_nsec = wallStart->tv_nsec + ns % NS_PER_S;
+  if (due.tv_nsec >= (long)NS_PER_S)
+    {
+      due.tv_sec++;
+      due.tv_nsec -= NS_PER_S;
+    }
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+}
+
+int main(int argc, char *argv[])
+{
+  int32_t opt;
+  const char *profileName = NULL, *outName = "-";
+  double days = 1, speed = 0;
+  uint64_t start = (uint64_t)time(NULL) * NS_PER_S, end, ts, seed = 1, numPulses = 0;
+  int text = 0;
+  ProfileStruct profile;
+  PulseTraceHeaderStruct header;
+  PulseTraceStruct trace;
+  struct timespec wallStart, wallEnd;
+  FILE *out;
+
+  while ((opt = getopt(argc, argv, "hp:s:d:r:x:to:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'p':
+	  profileName = optarg;
+	  break;
+	case 's':
+	  start = strtoull(optarg, NULL, 0) * NS_PER_S;
+	  break;
+	case 'd':
+	  days = atof(optarg);
+	  break;
+	case 'r':
+	  seed = strtoull(optarg, NULL, 0);
+	  break;
+	case 'x':
+	  speed = atof(optarg);
+	  break;
+	case 't':
+	  text = 1;
+	  break;
+	case 'o':
+	  outName = optarg;
+	  break;
+	case 'h':
+	  usage();
+	  return 0;
+	default:
+	  usage();
+	  error("Unrecognized input");
+	  break;
+	}
+    }
+  if (days <= 0 || speed < 0 || speed > MAX_SPEED) error("Bad arguments");
+
+  if (profileName == NULL) profileDefault(&profile);
+  else if (profileLoad(&profile, profileName) != 0) error("Bad profile");
+
+  out = (strcmp(outName, "-") == 0) ? stdout : fopen(outName, "w");
+  if (out == NULL) error("fopen() Failed");
+
+  memset(&header, 0, sizeof(header));
+  header.pulsesPerKwh = profile.pulsesPerKwh;
+  header.startCount = 0;
+  header.startNs = start;
+  snprintf(header.meta, sizeof(header.meta), "source=pulse-gen\nprofile=%s\nseed=%llu\n",
+	   profileName ? profileName : "default", (unsigned long long)seed);
+  if (!text && pulseTraceCreate(&trace, out, &header) != 0) error("write Failed");
+
+  end = start + (uint64_t)(days * 86400 * NS_PER_S);
+  profileStart(&profile, start, seed);
+  clock_gettime(CLOCK_MONOTONIC, &wallStart);
+  while ((ts = profileNext(&profile, end)) < end)
+    {
+      numPulses++;
+      if (speed > 0) pace(&wallStart, ts - start, speed);
+      if (text)
+	{
+	  if (fprintf(out, "%llu %llu\n", (unsigned long long)numPulses, (unsigned long long)ts) < 0)
+	    {
+	      error("write Failed");
+	    }
+	}
+      else if (pulseTraceWrite(&trace, ts, 0) != 0) error("write Failed");
+      if (speed > 0 && fflush(out) != 0) error("write Failed");
+    }
+  if (fflush(out) != 0) error("write Failed");
+  if (out != stdout) fclose(out);
+
+  clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+  fprintf(stderr, "%llu pulses, %.1f kWh, %.0f W average, in %.1f s\n",
+	  (unsigned long long)numPulses, (double)numPulses / profile.pulsesPerKwh,
+	  numPulses * 3600.0e3 / profile.pulsesPerKwh / (days * 86400),
+	  (wallEnd.tv_sec - wallStart.tv_sec) + (wallEnd.tv_nsec - wallStart.tv_nsec) / 1e9);
+  return 0;
+}
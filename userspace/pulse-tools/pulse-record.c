@@ -0,0 +1,252 @@
+/******************************************************************************/
+/**
+ * \file pulse-record.c
+ *
+ * \brief Records the pulses of the live module as a trace, see pulsetrace.h,
+ *        to replay later with pulse-replay.
+ *
+ *        | pulse-record -o site.wmtr -t 4 |
+ *
+ *        The recorder waits for the module to notify lastPulse, reads it
+ *        and appends about 5 bytes to a buffered file, which is flushed
+ *        every FLUSH_S and on SIGINT or SIGTERM, so it costs next to
+ *        nothing beside the server. Pulses the module counted between two
+ *        reads are recorded as missed, with the time of the last one.
+ *
+ *        The header has the impulse constant, the count when recording
+ *        started and, as meta, the host, the attribute directory and
+ *        whether the module debounces. When the count goes backwards, the
+ *        module was reloaded, the trace is closed and the recording goes on
+ *        in <file>.1, <file>.2 and so on, as a trace cannot go backwards.
+ *
+ *        A lastPulse outside sysfs, such as one kept by pulse-replay, is
+ *        read every POLL_MS instead.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include "pulsetrace.h"
+
+#define NS_PER_S (1000000000ULL)
+#define PATH (256)
+#define DEFAULT_DIR "/sys/tomas/gpio60"
+#define FLUSH_S (10)
+#define POLL_MS (1)
+
+static volatile sig_atomic_t stop = 0;
+
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+static void usage(void)
+{
+  printf("pulse-record -o file [-d dir] [-p pulses] [-t hours] [-n count]");
+  printf("\n");
+  printf("  -o file   trace to write");
+  printf("\n");
+  printf("  -d dir    attributes of the meter, default %s", DEFAULT_DIR);
+  printf("\n");
+  printf("  -p n      impulse constant of the meter per kWh, default 1000");
+  printf("\n");
+  printf("  -t hours  stop after this long, default when stopped");
+  printf("\n");
+  printf("  -n count  stop after this many pulses");
+  printf("\n");
+}
+
+static void onSignal(int sig)
+{
+  (void)sig;
+  stop = 1;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Read a "<count> <ns>" attribute, through a new descriptor when polled so
+ * that a file replaced by rename() is followed
+ *
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+static int readPulse(int fd, const char *fileName, int polled, uint32_t *count, uint64_t *ts)
+{
+  char buf[64];
+  unsigned long long t;
+  unsigned int c;
+  ssize_t n;
+
+  if (polled && (fd = open(fileName, O_RDONLY)) < 0) return -1;
+  n = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (polled) close(fd);
+  if (n <= 0) return -1;
+  buf[n] = '\0';
+  if (sscanf(buf, "%u %llu", &c, &t) != 2) return -1;
+  *count = c;
+  *ts = t;
+  return 0;
+}
+
+static void readText(const char *dir, const char *name, char *text, size_t size)
+{
+  char path[PATH];
+  FILE *fd;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  text[0] = '\0';
+  fd = fopen(path, "r");
+  if (fd == NULL) return;
+  if (fgets(text, size, fd) == NULL) text[0] = '\0';
+  fclose(fd);
+  text[strcspn(text, " \n")] = '\0';
+}
+
+/******************************************************************************/
+/**
+ *
+ * Start a trace at the given count and time
+ *
+ ******************************************************************************/
+static FILE *startTrace(PulseTraceStruct *trace, const char *fileName, int part, const char *dir,
+			uint32_t pulsesPerKwh, uint32_t count, uint64_t ts)
+{
+  PulseTraceHeaderStruct header;
+  char path[PATH], host[64], debounce[16];
+  FILE *out;
+
+  if (part == 0) snprintf(path, sizeof(path), "%s", fileName);
+  else snprintf(path, sizeof(path), "%s.%d", fileName, part);
+  out = fopen(path, "w");
+  if (out == NULL) error(path);
+
+  if (gethostname(host, sizeof(host)) != 0) strcpy(host, "unknown");
+  host[sizeof(host) - 1] = '\0';
+  readText(dir, "isDebounce", debounce, sizeof(debounce));
+
+  memset(&header, 0, sizeof(header));
+  header.pulsesPerKwh = pulsesPerKwh;
+  header.startCount = count;
+  header.startNs = ts;
+  snprintf(header.meta, sizeof(header.meta), "source=pulse-record\nhost=%s\ndir=%s\ndebounce=%s\n",
+	   host, dir, debounce);
+  if (pulseTraceCreate(trace, out, &header) != 0) error("write Failed");
+  return out;
+}
+
+int main(int argc, char *argv[])
+{
+  int32_t opt;
+  const char *outName = NULL, *dir = DEFAULT_DIR;
+  char pulseName[PATH];
+  uint32_t pulsesPerKwh = 1000, count, prevCount;
+  uint64_t ts, prevTs, maxPulses = 0, numPulses = 0, numMissed = 0;
+  double hours = 0;
+  time_t started, lastFlush;
+  PulseTraceStruct trace;
+  struct pollfd pfd;
+  struct statfs fs;
+  struct sigaction sa;
+  FILE *out;
+  int fd, polled, part = 0;
+
+  while ((opt = getopt(argc, argv, "ho:d:p:t:n:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'o':
+	  outName = optarg;
+	  break;
+	case 'd':
+	  dir = optarg;
+	  break;
+	case 'p':
+	  pulsesPerKwh = strtoul(optarg, NULL, 0);
+	  break;
+	case 't':
+	  hours = atof(optarg);
+	  break;
+	case 'n':
+	  maxPulses = strtoull(optarg, NULL, 0);
+	  break;
+	case 'h':
+	  usage();
+	  return 0;
+	default:
+	  usage();
+	  error("Unrecognized input");
+	  break;
+	}
+    }
+  if (outName == NULL || pulsesPerKwh == 0 || hours < 0)
+    {
+      usage();
+      error("Bad arguments");
+    }
+
+  snprintf(pulseName, sizeof(pulseName), "%s/lastPulse", dir);
+  fd = open(pulseName, O_RDONLY);
+  if (fd < 0) error(pulseName);
+  polled = (fstatfs(fd, &fs) != 0 || fs.f_type != SYSFS_MAGIC);
+  if (readPulse(fd, pulseName, polled, &prevCount, &prevTs) != 0) error("Bad lastPulse");
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onSignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  out = startTrace(&trace, outName, part, dir, pulsesPerKwh, prevCount, prevTs);
+  started = lastFlush = time(NULL);
+  pfd.fd = fd;
+  pfd.events = POLLPRI;
+  while (!stop)
+    {
+      /* Wake up now and then to flush and to notice a signal or the end */
+      if (polled) poll(NULL, 0, POLL_MS);
+      else if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) error("poll() Failed");
+
+      if (readPulse(fd, pulseName, polled, &count, &ts) == 0 && count != prevCount)
+	{
+	  if (count < prevCount || ts < prevTs)
+	    {
+	      fclose(out);
+	      out = startTrace(&trace, outName, ++part, dir, pulsesPerKwh, count, ts);
+	    }
+	  else
+	    {
+	      if (pulseTraceWrite(&trace, ts, count - prevCount - 1) != 0) error("write Failed");
+	      numPulses++;
+	      numMissed += count - prevCount - 1;
+	    }
+	  prevCount = count;
+	  prevTs = ts;
+	  if (maxPulses != 0 && numPulses >= maxPulses) break;
+	}
+
+      if (time(NULL) - lastFlush >= FLUSH_S)
+	{
+	  if (fflush(out) != 0) error("write Failed");
+	  lastFlush = time(NULL);
+	}
+      if (hours > 0 && time(NULL) - started >= hours * 3600) break;
+    }
+  if (fclose(out) != 0) error("write Failed");
+  close(fd);
+
+  fprintf(stderr, "%llu pulses, %llu missed, in %d part(s)\n", (unsigned long long)numPulses,
+	  (unsigned long long)numMissed, part + 1);
+  return 0;
+}
@@ -0,0 +1,208 @@
+/******************************************************************************/
+/**
+ * \file pulse-replay.c
+ *
+ * \brief Replays a pulse trace, see pulsetrace.h, into a fake of the tree
+ *        the wattmeter module keeps in sysfs, so that the server and the
+ *        power tool can run without the meter:
+ *
+ *        | pulse-replay -i year.wmtr -x 100 -k &            |
+ *        | power-update-server -d /tmp/tomas/gpio60         |
+ *
+ *        The attributes are written as the module shows them, lastPulse
+ *        last so that the others are up to date when it changes. Each is
+ *        written to a new file that is renamed over the old one, so a
+ *        reader never sees one half written. The server notices that
+ *        lastPulse is not in sysfs and polls it, see pulse-source.h.
+ *
+ *        Every pulse is written when it is due, at speed times real time,
+ *        against CLOCK_MONOTONIC so that the intervals are kept exactly.
+ *        By default the trace is moved to start now and its time stamps
+ *        are scaled with the speed, with -k they are kept as recorded, so
+ *        that a year of history can be built up in hours. At the end the
+ *        number of pulses and how late they were written is printed.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "pulsetrace.h"
+
+#define NS_PER_S (1000000000ULL)
+#define PATH (256)
+#define DEFAULT_DIR "/tmp/tomas/gpio60"
+
+void error(const char *msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+static void usage(void)
+{
+  printf("pulse-replay -i trace [-d dir] [-x speed] [-k]");
+  printf("\n");
+  printf("  -i file  trace to replay, - for stdin");
+  printf("\n");
+  printf("  -d dir   fake attribute tree, default %s", DEFAULT_DIR);
+  printf("\n");
+  printf("  -x speed times real time, default 1");
+  printf("\n");
+  printf("  -k       keep the recorded time stamps");
+  printf("\n");
+}
+
+static uint64_t nsOf(const struct timespec *t)
+{
+  return (uint64_t)t->tv_sec * NS_PER_S + t->tv_nsec;
+}
+
+/******************************************************************************/
+/**
+ *
+ * Replace an attribute of the fake tree
+ *
+ * \param dir, the tree
+ * \param name, the attribute
+ * \param text, its new contents
+ *
+ ******************************************************************************/
+static void writeAttr(const char *dir, const char *name, const char *text)
+{
+  char path[PATH], tmp[PATH];
+  size_t len = strlen(text);
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  snprintf(tmp, sizeof(tmp), "%s/.%s", dir, name);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) error(tmp);
+  if (write(fd, text, len) != (ssize_t)len) error("write() Failed");
+  close(fd);
+  if (rename(tmp, path) != 0) error("rename() Failed");
+}
+
+/******************************************************************************/
+/**
+ *
+ * Show a pulse in the tree the way the module does
+ *
+ * \param dir, the tree
+ * \param count, numWattHours
+ * \param ts, time of the pulse, ns since the epoch
+ * \param diff, ns since the pulse before
+ *
+ ******************************************************************************/
+static void showPulse(const char *dir, uint32_t count, uint64_t ts, uint64_t diff)
+{
+  char text[64];
+  unsigned long s = ts / NS_PER_S;
+
+  snprintf(text, sizeof(text), "%u\n", count);
+  writeAttr(dir, "numWattHours", text);
+  snprintf(text, sizeof(text), "%lu.%.9lu\n", (unsigned long)(diff / NS_PER_S),
+	   (unsigned long)(diff % NS_PER_S));
+  writeAttr(dir, "diffTime", text);
+  snprintf(text, sizeof(text), "%.2lu:%.2lu:%.2lu:%.9lu \n", (s / 3600) % 24, (s / 60) % 60, s % 60,
+	   (unsigned long)(ts % NS_PER_S));
+  writeAttr(dir, "lastTime", text);
+  snprintf(text, sizeof(text), "%u %llu\n", count, (unsigned long long)ts);
+  writeAttr(dir, "lastPulse", text);
+}
+
+/* mkdir -p, for the two levels of /tmp/tomas/gpio60 and the like */
+static void makeDir(const char *dir)
+{
+  char path[PATH];
+  char *slash;
+
+  snprintf(path, sizeof(path), "%s", dir);
+  for (slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+      *slash = '\0';
+      if (mkdir(path, 0755) != 0 && errno != EEXIST) error(path);
+      *slash = '/';
+    }
+  if (mkdir(path, 0755) != 0 && errno != EEXIST) error(path);
+}
+
+int main(int argc, char *argv[])
+{
+  int32_t opt;
+  const char *inName = NULL, *dir = DEFAULT_DIR;
+  double speed = 1;
+  int keep = 0;
+  PulseTraceStruct trace;
+  FILE *in;
+  struct timespec wallStart, realStart, due, now;
+  uint64_t ts, shown, lastShown, ns, late, maxLate = 0, sumLate = 0, numPulses = 0;
+  uint32_t missed;
+
+  while ((opt = getopt(argc, argv, "hi:d:x:k")) != -1)
+    {
+      switch (opt)
+	{
+	case 'i':
+	  inName = optarg;
+	  break;
+	case 'd':
+	  dir = optarg;
+	  break;
+	case 'x':
+	  speed = atof(optarg);
+	  break;
+	case 'k':
+	  keep = 1;
+	  break;
+	case 'h':
+	  usage();
+	  return 0;
+	default:
+	  usage();
+	  error("Unrecognized input");
+	  break;
+	}
+    }
+  if (inName == NULL || speed <= 0) error("Bad arguments");
+
+  in = (strcmp(inName, "-") == 0) ? stdin : fopen(inName, "r");
+  if (in == NULL) error("fopen() Failed");
+  if (pulseTraceOpen(&trace, in) != 0) error("Not a pulse trace");
+
+  makeDir(dir);
+  writeAttr(dir, "ledOn", "0\n");
+  writeAttr(dir, "isDebounce", "1\n");
+  clock_gettime(CLOCK_MONOTONIC, &wallStart);
+  clock_gettime(CLOCK_REALTIME, &realStart);
+  lastShown = keep ? trace.header.startNs : nsOf(&realStart);
+  showPulse(dir, trace.count, lastShown, 0);
+
+  while (pulseTraceRead(&trace, &ts, &missed) == 1)
+    {
+      ns = (uint64_t)((ts - trace.header.startNs) / speed);
+      due.tv_sec = wallStart.tv_sec + (wallStart.tv_nsec + ns) / NS_PER_S;
+      due.tv_nsec = (wallStart.tv_nsec + ns) % NS_PER_S;
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+
+      shown = keep ? ts : nsOf(&realStart) + ns;
+      showPulse(dir, trace.count, shown, shown - lastShown);
+      lastShown = shown;
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      late = nsOf(&now) - nsOf(&due);
+      if (late > maxLate) maxLate = late;
+      sumLate += late;
+      numPulses++;
+    }
+
+  fprintf(stderr, "%llu pulses, written %.3f ms late on average, %.3f ms at most\n",
+	  (unsigned long long)numPulses, numPulses ? sumLate / 1e6 / numPulses : 0, maxLate / 1e6);
+  return 0;
+}
@@ -0,0 +1,97 @@
+/******************************************************************************/
+/**
+ * \file pulsetrace.c
+ *
+ * \brief Compact file format for pulse traces, see pulsetrace.h
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#include <string.h>
+#include "pulsetrace.h"
+
+static int putVarint(FILE *f, uint64_t v)
+{
+  unsigned char buf[10];
+  int n = 0;
+
+  while (v >= 0x80)
+    {
+      buf[n++] = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+  buf[n++] = v;
+  return (fwrite(buf, 1, n, f) == (size_t)n) ? 0 : -1;
+}
+
+static int getVarint(FILE *f, uint64_t *v)
+{
+  int c, shift = 0;
+
+  *v = 0;
+  do
+    {
+      if ((c = getc(f)) == EOF || shift > 63) return -1;
+      *v |= (uint64_t)(c & 0x7f) << shift;
+      shift += 7;
+    }
+  while (c & 0x80);
+  return 0;
+}
+
+int pulseTraceCreate(PulseTraceStruct *t, FILE *f, const PulseTraceHeaderStruct *header)
+{
+  size_t metaLen = strlen(header->meta);
+
+  t->f = f;
+  t->header = *header;
+  t->ts = header->startNs;
+  t->count = header->startCount;
+  if (fwrite(PULSE_TRACE_MAGIC, 1, 4, f) != 4 || putc(PULSE_TRACE_VERSION, f) == EOF) return -1;
+  if (putVarint(f, header->pulsesPerKwh) != 0 || putVarint(f, header->startCount) != 0 ||
+      putVarint(f, header->startNs) != 0 || putVarint(f, metaLen) != 0) return -1;
+  return (fwrite(header->meta, 1, metaLen, f) == metaLen) ? 0 : -1;
+}
+
+int pulseTraceWrite(PulseTraceStruct *t, uint64_t ts, uint32_t missed)
+{
+  if (ts < t->ts) return -1;
+  if (putVarint(t->f, ((ts - t->ts) << 1) | (missed != 0)) != 0) return -1;
+  if (missed != 0 && putVarint(t->f, missed) != 0) return -1;
+  t->ts = ts;
+  t->count += 1 + missed;
+  return 0;
+}
+
+int pulseTraceOpen(PulseTraceStruct *t, FILE *f)
+{
+  char magic[4];
+  uint64_t pulsesPerKwh, startCount, metaLen;
+
+  t->f = f;
+  if (fread(magic, 1, 4, f) != 4 || memcmp(magic, PULSE_TRACE_MAGIC, 4) != 0) return -1;
+  if (getc(f) != PULSE_TRACE_VERSION) return -1;
+  if (getVarint(f, &pulsesPerKwh) != 0 || getVarint(f, &startCount) != 0 ||
+      getVarint(f, &t->header.startNs) != 0 || getVarint(f, &metaLen) != 0) return -1;
+  if (pulsesPerKwh == 0 || metaLen >= PULSE_TRACE_META) return -1;
+  if (fread(t->header.meta, 1, metaLen, f) != metaLen) return -1;
+  t->header.meta[metaLen] = '\0';
+  t->header.pulsesPerKwh = pulsesPerKwh;
+  t->header.startCount = startCount;
+  t->ts = t->header.startNs;
+  t->count = startCount;
+  return 0;
+}
+
+int pulseTraceRead(PulseTraceStruct *t, uint64_t *ts, uint32_t *missed)
+{
+  uint64_t v, m = 0;
+
+  if (getVarint(t->f, &v) != 0) return 0;
+  if ((v & 1) && getVarint(t->f, &m) != 0) return 0;
+  t->ts += v >> 1;
+  t->count += 1 + m;
+  *ts = t->ts;
+  *missed = m;
+  return 1;
+}
@@ -0,0 +1,104 @@
+/******************************************************************************/
+/**
+ * \file pulsetrace.h
+ *
+ * \brief Compact file format for pulse traces, recorded or generated.
+ *
+ *        | "WMTR" | version | header | record ... |
+ *
+ *        All numbers after the version byte are unsigned LEB128 varints.
+ *        The header is
+ *
+ *        | pulses per kWh | count before the first pulse | start ns |
+ *        | meta length | meta, "key=value" lines |
+ *
+ *        and every record is one pulse
+ *
+ *        | (ns since the previous pulse or start) << 1 | missed? |
+ *        | [missed] |
+ *
+ *        where the low bit tells if the number of pulses the recorder
+ *        missed before this one follows. The count of a pulse is the count
+ *        before it plus 1 + missed, so it is not stored. A typical pulse
+ *        takes 5 bytes. The trace ends at the end of the file, a record cut
+ *        short by a recorder being killed is ignored.
+ *
+ * \author Tomas Rosenkvist
+ *
+ ******************************************************************************/
+#ifndef PULSETRACE_H
+#define PULSETRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PULSE_TRACE_MAGIC "WMTR"
+#define PULSE_TRACE_VERSION (1)
+#define PULSE_TRACE_META (1024)
+
+typedef struct
+{
+  uint32_t pulsesPerKwh;     /* Impulse constant of the meter */
+  uint32_t startCount;       /* numWattHours before the first pulse */
+  uint64_t startNs;          /* ns since the epoch the trace starts at */
+  char meta[PULSE_TRACE_META];  /* Where and how it was made, text */
+} PulseTraceHeaderStruct;
+
+typedef struct
+{
+  FILE *f;
+  PulseTraceHeaderStruct header;
+  uint64_t ts;               /* Time of the last pulse */
+  uint32_t count;            /* Count of the last pulse */
+} PulseTraceStruct;
+
+/******************************************************************************/
+/**
+ *
+ * Start a trace by writing its header
+ *
+ * \param t, the trace
+ * \param f, file to write to
+ * \param header, the header
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int pulseTraceCreate(PulseTraceStruct *t, FILE *f, const PulseTraceHeaderStruct *header);
+
+/******************************************************************************/
+/**
+ *
+ * Add a pulse, which may not be earlier than the one before
+ *
+ * \param t, the trace
+ * \param ts, time of the pulse, ns since the epoch
+ * \param missed, pulses that happened since the one before without being seen
+ * \return 0 if successful, otherwise -1
+ *
+ ******************************************************************************/
+int pulseTraceWrite(PulseTraceStruct *t, uint64_t ts, uint32_t missed);
+
+/******************************************************************************/
+/**
+ *
+ * Open a trace by reading its header into t->header
+ *
+ * \return 0 if successful, -1 if it is not a trace that can be read
+ *
+ ******************************************************************************/
+int pulseTraceOpen(PulseTraceStruct *t, FILE *f);
+
+/******************************************************************************/
+/**
+ *
+ * Read the next pulse, its count is in t->count afterwards
+ *
+ * \param t, the trace
+ * \param ts, time of the pulse
+ * \param missed, pulses missed before it
+ * \return 1 if a pulse was read, 0 at the end of the trace
+ *
+ ******************************************************************************/
+int pulseTraceRead(PulseTraceStruct *t, uint64_t *ts, uint32_t *missed);
+
+#endif